@@ -0,0 +1,270 @@
+/*
+ * kpack: turns the kernel ELF binary into the image that is written to disk
+ * after the boot loader.
+ *
+ * usage: kpack [-n] <kernel> <output>
+ *
+ * The output is an ELF file with only the ELF header, the program headers and
+ * the contents of the loadable segments. Section headers, symbols and debug
+ * information are left out, as are the zero-filled tails (BSS) of segments.
+ * Each segment is compressed as a single LZ4 block, unless -n is given or the
+ * segment does not compress. Compressed segments have ELF_PROG_FLAG_LZ4 set in
+ * p_flags and p_filesz holds their compressed size.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/elf.h"
+
+#define SECTSIZE 512
+
+/* The boot loader reads the ELF header and the program headers from the first
+ * page of the image. */
+#define HDR_MAX 4096
+
+#define MINMATCH     4
+#define MFLIMIT      12
+#define LASTLITERALS 5
+#define MAX_OFFSET   65535
+#define HASH_LOG     16
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+
+	*op++ = len;
+
+	return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+	size_t off, size_t len)
+{
+	uint8_t *token = op++;
+
+	*token = (nlit >= 15 ? 15 : nlit) << 4;
+
+	if (nlit >= 15)
+		op = put_length(op, nlit - 15);
+
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	/* The last sequence has no match. */
+	if (!len)
+		return op;
+
+	*op++ = off & 0xFF;
+	*op++ = off >> 8;
+
+	len -= MINMATCH;
+	*token |= len >= 15 ? 15 : len;
+
+	if (len >= 15)
+		op = put_length(op, len - 15);
+
+	return op;
+}
+
+/* Compresses n bytes at src into an LZ4 block at dst, which must be able to
+ * hold at least n + n / 255 + 16 bytes. This is a simple greedy compressor
+ * that follows the restrictions of the reference implementation on the end of
+ * the block, such that the output can be decoded by any LZ4 decoder.
+ *
+ * Returns the size of the block.
+ */
+static size_t lz4_compress(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	static uint32_t table[1 << HASH_LOG];
+	const uint8_t *ip = src, *anchor = src, *end = src + n;
+	const uint8_t *ref;
+	uint8_t *op = dst;
+	size_t len;
+	uint32_t h;
+
+	memset(table, 0, sizeof table);
+
+	while (n >= MFLIMIT && ip <= end - MFLIMIT) {
+		h = hash32(read32(ip));
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_OFFSET ||
+		    read32(ref) != read32(ip)) {
+			++ip;
+			continue;
+		}
+
+		while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			--ip, --ref;
+
+		len = MINMATCH;
+
+		while (ip + len < end - LASTLITERALS && ip[len] == ref[len])
+			++len;
+
+		op = put_sequence(op, anchor, ip - anchor, ip - ref, len);
+		ip += len;
+		anchor = ip;
+	}
+
+	op = put_sequence(op, anchor, end - anchor, 0, 0);
+
+	return op - dst;
+}
+
+static void *xmalloc(size_t n)
+{
+	void *p = malloc(n ? n : 1);
+
+	if (!p) {
+		perror("kpack: malloc");
+		exit(1);
+	}
+
+	return p;
+}
+
+/* Reads the whole file at path into memory. */
+static uint8_t *read_file(const char *path, size_t *size)
+{
+	uint8_t *buf;
+	FILE *f;
+	long n;
+
+	if (!(f = fopen(path, "rb")) || fseek(f, 0, SEEK_END) < 0 ||
+	    (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	buf = xmalloc(n);
+
+	if (fread(buf, 1, n, f) != (size_t)n) {
+		perror(path);
+		exit(1);
+	}
+
+	fclose(f);
+	*size = n;
+
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	struct elf *elf, *out_elf;
+	struct elf_proghdr *ph, *out_ph;
+	uint8_t *in, *out, *seg;
+	size_t in_size, out_size, hdr_size, size, i;
+	int compress = 1;
+	FILE *f;
+
+	if (argc == 4 && !strcmp(argv[1], "-n")) {
+		compress = 0;
+		++argv, --argc;
+	}
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: kpack [-n] <kernel> <output>\n");
+		return 1;
+	}
+
+	in = read_file(argv[1], &in_size);
+	elf = (struct elf *)in;
+
+	if (in_size < sizeof *elf || elf->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		return 1;
+	}
+
+	hdr_size = sizeof *elf + elf->e_phnum * sizeof *ph;
+
+	if (elf->e_phentsize != sizeof *ph || hdr_size > HDR_MAX ||
+	    elf->e_phoff + elf->e_phnum * sizeof *ph > in_size) {
+		fprintf(stderr, "%s: bad program headers\n", argv[1]);
+		return 1;
+	}
+
+	/* Worst case: every segment is stored as is, sector aligned. */
+	out_size = HDR_MAX;
+	ph = (struct elf_proghdr *)(in + elf->e_phoff);
+
+	for (i = 0; i < elf->e_phnum; ++i) {
+		if (ph[i].p_offset + ph[i].p_filesz > in_size) {
+			fprintf(stderr, "%s: segment %zu out of bounds\n", argv[1], i);
+			return 1;
+		}
+
+		out_size += ph[i].p_filesz + ph[i].p_filesz / 255 + 16 + SECTSIZE;
+	}
+
+	out = xmalloc(out_size);
+	memset(out, 0, out_size);
+
+	/* The program headers directly follow the ELF header. */
+	out_elf = (struct elf *)out;
+	*out_elf = *elf;
+	out_elf->e_phoff = sizeof *elf;
+	out_elf->e_shoff = 0;
+	out_elf->e_shnum = 0;
+	out_elf->e_shstrndx = 0;
+	out_ph = (struct elf_proghdr *)(out + sizeof *elf);
+
+	out_size = (hdr_size + SECTSIZE - 1) & ~(size_t)(SECTSIZE - 1);
+
+	for (i = 0; i < elf->e_phnum; ++i) {
+		out_ph[i] = ph[i];
+
+		if (ph[i].p_type != ELF_PROG_LOAD || !ph[i].p_filesz) {
+			out_ph[i].p_offset = 0;
+			out_ph[i].p_filesz = 0;
+			continue;
+		}
+
+		/* The boot loader reads whole sectors, so the offset must have the
+		 * same offset into a sector as the physical address. */
+		out_size += (ph[i].p_pa - out_size) & (SECTSIZE - 1);
+		seg = out + out_size;
+		out_ph[i].p_offset = out_size;
+
+		size = compress ? lz4_compress(seg, in + ph[i].p_offset,
+			ph[i].p_filesz) : ph[i].p_filesz;
+
+		if (size < ph[i].p_filesz) {
+			out_ph[i].p_flags |= ELF_PROG_FLAG_LZ4;
+			out_ph[i].p_filesz = size;
+		} else {
+			size = ph[i].p_filesz;
+			memcpy(seg, in + ph[i].p_offset, size);
+		}
+
+		out_size += size;
+	}
+
+	if (!(f = fopen(argv[2], "wb")) ||
+	    fwrite(out, 1, out_size, f) != out_size || fclose(f)) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
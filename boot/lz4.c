@@ -0,0 +1,74 @@
+#include <x86/types.h>
+
+/*
+ * Decompressor for LZ4 blocks, as produced by boot/kpack.c.
+ *
+ * A block is a sequence of sequences, each consisting of a token, literals and
+ * a match. The high nibble of the token holds the number of literals and the
+ * low nibble holds the length of the match minus four. A nibble of 15 means
+ * that more length bytes follow, until a byte that is not 255. The literals
+ * are followed by the 16-bit offset of the match, counting back from the
+ * current output position. The last sequence of the block has no match.
+ */
+
+void *memcpy(void *dst, const void *src, size_t n);
+
+static uint32_t lz4_length(const uint8_t **ip, uint32_t len)
+{
+	uint8_t byte;
+
+	if (len != 15)
+		return len;
+
+	do {
+		byte = *(*ip)++;
+		len += byte;
+	} while (byte == 255);
+
+	return len;
+}
+
+/* Decompresses the LZ4 block of n bytes at src into dst.
+ *
+ * Returns the number of bytes written to dst.
+ */
+uint32_t lz4_decompress(void *dst, const void *src, uint32_t n)
+{
+	const uint8_t *ip = src, *iend = ip + n;
+	const uint8_t *match;
+	uint8_t *op = dst;
+	uint32_t len, off;
+	uint8_t token;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = lz4_length(&ip, token >> 4);
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence only has literals. */
+		if (ip >= iend)
+			break;
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		len = lz4_length(&ip, token & 0xF) + 4;
+		match = op - off;
+
+		/* A match may overlap with the bytes it produces, such as for runs of
+		 * the same byte, in which case it has to be copied one byte at a time.
+		 */
+		if (off >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+
+	return op - (uint8_t *)dst;
+}
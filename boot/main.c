@@ -34,18 +34,50 @@
 #define SECTSIZE	512
 #define ELFHDR	  ((struct elf *) 0x10000) /* scratch space */
 
-void readsect(void*, uint32_t);
+/* The BIOS can only read to memory below 1M, so reads that go beyond that are
+ * staged in a buffer at BOUNCE_BUF, BOUNCE_SECTS sectors at a time. */
+#define BOUNCE_BUF	((uint8_t *) 0x20000)
+#define BOUNCE_SECTS	64
+#define BIOS_MEM_LIM	0x100000
+
+/* ATA PIO on the primary IDE controller. */
+#define IDE_DATA	0x1F0
+#define IDE_NSECT	0x1F2
+#define IDE_LBA0	0x1F3
+#define IDE_LBA1	0x1F4
+#define IDE_LBA2	0x1F5
+#define IDE_DRIVE	0x1F6
+#define IDE_CMD		0x1F7
+#define IDE_STATUS	0x1F7
+
+#define IDE_ERR		0x01
+#define IDE_DRQ		0x08
+#define IDE_DF		0x20
+#define IDE_BSY		0x80
+
+#define IDE_CMD_READ	0x20
+#define IDE_MAX_SECTS	256
+
+int readsects(void *, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
+static void ide_probe(void);
 
 extern void puts32(const char *s);
-extern void read_sector32(void *, uint32_t);
+extern int read_sectors32(void *, uint32_t, uint32_t);
+extern uint32_t lz4_decompress(void *, const void *, uint32_t);
+
+/* Whether the boot disk can be read through ATA PIO. */
+static int use_ide;
 
 void bootmain(struct boot_info *boot_info)
 {
 	struct elf_proghdr *ph, *eph;
+	uint32_t stage_pa = 0;
 
 	boot_info->elf_hdr = ELFHDR;
 
+	ide_probe();
+
 	/* read 1st page off disk */
 	readseg((uint32_t) ELFHDR, SECTSIZE * 8, 0);
 
@@ -55,13 +87,38 @@ void bootmain(struct boot_info *boot_info)
 		goto bad;
 	}
 
-	/* load each program segment (ignores ph flags) */
 	ph = (struct elf_proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
+
+	/* Compressed segments are read to the first page after the kernel and
+	 * decompressed from there. */
+	for (; ph < eph; ph++) {
+		if (ph->p_pa + ph->p_memsz > stage_pa)
+			stage_pa = ph->p_pa + ph->p_memsz;
+	}
+
+	stage_pa = (stage_pa + 4095) & ~4095;
+
+	/* load each program segment. Only the first p_filesz bytes are stored on
+	 * disk: the rest is BSS, which the kernel clears itself. */
+	ph = (struct elf_proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	for (; ph < eph; ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || !ph->p_filesz)
+			continue;
+
 		/* p_pa is the load address of this segment (as well as the physical
 		 * address) */
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+		if (!(ph->p_flags & ELF_PROG_FLAG_LZ4)) {
+			readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+			continue;
+		}
+
+		readseg(stage_pa + ph->p_offset % SECTSIZE, ph->p_filesz,
+			ph->p_offset);
+		lz4_decompress((void *) (uint32_t) ph->p_pa,
+			(void *) (stage_pa + (uint32_t) ph->p_offset % SECTSIZE),
+			ph->p_filesz);
+	}
 
 	/* call the entry point from the ELF header
 	 * note: does not return! */
@@ -77,16 +134,131 @@ bad:
 
 void *memcpy(void *dst, const void *src, size_t n)
 {
-	const char *s = src;
-	char *d = dst;
+	const void *s = src;
+	void *d = dst;
+	uint32_t nwords = n / 4, nbytes = n % 4;
 
-	while (n--) {
-		*d++ = *s++;
-	}
+	asm volatile("cld; rep movsl\n"
+		: "+D" (d), "+S" (s), "+c" (nwords) :: "cc", "memory");
+	asm volatile("rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (nbytes) :: "memory");
 
 	return dst;
 }
 
+/* Waits for the drive to finish the current command.
+ *
+ * Returns 0 if the drive is ready and -1 on errors or if there is no drive.
+ */
+static int ide_wait(void)
+{
+	uint8_t status;
+
+	/* A floating bus reads as 0xFF, which would otherwise look busy forever. */
+	do {
+		status = inb(IDE_STATUS);
+	} while ((status & IDE_BSY) && status != 0xFF);
+
+	if (status == 0xFF || (status & (IDE_ERR | IDE_DF)))
+		return -1;
+
+	return 0;
+}
+
+/* Reads count sectors (at most IDE_MAX_SECTS) starting at LBA offset from the
+ * primary master straight into dst using a single multi-sector command.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+static int ide_read(void *dst, uint32_t offset, uint32_t count)
+{
+	uint8_t *p = dst;
+
+	if (ide_wait() < 0)
+		return -1;
+
+	outb(IDE_NSECT, count & 0xFF);
+	outb(IDE_LBA0, offset);
+	outb(IDE_LBA1, offset >> 8);
+	outb(IDE_LBA2, offset >> 16);
+	outb(IDE_DRIVE, 0xE0 | ((offset >> 24) & 0xF));
+	outb(IDE_CMD, IDE_CMD_READ);
+
+	for (; count > 0; --count, p += SECTSIZE) {
+		if (ide_wait() < 0 || !(inb(IDE_STATUS) & IDE_DRQ))
+			return -1;
+
+		insl(IDE_DATA, p, SECTSIZE / 4);
+	}
+
+	return 0;
+}
+
+/* Checks whether the primary master is the disk we have booted from by reading
+ * the first sector of stage 2 through both the BIOS and ATA PIO. If it is, the
+ * rest of the kernel is read through ATA PIO.
+ */
+static void ide_probe(void)
+{
+	uint8_t *bios = BOUNCE_BUF, *ide = BOUNCE_BUF + SECTSIZE;
+	size_t i;
+
+	if (read_sectors32(bios, 1, 1) || ide_read(ide, 1, 1))
+		return;
+
+	for (i = 0; i < SECTSIZE; ++i) {
+		if (bios[i] != ide[i])
+			return;
+	}
+
+	use_ide = 1;
+}
+
+/*
+ * Read up to 'count' sectors starting at sector 'offset' to 'dst'.
+ *
+ * Returns the number of sectors read, which is at least one.
+ */
+int readsects(void *dst, uint32_t offset, uint32_t count)
+{
+	uint32_t pa = (uint32_t)dst;
+
+	if (use_ide) {
+		if (count > IDE_MAX_SECTS)
+			count = IDE_MAX_SECTS;
+
+		if (!ide_read(dst, offset, count))
+			return count;
+
+		/* Fall back to the BIOS from here on. */
+		use_ide = 0;
+	}
+
+	if (count > BOUNCE_SECTS)
+		count = BOUNCE_SECTS;
+
+	/* Read straight into the destination if the BIOS can reach it. */
+	if (pa + count * SECTSIZE <= BIOS_MEM_LIM) {
+		if (read_sectors32(dst, offset, count))
+			goto bad;
+
+		return count;
+	}
+
+	if (read_sectors32(BOUNCE_BUF, offset, count))
+		goto bad;
+
+	memcpy(dst, BOUNCE_BUF, count * SECTSIZE);
+
+	return count;
+
+bad:
+	puts32("Disk error!");
+
+	while (1)
+		/* do nothing */;
+}
+
 /*
  * Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
  * Might copy more than asked.
@@ -106,22 +278,15 @@ void readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	offset += 1;
 	offset += (stage2_end - stage2 + SECTSIZE - 1) / SECTSIZE;
 
-	/* If this is too slow, we could read lots of sectors at a time. We'd write
-	 * more to memory than asked, but it doesn't matter -- we load in increasing
-	 * order. */
+	/* Read as many sectors at a time as possible. We may write more to memory
+	 * than asked, but it doesn't matter -- we load in increasing order. */
 	while (pa < end_pa) {
 		/* Since we haven't enabled paging yet and we're using an identity
 		 * segment mapping (see boot.S), we can use physical addresses directly.
 		 * This won't be the case once OpenLSD enables the MMU. */
-		readsect((uint8_t *) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		count = readsects((uint8_t *) pa,
+			offset, (end_pa - pa + SECTSIZE - 1) / SECTSIZE);
+		pa += count * SECTSIZE;
+		offset += count;
 	}
 }
-
-void readsect(void *dst, uint32_t offset)
-{
-	read_sector32((void *)0x1000, offset);
-	memcpy(dst, (void *)0x1000, SECTSIZE);
-}
-
@@ -1,6 +1,6 @@
 from __future__ import print_function
 
-import sys, os, re, time, socket, select, subprocess, errno, shutil
+import sys, os, re, time, socket, select, subprocess, errno, shutil, json
 from subprocess import check_call, Popen
 from optparse import OptionParser
 
@@ -489,6 +489,51 @@ Failed to shutdown QEMU.  You might need to 'killall qemu' or
 
         assert_lines_match(self.qemu.output, *args, **kwargs)
 
+##################################################################
+# Benchmarks
+#
+
+__all__ += ["parse_bench", "save_bench", "load_bench", "compare_bench"]
+
+def parse_bench(text):
+    """Parse the lines of the form "BENCH name=<name> key=<int> ..." printed
+    by the benchmark kernel into a dict mapping every name to a dict of its
+    integer fields."""
+
+    results = {}
+    for line in text.splitlines():
+        m = re.match(r"BENCH name=(\S+)((?: \w+=\d+)*)\s*$", line)
+        if m:
+            results[m.group(1)] = dict(
+                (k, int(v)) for k, v in re.findall(r"(\w+)=(\d+)", m.group(2)))
+    return results
+
+def save_bench(path, results):
+    with open(path, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+def load_bench(path):
+    with open(path) as f:
+        return json.load(f)
+
+def compare_bench(results, baseline, tolerance, key="cycles_per_op"):
+    """Compare the results against the baseline.  Return a list of
+    messages for every benchmark that is missing or that got slower by
+    more than the given fraction."""
+
+    regressions = []
+    for name in sorted(baseline):
+        if name not in results:
+            regressions.append("%s: missing" % name)
+            continue
+        old, new = baseline[name][key], results[name][key]
+        if new > old * (1 + tolerance):
+            regressions.append("%s: %d -> %d %s (+%.0f%%)" %
+                               (name, old, new, key,
+                                100.0 * (new - old) / max(old, 1)))
+    return regressions
+
 ##################################################################
 # Monitors
 #
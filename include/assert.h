@@ -2,6 +2,9 @@
 
 #include <stdio.h>
 
+/* The message of the first panic, or NULL if the kernel has not panicked. */
+extern const char *panicstr;
+
 void _warn(const char*, int, const char*, ...);
 void _panic(const char*, int, const char*, ...) __attribute__((noreturn));
 
@@ -4,6 +4,22 @@
 
 #define SECT_SIZE 512
 
+/* Memory map entry types. */
+#define MMAP_FREE             1
+#define MMAP_RESERVED         2
+#define MMAP_ACPI_RECLAIMABLE 3
+#define MMAP_ACPI_NVS         4
+#define MMAP_BAD              5
+
+/* Offsets into struct boot_info and struct mmap_entry for assembly. */
+#define BOOT_INFO_MMAP_ADDR 0
+#define BOOT_INFO_MMAP_LEN  4
+
+#define MMAP_ENTRY_ADDR 0
+#define MMAP_ENTRY_LEN  8
+#define MMAP_ENTRY_TYPE 16
+#define MMAP_ENTRY_SIZE 24
+
 #ifndef __ASSEMBLER__
 struct boot_info {
 	uint32_t mmap_addr;
@@ -11,14 +27,6 @@ struct boot_info {
 	void *elf_hdr;
 };
 
-enum mmap_type {
-	MMAP_FREE = 1,
-	MMAP_RESERVED = 2,
-	MMAP_ACPI_RECLAIMABLE = 3,
-	MMAP_ACPI_NVS = 4,
-	MMAP_BAD = 5,
-};
-
 struct mmap_entry {
 	uint64_t addr;
 	uint64_t len;
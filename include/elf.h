@@ -51,6 +51,8 @@ struct elf_secthdr {
 #define ELF_PROG_FLAG_EXEC  1
 #define ELF_PROG_FLAG_WRITE 2
 #define ELF_PROG_FLAG_READ  4
+/* OS-specific: the segment is stored as an LZ4 block of p_filesz bytes. */
+#define ELF_PROG_FLAG_LZ4   0x00100000
 
 /* Values for elf_sect_hdr::sh_type */
 #define ELF_SHT_NULL     0
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * An intrusive, chained hash table. Embed a struct hash_node in the objects
+ * and use hash_entry() to get back at the object, like container_of(). The
+ * table does not allocate memory: the caller provides the array of buckets,
+ * whose size must be a power of two, and replaces it with hash_resize() once
+ * hash_needs_resize() says so.
+ *
+ * Writers must be serialized by the caller. Readers may look up nodes while a
+ * node is being inserted or removed, as nodes are published with a single
+ * release store, provided that removed nodes are not reused until all readers
+ * are done with them. Resizing requires exclusive access.
+ */
+struct hash_node {
+	struct hash_node *next;
+	uint64_t hash;
+};
+
+struct hash_table {
+	struct hash_node **buckets;
+	size_t nbuckets;
+	size_t count;
+};
+
+/* The average number of nodes per bucket before the table should grow. */
+#define HASH_MAX_LOAD 2
+
+#define hash_entry(node, type, member) \
+	((node) ? container_of(node, type, member) : NULL)
+
+static inline struct hash_node *hash_bucket_head(struct hash_table *table,
+	uint64_t hash)
+{
+	return __atomic_load_n(table->buckets + (hash & (table->nbuckets - 1)),
+		__ATOMIC_ACQUIRE);
+}
+
+/* Returns the first node from node onwards in its chain with the given hash,
+ * or NULL if there is none.
+ */
+static inline struct hash_node *hash_next_match(struct hash_node *node,
+	uint64_t hash)
+{
+	while (node && node->hash != hash)
+		node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+	return node;
+}
+
+/* Iterates over the nodes with the given hash. */
+#define hash_foreach(table, node, hash_) \
+	for (node = hash_next_match(hash_bucket_head(table, hash_), hash_); \
+	     node; \
+	     node = hash_next_match(__atomic_load_n(&node->next, \
+		__ATOMIC_ACQUIRE), hash_))
+
+static inline int hash_needs_resize(struct hash_table *table)
+{
+	return table->count > table->nbuckets * HASH_MAX_LOAD;
+}
+
+/* Mixes the bits of a 64-bit key, such that keys that only differ in their
+ * upper bits, like page-aligned addresses, end up in different buckets.
+ */
+static inline uint64_t hash64(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return key;
+}
+
+uint64_t hash_str(const char *s);
+void hash_init(struct hash_table *table, struct hash_node **buckets,
+	size_t nbuckets);
+void hash_insert(struct hash_table *table, struct hash_node *node,
+	uint64_t hash);
+int hash_remove(struct hash_table *table, struct hash_node *node);
+struct hash_node *hash_find(struct hash_table *table, uint64_t hash,
+	const void *key, int (*match)(const void *key, struct hash_node *node));
+struct hash_node **hash_resize(struct hash_table *table,
+	struct hash_node **buckets, size_t nbuckets);
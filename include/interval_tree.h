@@ -0,0 +1,32 @@
+#pragma once
+
+#include <types.h>
+#include <rbtree.h>
+
+/*
+ * An interval tree is a red-black tree of ranges [start, end) ordered by their
+ * start address, where every node also tracks the largest end address in its
+ * subtree. This allows looking up the ranges that overlap an address or a
+ * range in O(log n).
+ */
+struct interval {
+	struct rb_node node;
+	uintptr_t start, end;
+	uintptr_t max_end;
+};
+
+static inline struct interval *interval_of(struct rb_node *node)
+{
+	return node ? container_of(node, struct interval, node) : NULL;
+}
+
+void interval_tree_init(struct rb_tree *tree);
+int interval_tree_build(struct rb_tree *tree, struct interval *intervals,
+	size_t n);
+int interval_insert(struct rb_tree *tree, struct interval *interval);
+int interval_remove(struct rb_tree *tree, struct interval *interval);
+struct interval *interval_first_overlap(struct rb_tree *tree, uintptr_t start,
+	uintptr_t end);
+struct interval *interval_next_overlap(struct interval *interval,
+	uintptr_t start, uintptr_t end);
+struct interval *interval_find(struct rb_tree *tree, uintptr_t addr);
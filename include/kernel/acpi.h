@@ -0,0 +1,117 @@
+#pragma once
+
+#include <types.h>
+
+/* The root system description pointer, which is found in the first KiB of the
+ * EBDA or in the BIOS ROM area between 0xE0000 and 0xFFFFF.
+ */
+struct acpi_rsdp {
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_addr;
+
+	/* Only valid if revision >= 2. */
+	uint32_t len;
+	uint64_t xsdt_addr;
+	uint8_t ext_checksum;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+/* The header shared by all system description tables. */
+struct acpi_sdt_hdr {
+	char signature[4];
+	uint32_t len;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+/* The multiple APIC description table (MADT), signature "APIC". */
+struct acpi_madt {
+	struct acpi_sdt_hdr hdr;
+	uint32_t lapic_addr;
+	uint32_t flags;
+	uint8_t entries[];
+} __attribute__((packed));
+
+/* The MADT entries consist of a type and a length followed by the data. */
+struct acpi_madt_entry {
+	uint8_t type;
+	uint8_t len;
+} __attribute__((packed));
+
+enum {
+	ACPI_MADT_LAPIC = 0,
+	ACPI_MADT_IOAPIC = 1,
+	ACPI_MADT_LAPIC_ADDR = 5,
+};
+
+struct acpi_madt_lapic {
+	struct acpi_madt_entry entry;
+	uint8_t acpi_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+#define ACPI_MADT_LAPIC_ENABLED (1 << 0)
+
+struct acpi_madt_lapic_addr {
+	struct acpi_madt_entry entry;
+	uint16_t reserved;
+	uint64_t addr;
+} __attribute__((packed));
+
+/* The system resource affinity table (SRAT), signature "SRAT". */
+struct acpi_srat {
+	struct acpi_sdt_hdr hdr;
+	uint32_t table_revision;
+	uint64_t reserved;
+	uint8_t entries[];
+} __attribute__((packed));
+
+/* The SRAT entries share their header with the MADT entries. */
+enum {
+	ACPI_SRAT_LAPIC = 0,
+	ACPI_SRAT_MEM = 1,
+};
+
+struct acpi_srat_lapic {
+	struct acpi_madt_entry entry;
+	uint8_t domain_lo;
+	uint8_t apic_id;
+	uint32_t flags;
+	uint8_t sapic_eid;
+	uint8_t domain_hi[3];
+	uint32_t clock_domain;
+} __attribute__((packed));
+
+struct acpi_srat_mem {
+	struct acpi_madt_entry entry;
+	uint32_t domain;
+	uint16_t reserved0;
+	uint64_t base;
+	uint64_t len;
+	uint32_t reserved1;
+	uint32_t flags;
+	uint64_t reserved2;
+} __attribute__((packed));
+
+#define ACPI_SRAT_ENABLED (1 << 0)
+
+/* The system locality information table (SLIT), signature "SLIT". The entry
+ * at [i * nlocalities + j] is the distance from domain i to domain j.
+ */
+struct acpi_slit {
+	struct acpi_sdt_hdr hdr;
+	uint64_t nlocalities;
+	uint8_t entries[];
+} __attribute__((packed));
+
+void acpi_init(void);
+void *acpi_find_table(const char *signature);
@@ -16,7 +16,9 @@
 #define CRT_SIZE    (CRT_ROWS * CRT_COLS)
 
 void cons_init(void);
+void cons_intr_init(void);
 int cons_getc(void);
+void cons_flush(void);
 
 void kbd_intr(void);    /* irq 1 */
 void serial_intr(void); /* irq 4 */
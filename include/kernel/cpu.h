@@ -0,0 +1,54 @@
+#pragma once
+
+#include <types.h>
+
+/* The maximum number of CPUs supported by the kernel. */
+#define NCPUS 64
+
+struct page_cache;
+struct klog_ring;
+
+/* The state of every CPU, indexed by the dense CPU index. The boot CPU is
+ * always CPU 0.
+ *
+ * This doubles as the per-CPU data area: the GS base of every CPU points at
+ * its own entry, such that a CPU finds its index, page cache and log ring with
+ * a single load, without having to look itself up first. self is the address
+ * of the entry, for getting at it through GS.
+ */
+struct cpuinfo {
+	struct cpuinfo *self;
+	unsigned cpu_id;
+	unsigned lapic_id;
+	unsigned node;
+	volatile uint32_t started;
+	struct page_cache *cache;
+	struct klog_ring *log;
+} __attribute__((aligned(64)));
+
+extern struct cpuinfo cpus[NCPUS];
+extern size_t ncpus;
+
+void cpu_init(unsigned cpu);
+
+/* Returns the state of the CPU we are running on. */
+static inline struct cpuinfo *this_cpu(void)
+{
+	struct cpuinfo *cpu;
+
+	asm volatile("movq %%gs:%c1, %0" : "=r" (cpu) :
+		"i" (offsetof(struct cpuinfo, self)));
+
+	return cpu;
+}
+
+/* Returns the index of the CPU we are running on. */
+static inline unsigned this_cpu_id(void)
+{
+	unsigned id;
+
+	asm volatile("movl %%gs:%c1, %0" : "=r" (id) :
+		"i" (offsetof(struct cpuinfo, cpu_id)));
+
+	return id;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <types.h>
+
+/* The CPU features the kernel specializes on. AVX2 is only reported, as the
+ * kernel does not save the extended register state and is built without SSE.
+ */
+enum {
+	CPU_FEATURE_ERMS = 1 << 0,
+	CPU_FEATURE_AVX2 = 1 << 1,
+	CPU_FEATURE_PCID = 1 << 2,
+	CPU_FEATURE_INVPCID = 1 << 3,
+	CPU_FEATURE_PAGE1GB = 1 << 4,
+	CPU_FEATURE_RDTSCP = 1 << 5,
+	CPU_NFEATURES = 6,
+};
+
+/* The features of the boot CPU, as probed by cpu_features_init(). The APs are
+ * assumed to support the same features.
+ */
+extern uint32_t cpu_features;
+
+static inline int cpu_has(uint32_t feature)
+{
+	return (cpu_features & feature) == feature;
+}
+
+void cpu_features_init(void);
+void show_cpu_features(void);
@@ -0,0 +1,32 @@
+#pragma once
+
+/* The vector of the IPI that asks a CPU to flush its TLB, right after the IRQs
+ * of the two PICs.
+ */
+#define INT_TLB_SHOOTDOWN 48
+
+/* The vector of the IPI that wakes up an idle CPU when there is work for it. */
+#define INT_KWORK_WAKE 49
+
+/* The spurious interrupt vector of the local APIC. Older local APICs hardwire
+ * the low four bits to ones.
+ */
+#define INT_SPURIOUS 63
+
+/* The number of vectors with an entry stub: the exceptions, the IRQs of the
+ * two PICs and the vectors of the local APIC.
+ */
+#define ISR_NSTUBS 64
+
+#ifndef __ASSEMBLER__
+#include <types.h>
+
+#include <x86-64/idt.h>
+
+typedef void (*intr_handler_t)(struct int_frame *frame);
+
+void idt_init(void);
+void idt_load(void);
+void intr_register(unsigned vector, intr_handler_t handler);
+void int_dispatch(struct int_frame *frame);
+#endif /* !defined(__ASSEMBLER__) */
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <types.h>
+#include <stdarg.h>
+
+#include <kernel/cpu.h>
+
+/* The log levels, from the most to the least severe. */
+enum {
+	KLOG_ERR = 0,
+	KLOG_WARN,
+	KLOG_INFO,
+	KLOG_DEBUG,
+	KLOG_NLEVELS,
+	KLOG_PAD = 0xff,
+};
+
+/* The size of the log ring of every CPU, and the largest amount of text a
+ * single record holds. Longer messages are split into multiple records.
+ */
+#define KLOG_SIZE 8192
+#define KLOG_MAX_TEXT 256
+
+/* Records with a level above this one are logged, but not written to the
+ * console.
+ */
+extern int klog_console_level;
+
+/*
+ * A record in a log ring, followed by len characters of text. Records are
+ * aligned to the size of the header and do not wrap around the end of the
+ * ring: if a record does not fit, a padding record fills up the rest of the
+ * ring and the record goes at the start.
+ */
+struct klog_rec {
+	uint64_t time;
+	uint32_t len;
+	uint16_t size;
+	uint8_t level;
+	uint8_t cpu;
+};
+
+/*
+ * Every CPU has its own log ring, which only that CPU writes to, such that
+ * logging takes neither a lock nor any atomic operations. The positions grow
+ * forever and are taken modulo KLOG_SIZE to index the ring.
+ *
+ * Before writing a record, the CPU advances reserve to the end of the record
+ * and tail past the oldest records that get overwritten, and once the record
+ * is complete, it advances head. Readers copy records between tail and head,
+ * and then check reserve to find out whether the copy got overwritten
+ * meanwhile.
+ */
+struct klog_ring {
+	char buf[KLOG_SIZE] __attribute__((aligned(sizeof(struct klog_rec))));
+	volatile uint64_t tail, head, reserve;
+};
+
+/* The position of a reader in every ring, and where it stops. */
+struct klog_reader {
+	uint64_t pos[NCPUS];
+	uint64_t end[NCPUS];
+};
+
+extern struct klog_ring klog_rings[NCPUS];
+
+void klog_write(int level, const char *s, size_t n);
+int vklog(int level, const char *fmt, va_list ap);
+int klog(int level, const char *fmt, ...);
+void klog_flush(void);
+void klog_reader_init(struct klog_reader *reader);
+int klog_reader_next(struct klog_reader *reader, struct klog_rec *rec,
+	char *text);
+void klog_dump(int level);
+int klog_parse_level(const char *name);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <types.h>
+
+/* The table of text symbols generated by kernel/ksyms.awk at build time. */
+extern const uint64_t ksym_count;
+extern const uintptr_t ksym_addrs[];
+extern const uint32_t ksym_offsets[];
+extern const char ksym_names[];
+
+const char *ksym_lookup(uintptr_t addr, uintptr_t *offset);
+void print_ksym(uintptr_t addr);
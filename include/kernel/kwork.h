@@ -0,0 +1,49 @@
+#pragma once
+
+#include <types.h>
+
+#include <x86-64/asm.h>
+
+/* The number of work items every CPU can have queued. Work submitted to a full
+ * queue runs right away instead.
+ */
+#define KWORK_QUEUE_SIZE 256
+
+/* A piece of work that any CPU may run. The item belongs to the submitter,
+ * which has to keep it around until the work is done: pending is set by
+ * kwork_submit() and cleared once fn has returned.
+ */
+struct kwork {
+	void (*fn)(void *arg);
+	void *arg;
+	volatile uint32_t pending;
+};
+
+#define KWORK_INIT(fn, arg) { (fn), (arg), 0 }
+
+/*
+ * The queue of work of a CPU. The CPU itself pushes and pops work at the tail,
+ * such that it runs the work it submitted last while its data is still in the
+ * cache. Idle CPUs steal the oldest work from the head. The positions grow
+ * forever and are taken modulo KWORK_QUEUE_SIZE to index the queue.
+ */
+struct kwork_queue {
+	struct spinlock lock;
+	volatile size_t head, tail;
+	struct kwork *items[KWORK_QUEUE_SIZE];
+} __attribute__((aligned(64)));
+
+static inline void kwork_init_item(struct kwork *work, void (*fn)(void *arg),
+	void *arg)
+{
+	work->fn = fn;
+	work->arg = arg;
+	work->pending = 0;
+}
+
+void kwork_init(void);
+void kwork_submit(struct kwork *work);
+int kwork_run(void);
+void kwork_wait(struct kwork *work);
+void kwork_idle(volatile uint32_t *word, uint32_t val);
+void kwork_wake_all(void);
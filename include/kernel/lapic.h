@@ -0,0 +1,28 @@
+#pragma once
+
+#include <types.h>
+
+/* Local APIC registers, as byte offsets from the base address. */
+#define LAPIC_ID       0x020
+#define LAPIC_VERSION  0x030
+#define LAPIC_EOI      0x0B0
+#define LAPIC_SVR      0x0F0
+#define LAPIC_ICR_LO   0x300
+#define LAPIC_ICR_HI   0x310
+
+/* Spurious interrupt vector register. */
+#define LAPIC_SVR_ENABLE 0x100
+
+/* Interrupt command register. */
+#define LAPIC_ICR_INIT     0x00000500
+#define LAPIC_ICR_STARTUP  0x00000600
+#define LAPIC_ICR_PENDING  0x00001000
+#define LAPIC_ICR_ASSERT   0x00004000
+#define LAPIC_ICR_LEVEL    0x00008000
+
+void lapic_init(physaddr_t pa);
+void lapic_cpu_init(void);
+unsigned lapic_id(void);
+void lapic_ipi(unsigned apic_id, unsigned vector);
+void lapic_eoi(void);
+void lapic_start_ap(unsigned apic_id, physaddr_t entry);
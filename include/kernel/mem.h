@@ -1,5 +1,19 @@
 #pragma once
 
+#include <kernel/mem/arena.h>
 #include <kernel/mem/boot.h>
 #include <kernel/mem/buddy.h>
+#include <kernel/mem/compact.h>
+#include <kernel/mem/cow.h>
+#include <kernel/mem/fault.h>
 #include <kernel/mem/init.h>
+#include <kernel/mem/kmalloc.h>
+#include <kernel/mem/lazy.h>
+#include <kernel/mem/map.h>
+#include <kernel/mem/page_list.h>
+#include <kernel/mem/pcp.h>
+#include <kernel/mem/ptpool.h>
+#include <kernel/mem/slab.h>
+#include <kernel/mem/tlb.h>
+#include <kernel/mem/trace.h>
+#include <kernel/mem/zero.h>
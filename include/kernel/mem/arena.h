@@ -0,0 +1,37 @@
+#pragma once
+
+#include <types.h>
+#include <list.h>
+
+/* The default order of the chunks backing an arena. */
+#define ARENA_ORDER 0
+
+/*
+ * An arena hands out memory by bumping a pointer through chunks of 2^order
+ * pages obtained from the buddy allocator. Objects are never freed one by one:
+ * instead, arena_reset() returns everything allocated since a mark, and
+ * arena_release() returns the whole arena at once.
+ */
+struct arena {
+	struct list chunks;
+	char *cur, *end;
+	size_t order;
+};
+
+/* The header at the start of every chunk. */
+struct arena_chunk {
+	struct list node;
+	size_t order;
+};
+
+/* A position in an arena to rewind to. */
+struct arena_mark {
+	struct arena_chunk *chunk;
+	char *cur;
+};
+
+void arena_init(struct arena *arena, size_t order);
+void *arena_alloc(struct arena *arena, size_t size, size_t align);
+void arena_mark(struct arena *arena, struct arena_mark *mark);
+void arena_reset(struct arena *arena, struct arena_mark *mark);
+void arena_release(struct arena *arena);
@@ -8,5 +8,23 @@
 
 extern char bootstacktop[], bootstack[];
 
+/* The amount of physical memory mapped at KERNEL_VMA, first by the boot stub
+ * and then by direct_map_init(), and the physical end of the page directories
+ * the boot stub allocated past the end of the kernel.
+ */
+extern physaddr_t boot_map_lim, boot_pt_end;
+
+/* The largest number of free regions the memory map may get split up into. */
+#define BOOT_NREGIONS 64
+
+struct boot_region {
+	physaddr_t start, end;
+};
+
+extern struct boot_region boot_regions[BOOT_NREGIONS];
+extern size_t boot_nregions;
+
 void *boot_alloc(uint32_t n);
 void align_boot_info(struct boot_info *boot_info);
+void boot_regions_init(struct boot_info *boot_info);
+void boot_regions_remove(physaddr_t start, physaddr_t end);
@@ -4,12 +4,16 @@
 #include <assert.h>
 #include <paging.h>
 
+#include <x86-64/asm.h>
 #include <x86-64/memory.h>
 
-#define BUDDY_MAX_ORDER (BUDDY_2M_PAGE + 1)
+#include <kernel/mem/numa.h>
+
+#define BUDDY_MAX_ORDER (BUDDY_1G_PAGE + 1)
 
 extern struct page_info *pages;
 extern size_t npages;
+extern size_t npages_init;
 
 /*
  * This macro takes a kernel virtual address -- an address that points above
@@ -43,6 +47,10 @@ enum {
 	ALLOC_ZERO = 1 << 0,
 	ALLOC_HUGE = 1 << 1,
 	ALLOC_PREMAPPED = 1 << 2,
+	ALLOC_1G = 1 << 3,
+	/* The page can be moved elsewhere or is easy to give back. */
+	ALLOC_MOVABLE = 1 << 4,
+	ALLOC_RECLAIMABLE = 1 << 5,
 };
 
 /* The buddy allocator order for known page sizes. */
@@ -52,14 +60,84 @@ enum {
 	BUDDY_1G_PAGE = 18,
 };
 
+/*
+ * Physical memory is grouped into pageblocks of 2^PAGEBLOCK_ORDER pages by the
+ * mobility of their pages. Free chunks are kept on the free lists of the type
+ * of their pageblock, and allocations split chunks of their own type first,
+ * such that pages that can never be moved do not end up scattered across all
+ * huge pages. Only if a type runs out does it claim a pageblock of another
+ * type.
+ */
+#define PAGEBLOCK_ORDER BUDDY_2M_PAGE
+#define PAGEBLOCK_PAGES ((size_t)1 << PAGEBLOCK_ORDER)
+
+enum {
+	MIGRATE_UNMOVABLE,
+	MIGRATE_RECLAIMABLE,
+	MIGRATE_MOVABLE,
+	MIGRATE_TYPES,
+};
+
+/* Counters of the buddy allocator, see buddy_get_stats(). */
+struct buddy_stats {
+	/* The number of free chunks of every order. */
+	size_t nfree[BUDDY_MAX_ORDER];
+
+	/* The total number of free order 0 pages across all orders. */
+	size_t nfree_pages;
+};
+
+/* Every NUMA node has its own zone with free lists and counters. A chunk never
+ * spans multiple nodes, so buddies are always in the same zone, and splitting
+ * or merging a chunk only ever takes the lock of a single zone.
+ */
+struct buddy_zone {
+	/* Protects the free lists, the free mask and the counters. */
+	struct spinlock lock;
+
+	/* The list of free chunks for every migrate type and order. */
+	struct page_list free_list[MIGRATE_TYPES][BUDDY_MAX_ORDER];
+
+	/* Bit n of free_mask[t] is set if and only if free_list[t][n] is not
+	 * empty.
+	 */
+	uint32_t free_mask[MIGRATE_TYPES];
+
+	struct buddy_stats stats;
+};
+
+extern struct buddy_zone buddy_zones[NNODES];
+
+void buddy_init(void);
+void buddy_get_stats(struct buddy_stats *stats);
 size_t count_free_pages(size_t order);
 void show_buddy_info(void);
 size_t count_total_free_pages(void);
+size_t count_node_free_pages(unsigned node);
 struct page_info *page_alloc(int alloc_flags);
+struct page_info *page_alloc_order(size_t order, int alloc_flags);
 struct page_info *buddy_find(size_t req_order);
+struct page_info *buddy_find_type(size_t req_order, unsigned migrate);
+struct page_info *buddy_find_node(unsigned node, size_t req_order,
+	unsigned migrate);
+void count_pageblocks(size_t *nblocks);
+struct page_info *buddy_split(struct page_info *lhs, size_t req_order);
+struct page_info *buddy_merge(struct page_info *page);
+void buddy_free_range(physaddr_t start, physaddr_t end);
+int buddy_isolate_pageblock(struct page_info *block);
 void page_free(struct page_info *pp);
+size_t page_alloc_bulk(struct page_info **pp, size_t n, size_t order,
+	int alloc_flags);
+void page_free_bulk(struct page_info **pp, size_t n);
+void page_put(struct page_info *pp);
 void page_decref(struct page_info *pp);
 
+/* Takes a reference to the page, which must be in use already. */
+static inline void page_get(struct page_info *pp)
+{
+	xadd(&pp->pp_ref, 1);
+}
+
 static inline physaddr_t page2pa(struct page_info *pp)
 {
 	return (pp - pages) << PAGE_TABLE_SHIFT;
@@ -77,3 +155,39 @@ static inline void *page2kva(struct page_info *pp)
 {
 	return KADDR(page2pa(pp));
 }
+
+/* Returns the first page of the pageblock the page belongs to. */
+static inline struct page_info *pageblock_of(struct page_info *pp)
+{
+	return pages + ((pp - pages) & ~(PAGEBLOCK_PAGES - 1));
+}
+
+/* The migrate types live in an array of their own rather than in the first
+ * page of every pageblock, as that page may be in use, and its owner updates
+ * the flags of the page without the lock of the zone. A type only changes with
+ * the lock of the zone of its pageblock held, and is a byte of its own, so it
+ * can be read without the lock.
+ */
+extern uint8_t *pageblock_types;
+
+static inline unsigned page_migrate_type(struct page_info *pp)
+{
+	return pageblock_types[(pp - pages) >> PAGEBLOCK_ORDER];
+}
+
+static inline void pageblock_set_migrate(struct page_info *pp,
+	unsigned migrate)
+{
+	pageblock_types[(pp - pages) >> PAGEBLOCK_ORDER] = migrate;
+}
+
+static inline unsigned alloc_migrate_type(int alloc_flags)
+{
+	if (alloc_flags & ALLOC_MOVABLE)
+		return MIGRATE_MOVABLE;
+
+	if (alloc_flags & ALLOC_RECLAIMABLE)
+		return MIGRATE_RECLAIMABLE;
+
+	return MIGRATE_UNMOVABLE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <types.h>
+#include <hash.h>
+#include <paging.h>
+
+/* A pageblock is only compacted if at least this many of its pages are free,
+ * as every page that is in use has to be copied.
+ */
+#define COMPACT_MIN_FREE (PAGEBLOCK_PAGES / 2)
+
+/*
+ * Pages allocated with page_alloc_movable() may be moved to another physical
+ * location by compaction at any time they are not pinned. The owner is a
+ * pointer to the page that the owner keeps, and that is updated whenever the
+ * page moves. The owner must pin the page with page_pin_movable() for as long
+ * as it accesses the contents, and must not access them otherwise, as they may
+ * be getting copied. The pages must not be mapped, as there is no way to find
+ * the page table entries pointing to them.
+ */
+struct movable_page {
+	struct hash_node node;
+	struct page_info *page;
+	struct page_info **owner;
+};
+
+void compact_init(void);
+struct page_info *page_alloc_movable(size_t order, int alloc_flags,
+	struct page_info **owner);
+void page_free_movable(struct page_info *page);
+struct page_info *page_pin_movable(struct page_info **owner);
+void page_unpin_movable(struct page_info *page);
+size_t count_movable_pages(void);
+size_t compact_memory(size_t order);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <types.h>
+#include <paging.h>
+
+int cow_share(struct page_table *dst, struct page_table *src, uintptr_t va,
+	size_t len);
+int cow_fault(struct page_table *pml4, uintptr_t va);
@@ -8,3 +8,5 @@
 
 void mem_init(struct boot_info *boot_info);
 void page_init(struct boot_info *boot_info);
+int page_init_deferred(void);
+int mem_idle(void);
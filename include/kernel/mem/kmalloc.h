@@ -0,0 +1,14 @@
+#pragma once
+
+#include <types.h>
+
+/* Requests up to KMALLOC_MAX_SIZE bytes are served from slab caches with sizes
+ * of 2^n and 3 * 2^n bytes. Anything larger is a chunk of whole pages.
+ */
+#define KMALLOC_MIN_SIZE 8
+#define KMALLOC_MAX_SIZE 2048
+
+void kmalloc_init(void);
+void *kmalloc(size_t size, int alloc_flags);
+void kfree(void *ptr);
+size_t ksize(void *ptr);
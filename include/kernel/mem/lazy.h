@@ -0,0 +1,9 @@
+#pragma once
+
+#include <types.h>
+#include <paging.h>
+
+int lazy_map(struct page_table *pml4, uintptr_t va, size_t len,
+	uint64_t flags);
+void lazy_unmap(struct page_table *pml4, uintptr_t va, size_t len);
+int lazy_fault(struct page_table *pml4, uintptr_t va);
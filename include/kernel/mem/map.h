@@ -0,0 +1,42 @@
+#pragma once
+
+#include <types.h>
+#include <paging.h>
+
+/* The levels of the page table hierarchy, from the root down. Huge pages are
+ * mapped by the entries of the PDPT (1 GiB) and of the page directories
+ * (2 MiB).
+ */
+enum {
+	MAP_PML4 = 0,
+	MAP_PDPT,
+	MAP_PAGE_DIR,
+	MAP_PAGE_TABLE,
+	MAP_LEVELS,
+};
+
+/* The page tables set up by direct_map_init(), which map all of physical
+ * memory at KERNEL_VMA.
+ */
+extern struct page_table *kernel_pml4;
+
+void direct_map_init(physaddr_t top);
+void direct_map_load(void);
+int map_range(struct page_table *pml4, uintptr_t va, physaddr_t pa, size_t len,
+	uint64_t flags);
+int unmap_range(struct page_table *pml4, uintptr_t va, size_t len);
+physaddr_t *map_find(struct page_table *pml4, uintptr_t va, int *level);
+int map_lookup(struct page_table *pml4, uintptr_t va, physaddr_t *pa,
+	size_t *size);
+void map_destroy(struct page_table *pml4);
+
+struct tlb_batch;
+
+void boot_map_region(struct page_table *pml4, uintptr_t va, size_t size,
+	physaddr_t pa, uint64_t flags);
+struct page_info *page_lookup(struct page_table *pml4, uintptr_t va,
+	physaddr_t **entry_store);
+void page_remove_batch(struct tlb_batch *batch, uintptr_t va);
+void page_remove(struct page_table *pml4, uintptr_t va);
+int page_insert(struct page_table *pml4, struct page_info *page, uintptr_t va,
+	uint64_t flags);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <types.h>
+
+#include <kernel/cpu.h>
+
+/* The maximum number of NUMA nodes supported by the kernel. */
+#define NNODES 8
+
+/* The maximum number of memory ranges that can be assigned to nodes. */
+#define NUMA_NRANGES 32
+
+/* The distance of a node to itself, as used by the ACPI SLIT. */
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+/* A range of physical memory [start, end) that belongs to a node. */
+struct numa_range {
+	physaddr_t start, end;
+	unsigned node;
+};
+
+extern size_t nnodes;
+
+/* For every node, the nodes sorted by distance, starting with the node itself.
+ */
+extern uint8_t numa_fallback[NNODES][NNODES];
+
+void numa_init(void);
+unsigned numa_lookup(physaddr_t pa, physaddr_t *end);
+unsigned numa_distance(unsigned from, unsigned to);
+
+/* Returns the node of the CPU we are running on. */
+static inline unsigned numa_local_node(void)
+{
+	return this_cpu()->node;
+}
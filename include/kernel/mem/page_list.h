@@ -0,0 +1,140 @@
+#pragma once
+
+#include <types.h>
+#include <paging.h>
+
+extern struct page_info *pages;
+
+/*
+ * Doubly linked lists of struct page_info, linked through 32-bit page indices
+ * rather than pointers to keep struct page_info small. The first page on a
+ * list has no previous page and the last page has no next page, i.e. their
+ * links are set to PAGE_NIL. A page that is not on any list links to itself.
+ */
+
+static inline uint32_t page_index(struct page_info *page)
+{
+	return page - pages;
+}
+
+static inline struct page_info *page_at(uint32_t idx)
+{
+	return idx == PAGE_NIL ? NULL : pages + idx;
+}
+
+static inline void page_list_init(struct page_list *list)
+{
+	list->head = PAGE_NIL;
+	list->tail = PAGE_NIL;
+}
+
+static inline int page_list_is_empty(struct page_list *list)
+{
+	return list->head == PAGE_NIL;
+}
+
+static inline struct page_info *page_list_head(struct page_list *list)
+{
+	return page_at(list->head);
+}
+
+static inline struct page_info *page_list_tail(struct page_list *list)
+{
+	return page_at(list->tail);
+}
+
+static inline struct page_info *page_list_next(struct page_info *page)
+{
+	return page_at(page->pp_next);
+}
+
+static inline struct page_info *page_list_prev(struct page_info *page)
+{
+	return page_at(page->pp_prev);
+}
+
+#define page_list_foreach(list, page) \
+	for (page = page_list_head(list); page; page = page_list_next(page))
+#define page_list_foreach_safe(list, page, next) \
+	for (page = page_list_head(list), next = page ? page_list_next(page) : \
+		NULL; page; page = next, next = page ? page_list_next(page) : NULL)
+
+/* Marks the page as not being on any list. */
+static inline void page_node_init(struct page_info *page)
+{
+	page->pp_next = page->pp_prev = page_index(page);
+}
+
+/* Returns whether the page is on a list. */
+static inline int page_is_listed(struct page_info *page)
+{
+	return page->pp_next != page_index(page);
+}
+
+static inline void page_list_add(struct page_list *list,
+	struct page_info *page)
+{
+	uint32_t idx = page_index(page);
+
+	page->pp_prev = PAGE_NIL;
+	page->pp_next = list->head;
+
+	if (list->head != PAGE_NIL)
+		pages[list->head].pp_prev = idx;
+	else
+		list->tail = idx;
+
+	list->head = idx;
+}
+
+static inline void page_list_add_tail(struct page_list *list,
+	struct page_info *page)
+{
+	uint32_t idx = page_index(page);
+
+	page->pp_next = PAGE_NIL;
+	page->pp_prev = list->tail;
+
+	if (list->tail != PAGE_NIL)
+		pages[list->tail].pp_next = idx;
+	else
+		list->head = idx;
+
+	list->tail = idx;
+}
+
+static inline void page_list_del(struct page_list *list,
+	struct page_info *page)
+{
+	if (page->pp_prev != PAGE_NIL)
+		pages[page->pp_prev].pp_next = page->pp_next;
+	else
+		list->head = page->pp_next;
+
+	if (page->pp_next != PAGE_NIL)
+		pages[page->pp_next].pp_prev = page->pp_prev;
+	else
+		list->tail = page->pp_prev;
+
+	page_node_init(page);
+}
+
+static inline struct page_info *page_list_pop(struct page_list *list)
+{
+	struct page_info *page = page_list_head(list);
+
+	if (page)
+		page_list_del(list, page);
+
+	return page;
+}
+
+static inline struct page_info *page_list_pop_tail(struct page_list *list)
+{
+	struct page_info *page = page_list_tail(list);
+
+	if (page)
+		page_list_del(list, page);
+
+	return page;
+}
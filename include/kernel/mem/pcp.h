@@ -0,0 +1,48 @@
+#pragma once
+
+#include <paging.h>
+
+#include <kernel/cpu.h>
+
+/* The number of pages freed by page_put() that a CPU collects before freeing
+ * them.
+ */
+#define PCP_DEFER_MAX 32
+
+/*
+ * Per-CPU page (pcp) cache of order 0 pages sitting in front of the buddy
+ * allocator. Pages on these lists are not free as far as the buddy allocator
+ * is concerned: they are marked as in use and have not been merged with their
+ * buddies.
+ *
+ * An empty cache is refilled with batch pages at once. Once a cache holds more
+ * than high pages, it is drained back down to low pages.
+ *
+ * Pages whose last reference is dropped by page_put() are first collected in
+ * the deferred array of the CPU, and freed PCP_DEFER_MAX at a time with the
+ * lock taken once, rather than going through the allocator every time a
+ * shared page is released.
+ *
+ * The lock is almost always taken by the CPU owning the cache, and only
+ * contended when another CPU drains all caches because it ran out of memory.
+ */
+struct page_cache {
+	struct spinlock lock;
+	struct page_list free_list;
+	size_t count;
+	size_t low;
+	size_t high;
+	size_t batch;
+	size_t ndeferred;
+	struct page_info *deferred[PCP_DEFER_MAX];
+};
+
+extern struct page_cache page_caches[NCPUS];
+
+void page_cache_init(void);
+struct page_info *page_cache_alloc(void);
+void page_cache_free(struct page_info *page);
+void page_cache_defer(struct page_info *page);
+size_t page_cache_drain(struct page_cache *cache, size_t target);
+size_t page_cache_drain_all(void);
+size_t count_cached_pages(void);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <paging.h>
+
+/* The number of free page-table pages the pool holds on to. */
+#define PT_POOL_MAX 256
+
+/*
+ * Pool of free page-table pages. The pages are all zeroes, such that a new
+ * table can be handed out without clearing it, and they are recycled without
+ * going through the buddy allocator. Page tables from the pool have pp_pt set
+ * and count the entries they have in use in pp_nents, such that only those
+ * have to be cleared again once the table is freed, which is none at all for
+ * tables that got emptied by unmapping.
+ */
+struct pt_pool {
+	struct spinlock lock;
+	struct page_list free_list;
+	size_t count;
+};
+
+void pt_pool_init(void);
+struct page_info *pt_alloc(void);
+void pt_free(struct page_info *page);
+size_t pt_pool_drain(void);
+size_t count_pt_pool_pages(void);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <types.h>
+#include <list.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+
+/* The number of objects every CPU keeps around per cache, and the number of
+ * objects moved between the per-CPU cache and the slabs at once.
+ */
+#define KMEM_CPU_OBJS 16
+#define KMEM_CPU_BATCH (KMEM_CPU_OBJS / 2)
+
+/* Slabs are at most 2^KMEM_MAX_ORDER pages. The order is picked such that a
+ * slab holds at least KMEM_MIN_OBJS objects, if possible.
+ */
+#define KMEM_MAX_ORDER 3
+#define KMEM_MIN_OBJS 8
+
+/* The number of empty slabs a cache holds on to before returning them to the
+ * buddy allocator.
+ */
+#define KMEM_MAX_EMPTY 1
+
+/* A per-CPU stack of free objects sitting in front of the slabs. */
+struct kmem_cpu_cache {
+	size_t count;
+	void *objs[KMEM_CPU_OBJS];
+};
+
+/*
+ * A cache of objects of a fixed size. The objects are carved out of slabs:
+ * chunks of 2^order pages obtained from page_alloc_order(), which start with
+ * a struct kmem_slab followed by the objects. As chunks are naturally
+ * aligned, the slab of an object is found by rounding its address down to the
+ * size of a slab.
+ *
+ * If the cache has a constructor, it is called once for every object when its
+ * slab is created. Objects have to be in their constructed state again by the
+ * time they are freed.
+ */
+struct kmem_cache {
+	const char *name;
+
+	/* The size of an object, the distance between two objects in a slab
+	 * and the offset of the pointer to the next free object within a free
+	 * object.
+	 */
+	size_t size;
+	size_t stride;
+	size_t free_offset;
+
+	/* The order of the slabs, the number of objects per slab and the
+	 * offset of the first object within a slab.
+	 */
+	size_t order;
+	size_t nobjs;
+	size_t obj_offset;
+
+	void (*ctor)(void *obj);
+
+	/* Slabs with some, no and only free objects, protected by lock. The
+	 * per-CPU caches are only touched by their CPU, except when shrinking.
+	 */
+	struct spinlock lock;
+	struct list partial;
+	struct list full;
+	struct list empty;
+	size_t nslabs, nempty;
+
+	/* The node on the list of all caches. */
+	struct list node;
+
+	struct kmem_cpu_cache cpu[NCPUS];
+};
+
+struct kmem_slab {
+	struct list node;
+	struct kmem_cache *cache;
+	void *free;
+	size_t inuse;
+};
+
+void kmem_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+	size_t align, void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *cache);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+size_t kmem_cache_shrink(struct kmem_cache *cache);
+struct kmem_cache *kmem_cache_of(void *obj);
+void show_slab_info(void);
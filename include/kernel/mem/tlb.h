@@ -0,0 +1,42 @@
+#pragma once
+
+#include <types.h>
+#include <paging.h>
+
+/* The number of pages a batch invalidates one at a time. Once a batch holds
+ * more, flushing the entire TLB is cheaper than invalidating every page.
+ */
+#define TLB_BATCH_MAX 32
+
+/* The number of address spaces every CPU keeps translations cached for when
+ * the CPU supports PCIDs.
+ */
+#define TLB_NPCIDS 8
+
+/*
+ * The invalidations of a batch of changes to the page tables of pml4, along
+ * with the pages and page tables that can only be freed once no TLB maps or
+ * caches them anymore. The batch is flushed at once, such that every other CPU
+ * using the page tables gets a single IPI for all of the changes.
+ */
+struct tlb_batch {
+	struct page_table *pml4;
+	size_t naddrs;
+	int full;
+	uintptr_t addrs[TLB_BATCH_MAX];
+	size_t npages;
+	struct page_info *pages[TLB_BATCH_MAX];
+	struct page_list tables;
+};
+
+void tlb_init(void);
+void tlb_cpu_init(unsigned cpu);
+void tlb_batch_init(struct tlb_batch *batch, struct page_table *pml4);
+void tlb_batch_add(struct tlb_batch *batch, uintptr_t va);
+void tlb_batch_add_all(struct tlb_batch *batch);
+void tlb_batch_put(struct tlb_batch *batch, struct page_info *page);
+void tlb_batch_put_table(struct tlb_batch *batch, struct page_info *page);
+void tlb_batch_flush(struct tlb_batch *batch);
+void tlb_forget(struct page_table *pml4);
+void tlb_poll(unsigned cpu);
+void pml4_switch(struct page_table *pml4);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <types.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+#include <kernel/mem/buddy.h>
+
+/*
+ * Optional instrumentation of the buddy allocator, enabled by building with
+ * -DMEM_TRACE, e.g. make DEFS=-DMEM_TRACE. Without it, the hooks below expand
+ * to nothing, such that the allocator does not even read the TSC.
+ *
+ * Every CPU records into its own buffer, such that recording needs no locks
+ * and no shared cache lines. The buffers are summed up when dumped.
+ */
+
+/* Latencies are recorded into log2 buckets of TSC cycles: bucket 0 counts
+ * everything below 2^(MEM_TRACE_MIN_SHIFT + 1) cycles, the last bucket
+ * everything from 2^(MEM_TRACE_MIN_SHIFT + MEM_TRACE_NBUCKETS - 1) cycles.
+ */
+#define MEM_TRACE_NBUCKETS 16
+#define MEM_TRACE_MIN_SHIFT 5
+
+/* The operations whose latency is recorded per order. */
+enum {
+	MEM_TRACE_ALLOC,
+	MEM_TRACE_FIND,
+	MEM_TRACE_FREE,
+	MEM_TRACE_NOPS,
+};
+
+struct mem_trace {
+	uint32_t latency[MEM_TRACE_NOPS][BUDDY_MAX_ORDER][MEM_TRACE_NBUCKETS];
+
+	/* The number of times buddy_split() and buddy_merge() went through
+	 * the given number of orders.
+	 */
+	uint32_t split_depth[BUDDY_MAX_ORDER];
+	uint32_t merge_depth[BUDDY_MAX_ORDER];
+
+	/* The number of failed allocations per order. */
+	uint64_t failed[BUDDY_MAX_ORDER];
+} __attribute__((aligned(64)));
+
+#ifdef MEM_TRACE
+extern struct mem_trace mem_traces[NCPUS];
+
+#define mem_trace_begin() read_tsc()
+
+void mem_trace_latency(unsigned op, size_t order, uint64_t start);
+void mem_trace_split(size_t depth);
+void mem_trace_merge(size_t depth);
+void mem_trace_failed(size_t order);
+void mem_trace_reset(void);
+void show_mem_trace(void);
+#else
+#define mem_trace_begin() ((uint64_t)0)
+#define mem_trace_latency(op, order, start) ((void)(start))
+#define mem_trace_split(depth) ((void)0)
+#define mem_trace_merge(depth) ((void)0)
+#define mem_trace_failed(order) ((void)0)
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <paging.h>
+
+/*
+ * Pool of pages that are known to contain only zeroes, such that ALLOC_ZERO
+ * requests can be served without clearing the page on the allocation path.
+ * There is one pool of order 0 pages and one pool of huge pages. Pages in a
+ * pool have pp_zero set and are not free as far as the buddy allocator is
+ * concerned.
+ *
+ * The pools are refilled by zero_pool_refill() when the CPU is idle and
+ * drained back into the buddy allocator when it runs out of memory.
+ */
+struct zero_pool {
+	/* Protects the list of zeroed pages. */
+	struct spinlock lock;
+	struct page_list free_list;
+	size_t order;
+	size_t count;
+	size_t target;
+
+	/* The chunk that is being cleared and the number of pages cleared,
+	 * owned by whoever holds fill_lock. The pages are cleared without
+	 * holding lock, such that allocations do not have to wait for it.
+	 */
+	struct spinlock fill_lock;
+	struct page_info *pending;
+	size_t pending_done;
+};
+
+void zero_pool_init(void);
+struct page_info *zero_pool_alloc(size_t order);
+size_t zero_pool_refill(size_t budget);
+size_t zero_pool_drain(void);
+size_t count_zeroed_pages(void);
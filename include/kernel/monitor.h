@@ -4,6 +4,8 @@
 #error "This is a OpenLSD kernel header; user programs should not #include it"
 #endif
 
+#include <types.h>
+
 struct int_frame;
 
 /*
@@ -12,6 +14,7 @@ struct int_frame;
  * (NULL if none).
  */
 void monitor(struct int_frame *frame);
+size_t walk_stack(uintptr_t *rbp, uintptr_t *rips, size_t n);
 
 /* Functions implementing monitor commands. */
 int mon_help(int argc, char **argv, struct int_frame *frame);
@@ -19,3 +22,9 @@ int mon_kerninfo(int argc, char **argv, struct int_frame *frame);
 int mon_backtrace(int argc, char **argv, struct int_frame *frame);
 int mon_buddyinfo(int argc, char **argv, struct int_frame *frame);
 int mon_pageinfo(int argc, char **argv, struct int_frame *frame);
+int mon_slabinfo(int argc, char **argv, struct int_frame *frame);
+int mon_compact(int argc, char **argv, struct int_frame *frame);
+int mon_dmesg(int argc, char **argv, struct int_frame *frame);
+int mon_profile(int argc, char **argv, struct int_frame *frame);
+int mon_batch(int argc, char **argv, struct int_frame *frame);
+int mon_memtrace(int argc, char **argv, struct int_frame *frame);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <types.h>
+
+/* The rate at which the PIT interrupts us to take a sample. */
+#define PROFILE_HZ 1000
+
+/* The number of samples kept in the ring, the number of return addresses
+ * recorded per sample with call stacks enabled, and the number of hot spots
+ * shown by profile_dump().
+ */
+#define PROFILE_NSAMPLES 2048
+#define PROFILE_DEPTH 7
+#define PROFILE_NTOP 16
+
+struct profile_sample {
+	uintptr_t rip;
+	uintptr_t callers[PROFILE_DEPTH];
+};
+
+void profile_start(int callchain);
+void profile_stop(void);
+void profile_dump(int raw);
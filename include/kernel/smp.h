@@ -0,0 +1,20 @@
+#pragma once
+
+#include <types.h>
+
+#include <x86-64/memory.h>
+
+#include <kernel/cpu.h>
+
+/* The kernel stack of every AP lives below KSTACK_TOP, with an unmapped gap of
+ * KSTACK_GAP bytes below it, such that running off the end of the stack faults
+ * instead of corrupting the stack of the next CPU. The boot CPU stays on the
+ * stack set up by boot.S, but keeps its slot.
+ */
+static inline uintptr_t cpu_kstack_top(unsigned cpu)
+{
+	return KSTACK_TOP - (uintptr_t)cpu * (KSTACK_SIZE + KSTACK_GAP);
+}
+
+void smp_init(void);
+void smp_run(void (*fn)(unsigned cpu, void *arg), void *arg);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * A static call is a call through a trampoline in the kernel text that consists
+ * of a single jump to the current target. Selecting a target rewrites the jump
+ * in place, such that calls never load a function pointer from memory and the
+ * CPU only ever sees a direct jump that it predicts right.
+ *
+ * The targets may only be changed at boot, while no other CPU runs, as the jump
+ * is not rewritten atomically.
+ */
+#define STATIC_CALL_TRAMP(name) __static_call_tramp_##name
+#define STATIC_CALL_TRAMP_STR(name) "__static_call_tramp_" #name
+
+/* The opcode of the jump with a 32-bit displacement the trampolines start with,
+ * and the size of a trampoline, which is padded with int3.
+ */
+#define STATIC_CALL_JMP 0xe9
+#define STATIC_CALL_SIZE 8
+
+/* Defines a static call with the type of func that calls func until it gets
+ * updated. The pointer keeps func around, as the trampoline only references it
+ * from assembly.
+ */
+#define DEFINE_STATIC_CALL(name, func) \
+	extern typeof(func) STATIC_CALL_TRAMP(name); \
+	static void *const __static_call_default_##name \
+		__attribute__((used)) = (void *)(func); \
+	asm(".pushsection .text, \"ax\"\n" \
+	    ".balign 8\n" \
+	    ".type " STATIC_CALL_TRAMP_STR(name) ", @function\n" \
+	    STATIC_CALL_TRAMP_STR(name) ":\n" \
+	    ".byte 0xe9\n" \
+	    ".long " #func " - . - 4\n" \
+	    ".byte 0xcc, 0xcc, 0xcc\n" \
+	    ".size " STATIC_CALL_TRAMP_STR(name) ", . - " \
+	    STATIC_CALL_TRAMP_STR(name) "\n" \
+	    ".popsection\n")
+
+#define static_call(name) (STATIC_CALL_TRAMP(name))
+
+/* Makes the static call call func, which must have the type of the call. */
+#define static_call_update(name, func) do { \
+		typeof(&STATIC_CALL_TRAMP(name)) __func = (func); \
+		static_call_patch((void *)STATIC_CALL_TRAMP(name), \
+			(void *)__func); \
+	} while (0)
+
+void static_call_patch(void *tramp, void *func);
@@ -1,4 +1,7 @@
 #pragma once
 
+#include <boot.h>
+
 void lab1_check_mem(struct boot_info *boot_info);
 
+void mem_bench(void);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <types.h>
+
+#include <x86-64/asm.h>
+
+/* The programmable interval timer runs at 1.193182 MHz. */
+#define PIT_HZ 1193182
+
+/* How long tsc_init() measures the TSC against the PIT. */
+#define TSC_CALIBRATE_MS 10
+
+#define NSEC_PER_USEC 1000UL
+#define NSEC_PER_MSEC 1000000UL
+#define NSEC_PER_SEC 1000000000UL
+
+/* The TSC frequency in kHz, and the factor that converts TSC cycles to
+ * nanoseconds as a 32.32 fixed point number.
+ */
+extern uint64_t tsc_khz;
+extern uint64_t tsc_ns_mult;
+extern uint64_t tsc_base;
+
+void tsc_init(void);
+void udelay(unsigned us);
+void pit_start_periodic(unsigned hz);
+
+/* Converts a number of TSC cycles into nanoseconds. */
+static inline uint64_t tsc_to_ns(uint64_t cycles)
+{
+	return (uint64_t)(((unsigned __int128)cycles * tsc_ns_mult) >> 32);
+}
+
+/* Returns the number of nanoseconds since tsc_init(), or 0 before that. */
+static inline uint64_t ktime_ns(void)
+{
+	return tsc_ns_mult ? tsc_to_ns(read_tsc() - tsc_base) : 0;
+}
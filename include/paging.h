@@ -1,7 +1,5 @@
 #pragma once
 
-#include <list.h>
-
 #include <x86-64/paging.h>
 
 #ifndef __ASSEMBLER__
@@ -17,23 +15,68 @@
  * FIXME: where?
  */
 struct page_info {
-	/* Next page on the free list. */
-	struct list pp_node;
+	/* Indices of the next and the previous page on the free list, see
+	 * <kernel/mem/page_list.h>. */
+	uint32_t pp_next;
+	uint32_t pp_prev;
+
+	union {
+		uint32_t pp_flags;
+
+		struct {
+			/* The order of the page. */
+			uint32_t pp_order : 5;
+
+			/* Whether the page is actually free. */
+			uint32_t pp_free : 1;
+
+			/* Whether the contents of the page are known to be
+			 * zero. */
+			uint32_t pp_zero : 1;
+
+			/* The NUMA node the page belongs to, see
+			 * <kernel/mem/numa.h>. */
+			uint32_t pp_node : 3;
+
+			/* Whether the page is part of a slab, see
+			 * <kernel/mem/slab.h>. */
+			uint32_t pp_slab : 1;
+
+			/* Whether the page was allocated with
+			 * page_alloc_movable() and can be moved by compaction,
+			 * and whether the page is a free chunk compaction took
+			 * off the free lists, see <kernel/mem/compact.h>. */
+			uint32_t pp_movable : 1;
+			uint32_t pp_isolated : 1;
+
+			/* Whether the page is a page table from the pool of
+			 * page-table pages, and how many of its entries are in
+			 * use, see <kernel/mem/ptpool.h>. */
+			uint32_t pp_pt : 1;
+			uint32_t pp_nents : 10;
+		};
+	};
 
 	/* pp_ref is the count of pointers (usually in page table entries)
 	 * to this page, for pages allocated using page_alloc.
 	 * Pages allocated at boot time using pmap.c's
-	 * boot_alloc do not have valid reference count fields. */
-	uint16_t pp_ref;
+	 * boot_alloc do not have valid reference count fields.
+	 * Shared pages are counted atomically with page_get() and
+	 * page_put(). */
+	uint32_t pp_ref;
+};
 
-	/* The order of the page. */
-	uint8_t pp_order : 7;
+/* Keep the page_info array small: there is one entry for every 4K page. */
+_Static_assert(sizeof(struct page_info) <= 16,
+	"struct page_info must not exceed 16 bytes");
 
-	/* Whether the page is actually free. */
-	uint8_t pp_free : 1;
+/* The index used to terminate a list of pages. */
+#define PAGE_NIL UINT32_C(0xFFFFFFFF)
 
-	/* Reserved. */
-	uint64_t pp_zero;
+/* A list of pages linked through their page indices. */
+struct page_list {
+	uint32_t head;
+	uint32_t tail;
 };
 #endif /* !__ASSEMBLER__ */
 
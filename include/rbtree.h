@@ -19,8 +19,24 @@ struct rb_node {
 	enum rb_color color;
 };
 
+/* If augment is set, it is called to recalculate the augmented data of a node
+ * from its children whenever the children of the node change.
+ */
 struct rb_tree {
 	struct rb_node *root;
+	void (*augment)(struct rb_node *node);
+};
+
+/* The maximum height of a tree an iterator can walk. The height of a red-black
+ * tree is at most 2 log2(n + 1), and with 48-bit addresses there are fewer
+ * than 2^44 nodes.
+ */
+#define RB_ITER_DEPTH 96
+
+/* An in-order iterator that keeps the path to the next node on a stack. */
+struct rb_iter {
+	struct rb_node *stack[RB_ITER_DEPTH];
+	size_t depth;
 };
 
 struct rb_node *rb_first(struct rb_tree *tree);
@@ -31,6 +47,14 @@ struct rb_node *rb_prev(struct rb_node *node);
 static inline void rb_init(struct rb_tree *tree)
 {
 	tree->root = NULL;
+	tree->augment = NULL;
+}
+
+static inline void rb_init_augmented(struct rb_tree *tree,
+	void (*augment)(struct rb_node *node))
+{
+	tree->root = NULL;
+	tree->augment = augment;
 }
 
 static inline void rb_node_init(struct rb_node *node)
@@ -42,4 +66,14 @@ int rb_balance(struct rb_tree *tree, struct rb_node *node);
 int rb_remove(struct rb_tree *tree, struct rb_node *node);
 int rb_replace(struct rb_tree *tree, struct rb_node *node,
 	struct rb_node *new_node);
-
+void rb_augment_propagate(struct rb_tree *tree, struct rb_node *node);
+int rb_insert(struct rb_tree *tree, struct rb_node *node,
+	int (*cmp)(struct rb_node *lhs, struct rb_node *rhs));
+struct rb_node *rb_find(struct rb_tree *tree, const void *key,
+	int (*cmp)(const void *key, struct rb_node *node));
+struct rb_node *rb_lower_bound(struct rb_tree *tree, const void *key,
+	int (*cmp)(const void *key, struct rb_node *node));
+int rb_build(struct rb_tree *tree, void *base, size_t n, size_t size,
+	size_t offset);
+void rb_iter_init(struct rb_iter *iter, struct rb_tree *tree);
+struct rb_node *rb_iter_next(struct rb_iter *iter);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <types.h>
 #include <stdarg.h>
 
 #ifndef NULL
@@ -8,10 +9,31 @@
 
 /* lib/stdio.c */
 void cputchar(int c);
+void cputs(const char *s, size_t n);
 int getchar(void);
 int iscons(int fd);
 
 /* lib/printfmt.c */
+
+/* A caller-provided span the formatting routines write into. Whenever the
+ * span fills up, and once formatting is done, its contents are handed to puts
+ * in a single call. If puts is NULL, the output is truncated to the span.
+ */
+struct printbuf {
+	char *buf;
+	size_t size;
+	size_t len;
+	int cnt;
+	void (*puts)(const char *s, size_t n, void *putdat);
+	void *putdat;
+};
+
+#define PRINTBUF_SIZE 128
+#define PRINTBUF_INIT(_buf, _size, _puts, _putdat) \
+	{ .buf = (_buf), .size = (_size), .puts = (_puts), .putdat = (_putdat) }
+
+int bprintfmt(struct printbuf *pb, const char *fmt, ...);
+int vbprintfmt(struct printbuf *pb, const char *fmt, va_list);
 void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 	va_list);
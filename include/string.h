@@ -13,7 +13,9 @@ int strncmp(const char *s1, const char *s2, size_t size);
 char *strchr(const char *s, char c);
 char *strfind(const char *s, char c);
 
+void string_init(void);
 void *memset(void *dst, int c, size_t len);
+void *memset_nt(void *dst, int c, size_t len);
 void *memcpy(void *dst, const void *src, size_t len);
 void *memmove(void *dst, const void *src, size_t len);
 int memcmp(const void *s1, const void *s2, size_t len);
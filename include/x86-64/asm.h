@@ -1,12 +1,21 @@
 #pragma once
 
 #define CR0_PM     (1 << 0)
+#define CR0_WP     (1 << 16)
 #define CR0_PAGING (1 << 31)
 
 #define CR4_PAE  (1 << 5)
+#define CR4_PGE  (1 << 7)
+#define CR4_PCIDE (1 << 17)
 #define CR4_SMEP (1 << 20)
 #define CR4_SMAP (1 << 21)
 
+/* The low bits of CR3 hold the PCID if CR4.PCIDE is set, in which case loading
+ * CR3 with bit 63 set keeps the translations cached for the PCID.
+ */
+#define CR3_PCID_MASK 0xFFF
+#define CR3_NOFLUSH   (1ULL << 63)
+
 #define FLAGS_CF      (1 << 0)
 #define FLAGS_PF      (1 << 2)
 #define FLAGS_AF      (1 << 4)
@@ -25,7 +34,16 @@
 #define FLAGS_VIP     (1 << 20)
 #define FLAGS_ID      (1 << 21)
 
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_AVX2 (1 << 5)
+#define CPUID_7_EBX_ERMS (1 << 9)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+#define CPUID_80000001_EDX_PAGE1GB (1 << 26)
+#define CPUID_80000001_EDX_RDTSCP (1 << 27)
+
 #define MSR_APIC_BASE      0x0000001b
+#define MSR_APIC_BASE_BSP    (1 << 8)
+#define MSR_APIC_BASE_ENABLE (1 << 11)
 
 #define MSR_EFER           0xc0000080
 #define MSR_STAR           0xc0000081
@@ -105,6 +123,20 @@ static inline uint64_t read_rflags(void)
 	return rflags;
 }
 
+static inline uintptr_t read_cr0(void)
+{
+	uintptr_t value;
+
+	asm volatile("movq %%cr0, %0\n" : "=r" (value));
+
+	return value;
+}
+
+static inline void write_cr0(uintptr_t value)
+{
+	asm volatile("movq %0, %%cr0\n" :: "r" (value));
+}
+
 static inline uintptr_t read_cr2(void)
 {
 	uintptr_t ret;
@@ -252,9 +284,36 @@ static inline void outsl(uint16_t port, const void *addr, size_t n)
 
 static inline uint64_t read_tsc(void)
 {
-	uint64_t ret;
-	asm volatile("rdtsc" : "=A" (ret));
-	return ret;
+	uint32_t lo, hi;
+
+	/* "=A" would only give us %rax in 64-bit mode. */
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (uint64_t)hi << 32 | lo;
+}
+
+/* Like read_tsc(), but waits for all earlier instructions to have executed
+ * and stores IA32_TSC_AUX in *aux, which holds the CPU number on most systems.
+ * aux may be NULL.
+ */
+static inline uint64_t read_tscp(uint32_t *aux)
+{
+	uint32_t lo, hi, ecx;
+
+	asm volatile("rdtscp" : "=a" (lo), "=d" (hi), "=c" (ecx));
+
+	if (aux)
+		*aux = ecx;
+
+	return (uint64_t)hi << 32 | lo;
+}
+
+/* Reads the TSC once all earlier instructions have executed, for timing code
+ * on CPUs without rdtscp.
+ */
+static inline uint64_t read_tsc_ordered(void)
+{
+	asm volatile("lfence" ::: "memory");
+	return read_tsc();
 }
 
 static inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval)
@@ -270,14 +329,134 @@ static inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval)
 	return ret;
 }
 
-static inline void cpuid(unsigned long fn, uint32_t *eaxp, uint32_t *ebxp,
-	uint32_t *ecxp, uint32_t *edxp)
+/* Atomically adds val to *addr and returns the old value of *addr. */
+static inline uint32_t xadd(volatile uint32_t *addr, uint32_t val)
+{
+	asm volatile(
+		"lock; xaddl %0, %1" :
+		"+r" (val), "+m" (*addr) ::
+		"cc", "memory");
+	return val;
+}
+
+static inline void sti(void)
+{
+	asm volatile("sti" ::: "memory");
+}
+
+static inline void cli(void)
+{
+	asm volatile("cli" ::: "memory");
+}
+
+/* Enables interrupts and halts until the next one. Interrupts only get enabled
+ * after the instruction following sti, such that an interrupt cannot arrive
+ * between checking for work with interrupts disabled and halting.
+ */
+static inline void sti_hlt(void)
+{
+	asm volatile("sti; hlt" ::: "memory");
+}
+
+/* Keeps the compiler from moving memory accesses across this point. As x86
+ * does not reorder stores with other stores or loads with other loads, this is
+ * enough to order the accesses of a single writer and its readers.
+ */
+static inline void barrier(void)
+{
+	asm volatile("" ::: "memory");
+}
+
+/* Hints the CPU that we are spinning on a memory location. */
+static inline void pause(void)
+{
+	asm volatile("pause" ::: "memory");
+}
+
+/*
+ * A ticket spinlock. Every CPU takes a ticket by atomically incrementing next
+ * and waits until owner reaches its ticket, such that the lock is handed out
+ * in FIFO order. While waiting, a CPU only reads the lock, so the cache line
+ * is shared between the waiters until the owner releases the lock.
+ */
+struct spinlock {
+	volatile uint32_t next;
+	volatile uint32_t owner;
+};
+
+#define SPINLOCK_INIT { 0, 0 }
+
+static inline void spin_init(struct spinlock *lock)
+{
+	lock->next = 0;
+	lock->owner = 0;
+}
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	uint32_t ticket = xadd(&lock->next, 1);
+
+	while (lock->owner != ticket)
+		pause();
+
+	/* Keep the critical section after the lock is taken. */
+	asm volatile("" ::: "memory");
+}
+
+/* Takes the lock if it is not held by anyone.
+ *
+ * Returns 1 if the lock was taken and 0 otherwise.
+ */
+static inline int spin_trylock(struct spinlock *lock)
+{
+	uint32_t ticket = lock->owner;
+
+	return __atomic_compare_exchange_n(&lock->next, &ticket, ticket + 1, 0,
+		__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	/* Only the owner writes owner, and x86 does not reorder stores with
+	 * earlier loads or stores, so a plain store releases the lock.
+	 */
+	asm volatile("" ::: "memory");
+	lock->owner = lock->owner + 1;
+}
+
+static inline int spin_is_locked(struct spinlock *lock)
+{
+	return lock->next != lock->owner;
+}
+
+/* Returns the index of the least significant set bit. The result is undefined
+ * if word is zero.
+ */
+static inline unsigned long bsf(unsigned long word)
+{
+	asm("bsfq %1, %0" : "=r" (word) : "rm" (word) : "cc");
+
+	return word;
+}
+
+/* Returns the index of the most significant set bit. The result is undefined
+ * if word is zero.
+ */
+static inline unsigned long bsr(unsigned long word)
+{
+	asm("bsrq %1, %0" : "=r" (word) : "rm" (word) : "cc");
+
+	return word;
+}
+
+static inline void cpuid_count(unsigned long fn, unsigned long subfn,
+	uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
 {
 	uint32_t eax, ebx, ecx, edx;
 
 	asm volatile("cpuid" :
 		"=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) :
-		"a" (fn));
+		"a" (fn), "c" (subfn));
 
 	if (eaxp)
 		*eaxp = eax;
@@ -292,5 +471,11 @@ static inline void cpuid(unsigned long fn, uint32_t *eaxp, uint32_t *ebxp,
 		*edxp = edx;
 }
 
+static inline void cpuid(unsigned long fn, uint32_t *eaxp, uint32_t *ebxp,
+	uint32_t *ecxp, uint32_t *edxp)
+{
+	cpuid_count(fn, 0, eaxp, ebxp, ecxp, edxp);
+}
+
 #endif /* !defined(__ASSEMBLER__) */
 
@@ -50,5 +50,3 @@
 #define UXSTACK_TOP USER_TOP
 #define USTACK_TOP (UXSTACK_TOP - 2 * PAGE_SIZE)
 
-/* The amount of memory mapped in the boot stub. */
-#define BOOT_MAP_LIM (8 * 1024 * 1024)
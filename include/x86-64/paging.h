@@ -12,6 +12,13 @@
 #define PAGE_HUGE (1 << 7)
 #define PAGE_GLOBAL (1 << 8)
 
+/* Bits 9 to 11 are left to software. A page marked copy-on-write is mapped
+ * read-only and gets copied on the first write. A lazy page maps the shared
+ * zero page read-only until the first write allocates a page.
+ */
+#define PAGE_COW  (1 << 9)
+#define PAGE_LAZY (1 << 10)
+
 #ifdef __ASSEMBLER__
 #define PAGE_NO_EXEC (1 << 63)
 #else
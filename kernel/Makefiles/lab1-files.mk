@@ -1,15 +1,45 @@
 # LAB 1 code
 KERNEL_SRCFILES := \
+	kernel/acpi.c \
 	kernel/boot.S \
 	kernel/console.c \
+	kernel/cpufeature.c \
+	kernel/intr.c \
+	kernel/isr.S \
+	kernel/klog.c \
+	kernel/ksym.c \
+	kernel/kwork.c \
+	kernel/lapic.c \
 	kernel/main.c \
 	kernel/monitor.c \
+	kernel/mpentry.S \
 	kernel/pic.c \
 	kernel/printf.c \
+	kernel/profile.c \
+	kernel/smp.c \
+	kernel/static_call.c \
+	kernel/time.c \
+	kernel/mem/arena.c \
 	kernel/mem/boot.c \
 	kernel/mem/buddy.c \
+	kernel/mem/compact.c \
+	kernel/mem/cow.c \
+	kernel/mem/fault.c \
 	kernel/mem/init.c \
+	kernel/mem/kmalloc.c \
+	kernel/mem/lazy.c \
+	kernel/mem/map.c \
+	kernel/mem/numa.c \
+	kernel/mem/pcp.c \
+	kernel/mem/ptpool.c \
+	kernel/mem/slab.c \
+	kernel/mem/tlb.c \
+	kernel/mem/trace.c \
+	kernel/mem/zero.c \
+	kernel/tests/bench.c \
 	kernel/tests/lab1.c \
+	lib/hash.c \
+	lib/interval_tree.c \
 	lib/list.c \
 	lib/printfmt.c \
 	lib/rbtree.c \
@@ -0,0 +1,137 @@
+#include <types.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/acpi.h>
+#include <kernel/mem.h>
+
+/* The root table: either the RSDT with 32-bit or the XSDT with 64-bit entries.
+ */
+static struct acpi_sdt_hdr *acpi_root;
+static size_t acpi_entry_size;
+
+/* The ACPI tables usually live in reserved memory beyond the last page we
+ * manage, so KADDR() cannot be used here. Anything mapped by the boot stub is
+ * fine, however.
+ */
+static void *acpi_kaddr(physaddr_t pa, size_t len)
+{
+	if (pa + len < pa || pa + len > boot_map_lim)
+		return NULL;
+
+	return (void *)(KERNEL_VMA + pa);
+}
+
+/* Returns whether the bytes of the structure add up to zero. */
+static int acpi_checksum(const void *addr, size_t len)
+{
+	const uint8_t *p = addr;
+	uint8_t sum = 0;
+
+	while (len--)
+		sum += *p++;
+
+	return sum == 0;
+}
+
+/* Scans [pa, pa + len) for the RSDP, which is aligned to 16 bytes. */
+static struct acpi_rsdp *acpi_scan_rsdp(physaddr_t pa, size_t len)
+{
+	struct acpi_rsdp *rsdp;
+	char *p, *end;
+
+	p = acpi_kaddr(pa, len);
+
+	if (!p)
+		return NULL;
+
+	for (end = p + len; p + sizeof *rsdp <= end; p += 16) {
+		rsdp = (struct acpi_rsdp *)p;
+
+		if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+		    acpi_checksum(rsdp, 20))
+			return rsdp;
+	}
+
+	return NULL;
+}
+
+/* Maps the table at pa and checks its length and checksum. */
+static struct acpi_sdt_hdr *acpi_get_table(physaddr_t pa)
+{
+	struct acpi_sdt_hdr *hdr;
+
+	hdr = acpi_kaddr(pa, sizeof *hdr);
+
+	if (!hdr || !acpi_kaddr(pa, hdr->len) || !acpi_checksum(hdr, hdr->len))
+		return NULL;
+
+	return hdr;
+}
+
+/* Locates the RSDP and the root table. If the firmware does not provide ACPI
+ * tables, acpi_find_table() will simply not find anything.
+ */
+void acpi_init(void)
+{
+	struct acpi_rsdp *rsdp;
+	uint16_t *ebda_seg;
+
+	/* The BIOS data area holds the segment of the EBDA at 0x40E. */
+	ebda_seg = (uint16_t *)(KERNEL_VMA + 0x40E);
+	rsdp = acpi_scan_rsdp((physaddr_t)*ebda_seg << 4, 1024);
+
+	if (!rsdp)
+		rsdp = acpi_scan_rsdp(0xE0000, 0x20000);
+
+	if (!rsdp) {
+		cprintf("ACPI: no RSDP found\n");
+		return;
+	}
+
+	if (rsdp->revision >= 2 && rsdp->xsdt_addr &&
+	    acpi_checksum(rsdp, rsdp->len)) {
+		acpi_root = acpi_get_table(rsdp->xsdt_addr);
+		acpi_entry_size = sizeof(uint64_t);
+	}
+
+	if (!acpi_root) {
+		acpi_root = acpi_get_table(rsdp->rsdt_addr);
+		acpi_entry_size = sizeof(uint32_t);
+	}
+
+	if (!acpi_root)
+		cprintf("ACPI: invalid root table\n");
+}
+
+/* Looks up the first table with the given signature in the root table.
+ *
+ * Returns the kernel virtual address of the table or NULL if there is no such
+ * table.
+ */
+void *acpi_find_table(const char *signature)
+{
+	struct acpi_sdt_hdr *hdr;
+	char *entry, *end;
+	physaddr_t pa;
+
+	if (!acpi_root)
+		return NULL;
+
+	entry = (char *)(acpi_root + 1);
+	end = (char *)acpi_root + acpi_root->len;
+
+	for (; entry + acpi_entry_size <= end; entry += acpi_entry_size) {
+		if (acpi_entry_size == sizeof(uint64_t))
+			pa = *(uint64_t *)entry;
+		else
+			pa = *(uint32_t *)entry;
+
+		hdr = acpi_get_table(pa);
+
+		if (hdr && memcmp(hdr->signature, signature, 4) == 0)
+			return hdr;
+	}
+
+	return NULL;
+}
@@ -3,8 +3,13 @@
 #include <string.h>
 #include <assert.h>
 
+#include <x86-64/idt.h>
+
 #include <kernel/console.h>
+#include <kernel/intr.h>
+#include <kernel/mem.h>
 #include <kernel/pic.h>
+#include <kernel/time.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -18,6 +23,29 @@ static void delay(void)
     inb(0x84);
 }
 
+/* How long to wait for a port to become ready before writing anyway. */
+#define PORT_TIMEOUT_NS (50 * NSEC_PER_MSEC)
+
+/* Waits until any of the bits in mask are set in the status port, or until
+ * the timeout expires. Before the TSC has been calibrated, the same timeout is
+ * approximated by a fixed number of I/O delays. */
+static void wait_port(uint16_t port, uint8_t mask)
+{
+    uint64_t end;
+    int i;
+
+    if (!tsc_ns_mult) {
+        for (i = 0; !(inb(port) & mask) && i < 12800; i++)
+            delay();
+        return;
+    }
+
+    end = ktime_ns() + PORT_TIMEOUT_NS;
+
+    while (!(inb(port) & mask) && ktime_ns() < end)
+        pause();
+}
+
 /***** Serial I/O code *****/
 
 #define COM1            0x3F8
@@ -29,7 +57,10 @@ static void delay(void)
 #define COM_IER         1   /* Out: Interrupt Enable Register */
 #define   COM_IER_RDI   0x01    /*   Enable receiver data interrupt */
 #define COM_IIR         2   /* In:  Interrupt ID Register */
+#define   COM_IIR_FIFO  0xC0    /*   FIFO enabled */
 #define COM_FCR         2   /* Out: FIFO Control Register */
+#define   COM_FCR_ENABLE 0x01   /*   Enable the FIFOs */
+#define   COM_FCR_CLEAR 0x06    /*   Clear the receive and transmit FIFOs */
 #define COM_LCR         3   /* Out: Line Control Register */
 #define   COM_LCR_DLAB  0x80    /*   Divisor latch access bit */
 #define   COM_LCR_WLEN8 0x03    /*   Wordlength: 8 bits */
@@ -42,6 +73,8 @@ static void delay(void)
 #define   COM_LSR_TXRDY 0x20    /*   Transmit buffer avail */
 #define   COM_LSR_TSRE  0x40    /*   Transmitter off */
 
+#define COM_FIFO_SIZE   16
+
 static bool serial_exists;
 
 static int serial_proc_data(void)
@@ -57,22 +90,33 @@ void serial_intr(void)
         cons_intr(serial_proc_data);
 }
 
-static void serial_putc(int c)
+static bool serial_fifo;
+
+/* Write n characters to the serial port. If the UART has a FIFO, it is filled
+ * with up to COM_FIFO_SIZE characters every time it runs empty, rather than
+ * waiting for the transmitter for every single character. */
+static void serial_write(const uint8_t *buf, size_t n)
 {
-    int i;
+    size_t i, count;
+
+    while (n > 0) {
+        wait_port(COM1 + COM_LSR, COM_LSR_TXRDY);
 
-    for (i = 0;
-         !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-         i++)
-        delay();
+        count = serial_fifo ? MIN(n, COM_FIFO_SIZE) : 1;
 
-    outb(COM1 + COM_TX, c);
+        for (i = 0; i < count; i++)
+            outb(COM1 + COM_TX, buf[i]);
+
+        buf += count;
+        n -= count;
+    }
 }
 
 static void serial_init(void)
 {
-    /* Turn off the FIFO */
-    outb(COM1+COM_FCR, 0);
+    /* Turn on and clear the FIFO */
+    outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
+    serial_fifo = (inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO;
 
     /* Set speed; requires DLAB latch */
     outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -82,8 +126,8 @@ static void serial_init(void)
     /* 8 data bits, 1 stop bit, parity off; turn off DLAB latch */
     outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-    /* No modem controls */
-    outb(COM1+COM_MCR, 0);
+    /* No modem controls, but OUT2 gates the interrupt line of the UART */
+    outb(COM1+COM_MCR, COM_MCR_OUT2);
     /* Enable rcv interrupts */
     outb(COM1+COM_IER, COM_IER_RDI);
 
@@ -101,12 +145,15 @@ static void serial_init(void)
 /* For information on PC parallel port programming, see the class References
  * page. */
 
+/* Console output is only mirrored to the parallel port if CONS_LPT is set, as
+ * every character costs several slow port accesses. */
+#ifndef CONS_LPT
+#define CONS_LPT 0
+#endif
+
 static void lpt_putc(int c)
 {
-    int i;
-
-    for (i = 0; !(inb(0x378+1) & 0x80) && i < 12800; i++)
-        delay();
+    wait_port(0x378+1, 0x80);
     outb(0x378+0, c);
     outb(0x378+2, 0x08|0x04|0x01);
     outb(0x378+2, 0x08);
@@ -117,9 +164,21 @@ static void lpt_putc(int c)
 
 /***** Text-mode CGA/VGA display output *****/
 
+/* The screen is a window of CRT_SIZE characters into the display memory that
+ * starts at crt_origin. Scrolling moves the window down by a row by updating
+ * the 6845 start address, such that characters only have to be moved once the
+ * window reaches the end of the display memory. The 16K of display memory of
+ * the CGA fits a bit over three screens worth of characters, while the MDA
+ * only has room for a single screen and moves the screen for every row.
+ */
+#define CGA_BUF_CELLS   (0x4000 / sizeof(uint16_t))
+#define MONO_BUF_CELLS  CRT_SIZE
+
 static unsigned addr_6845;
 static uint16_t *crt_buf;
 static uint16_t crt_pos;
+static unsigned crt_origin;
+static unsigned crt_cells;
 
 static void cga_init(void)
 {
@@ -133,9 +192,11 @@ static void cga_init(void)
     if (*cp != 0xA55A) {
         cp = (uint16_t*) (KERNEL_VMA + MONO_BUF);
         addr_6845 = MONO_BASE;
+        crt_cells = MONO_BUF_CELLS;
     } else {
         *cp = was;
         addr_6845 = CGA_BASE;
+        crt_cells = CGA_BUF_CELLS;
     }
 
     /* Extract cursor location */
@@ -144,14 +205,41 @@ static void cga_init(void)
     outb(addr_6845, 15);
     pos |= inb(addr_6845 + 1);
 
+    /* Make sure the screen starts at the beginning of the display memory */
+    outb(addr_6845, 12);
+    outb(addr_6845 + 1, 0);
+    outb(addr_6845, 13);
+    outb(addr_6845 + 1, 0);
+
     crt_buf = (uint16_t*) cp;
     crt_pos = pos;
+    crt_origin = 0;
 }
 
+/* Scroll the screen up by one row. */
+static void cga_scroll(void)
+{
+    uint16_t *screen;
+    int i;
 
+    if (crt_origin + CRT_SIZE + CRT_COLS <= crt_cells) {
+        crt_origin += CRT_COLS;
+    } else {
+        memmove(crt_buf, crt_buf + crt_origin + CRT_COLS,
+                (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
+        crt_origin = 0;
+    }
+
+    screen = crt_buf + crt_origin;
+    for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
+        screen[i] = 0x0700 | ' ';
+    crt_pos -= CRT_COLS;
+}
 
 static void cga_putc(int c)
 {
+    uint16_t *screen = crt_buf + crt_origin;
+
     /* If no attribute given, then use black on white. */
     if (!(c & ~0xFF))
         c |= 0x0700;
@@ -160,7 +248,7 @@ static void cga_putc(int c)
     case '\b':
         if (crt_pos > 0) {
             crt_pos--;
-            crt_buf[crt_pos] = (c & ~0xff) | ' ';
+            screen[crt_pos] = (c & ~0xff) | ' ';
         }
         break;
     case '\n':
@@ -170,32 +258,35 @@ static void cga_putc(int c)
         crt_pos -= (crt_pos % CRT_COLS);
         break;
     case '\t':
-        cons_putc(' ');
-        cons_putc(' ');
-        cons_putc(' ');
-        cons_putc(' ');
-        cons_putc(' ');
+        cga_putc(' ');
+        cga_putc(' ');
+        cga_putc(' ');
+        cga_putc(' ');
+        cga_putc(' ');
         break;
     default:
-        crt_buf[crt_pos++] = c;     /* write the character */
+        screen[crt_pos++] = c;      /* write the character */
         break;
     }
 
-    /* What is the purpose of this? */
-    if (crt_pos >= CRT_SIZE) {
-        int i;
+    /* Scroll once the cursor runs off the bottom of the screen. */
+    if (crt_pos >= CRT_SIZE)
+        cga_scroll();
+}
 
-        memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-        for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-            crt_buf[i] = 0x0700 | ' ';
-        crt_pos -= CRT_COLS;
-    }
+/* move that little blinky thing, and the screen along with it */
+static void cga_set_cursor(void)
+{
+    unsigned pos = crt_origin + crt_pos;
 
-    /* move that little blinky thing */
+    outb(addr_6845, 12);
+    outb(addr_6845 + 1, crt_origin >> 8);
+    outb(addr_6845, 13);
+    outb(addr_6845 + 1, crt_origin);
     outb(addr_6845, 14);
-    outb(addr_6845 + 1, crt_pos >> 8);
+    outb(addr_6845 + 1, pos >> 8);
     outb(addr_6845, 15);
-    outb(addr_6845 + 1, crt_pos);
+    outb(addr_6845 + 1, pos);
 }
 
 
@@ -358,7 +449,6 @@ static void kbd_init(void)
 {
     /* Drain the kbd buffer so that Bochs generates interrupts. */
     kbd_intr();
-    pic_enable_irq(1);
 }
 
 
@@ -391,33 +481,215 @@ static void cons_intr(int (*proc)(void))
     }
 }
 
+/* Set once the keyboard and serial IRQs feed the input buffer. */
+static bool cons_irqs;
+
+/* Until the IRQs are set up and after a panic, when we no longer trust the
+ * interrupt machinery, input has to be polled for. */
+static bool cons_polling(void)
+{
+    return !cons_irqs || panicstr;
+}
+
 /* return the next input character from the console, or 0 if none waiting */
 int cons_getc(void)
 {
-    int c;
+    uint64_t rflags = read_rflags();
+    int c = 0;
 
-    /* Poll for any pending input characters, so that this function works even
-     * when interrupts are disabled (e.g., when called from the kernel
-     * monitor). */
-    serial_intr();
-    kbd_intr();
+    /* The IRQ handlers write to the input buffer, so keep them out while we
+     * poll and take a character. */
+    cli();
+
+    if (cons_polling()) {
+        serial_intr();
+        kbd_intr();
+    }
 
     /* grab the next character from the input buffer. */
     if (cons.rpos != cons.wpos) {
         c = cons.buf[cons.rpos++];
         if (cons.rpos == CONSBUFSIZE)
             cons.rpos = 0;
-        return c;
     }
-    return 0;
+
+    if (rflags & FLAGS_IF)
+        sti();
+    return c;
+}
+
+/* Halts the CPU until the next interrupt, unless input is already waiting or
+ * has to be polled for. */
+static void cons_idle(void)
+{
+    uint64_t rflags = read_rflags();
+
+    if (cons_polling())
+        return;
+
+    cli();
+
+    if (cons.rpos == cons.wpos)
+        sti_hlt();
+
+    if (!(rflags & FLAGS_IF))
+        cli();
+}
+
+static void kbd_irq(struct int_frame *frame)
+{
+    kbd_intr();
+}
+
+static void serial_irq(struct int_frame *frame)
+{
+    serial_intr();
+}
+
+/* Routes the keyboard and serial IRQs into the input buffer, such that
+ * getchar() can halt while waiting for input. Call this once the IDT and the
+ * PICs have been set up. */
+void cons_intr_init(void)
+{
+    intr_register(IRQ_KBD, kbd_irq);
+    pic_enable_irq(IRQ_KBD - IRQ_OFFSET);
+
+    if (serial_exists) {
+        intr_register(IRQ_SERIAL, serial_irq);
+        pic_enable_irq(IRQ_SERIAL - IRQ_OFFSET);
+    }
+
+    /* Pick up whatever arrived before the IRQs were unmasked. */
+    kbd_intr();
+    serial_intr();
+    cons_irqs = 1;
+}
+
+/* Console output goes through a ring buffer, such that the devices can be
+ * written to in batches: the serial port gets as many characters at once as
+ * its FIFO holds and the CGA cursor is only moved once per flush.
+ *
+ * The ring is lock-free for writers: a writer reserves a slot by atomically
+ * incrementing head, stores its character and then marks the slot as ready.
+ * Whoever manages to take the flush lock writes out the ready characters in
+ * order, starting at tail, until it finds a slot that is not ready yet.
+ *
+ * The ring is flushed at every newline, when it is full, before waiting for
+ * input and on panic.
+ *
+ * Interrupts are disabled from reserving a slot until it is ready: a handler
+ * that prints on the same CPU could otherwise fill up the ring behind a slot
+ * that never becomes ready while the handler runs, and wait forever.
+ */
+#define CONS_OUTSIZE 4096
+
+static struct {
+    volatile uint8_t buf[CONS_OUTSIZE];
+    volatile uint8_t ready[CONS_OUTSIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t lock;
+} cons_out;
+
+/* Write out all ready characters, unless another CPU is already doing so.
+ * Interrupts are disabled while holding the flush lock, such that a handler
+ * waiting for room in the ring never waits for the code it interrupted. */
+void cons_flush(void)
+{
+    uint8_t chunk[COM_FIFO_SIZE * 4];
+    uint64_t rflags = read_rflags();
+    uint32_t tail;
+    size_t i, n;
+
+    cli();
+
+    while (!xchg(&cons_out.lock, 1)) {
+        tail = cons_out.tail;
+        n = 0;
+
+        while (n < sizeof chunk && cons_out.ready[tail % CONS_OUTSIZE]) {
+            chunk[n++] = cons_out.buf[tail % CONS_OUTSIZE];
+            cons_out.ready[tail % CONS_OUTSIZE] = 0;
+            tail++;
+        }
+
+        cons_out.tail = tail;
+
+        if (n > 0) {
+            serial_write(chunk, n);
+
+            for (i = 0; i < n; i++) {
+                if (CONS_LPT)
+                    lpt_putc(chunk[i]);
+                cga_putc(chunk[i]);
+            }
+        }
+
+        if (!cons_out.ready[cons_out.tail % CONS_OUTSIZE])
+            cga_set_cursor();
+
+        xchg(&cons_out.lock, 0);
+
+        /* Characters that became ready while we held the lock would otherwise
+         * be stuck until the next flush. */
+        if (!cons_out.ready[cons_out.tail % CONS_OUTSIZE])
+            break;
+    }
+
+    if (rflags & FLAGS_IF)
+        sti();
 }
 
 /* Output a character to the console. */
 static void cons_putc(int c)
 {
-    serial_putc(c);
-    lpt_putc(c);
-    cga_putc(c);
+    uint64_t rflags = read_rflags();
+    uint32_t slot;
+
+    cli();
+    slot = xadd(&cons_out.head, 1);
+
+    /* Wait for the slot to be written out if the ring is full. */
+    while (slot - cons_out.tail >= CONS_OUTSIZE)
+        cons_flush();
+
+    cons_out.buf[slot % CONS_OUTSIZE] = c;
+    cons_out.ready[slot % CONS_OUTSIZE] = 1;
+
+    if (rflags & FLAGS_IF)
+        sti();
+
+    if (c == '\n')
+        cons_flush();
+}
+
+/* Output n characters to the console. The slots for all of them are reserved
+ * at once, such that the string is not interleaved with the output of other
+ * CPUs, and the ring is flushed once if the string contains a newline. */
+static void cons_write(const char *s, size_t n)
+{
+    uint64_t rflags = read_rflags();
+    uint32_t slot;
+    bool newline = 0;
+    size_t i;
+
+    cli();
+    slot = xadd(&cons_out.head, n);
+
+    for (i = 0; i < n; i++, slot++) {
+        while (slot - cons_out.tail >= CONS_OUTSIZE)
+            cons_flush();
+
+        cons_out.buf[slot % CONS_OUTSIZE] = s[i];
+        cons_out.ready[slot % CONS_OUTSIZE] = 1;
+        newline |= s[i] == '\n';
+    }
+
+    if (rflags & FLAGS_IF)
+        sti();
+
+    if (newline)
+        cons_flush();
 }
 
 /* Initialize the console devices. */
@@ -439,12 +711,26 @@ void cputchar(int c)
     cons_putc(c);
 }
 
+void cputs(const char *s, size_t n)
+{
+    cons_write(s, n);
+}
+
 int getchar(void)
 {
     int c;
 
-    while ((c = cons_getc()) == 0)
-        /* do nothing */;
+    /* Make sure the prompt is visible. */
+    cons_flush();
+
+    /* Use the time spent waiting for input to set up the remaining sections
+     * of memory and then to clear pages, see mem_idle(). Once there is nothing
+     * left to do, halt until the next keyboard or serial interrupt. */
+    while ((c = cons_getc()) == 0) {
+        if (mem_idle())
+            continue;
+        cons_idle();
+    }
     return c;
 }
 
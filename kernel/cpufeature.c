@@ -0,0 +1,67 @@
+#include <types.h>
+#include <stdio.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpufeature.h>
+
+uint32_t cpu_features;
+
+static const char * const cpu_feature_names[CPU_NFEATURES] = {
+	"erms", "avx2", "pcid", "invpcid", "page1gb", "rdtscp",
+};
+
+/* Probes the features of the boot CPU through CPUID. This only runs once, such
+ * that everything else checks a single word instead of issuing CPUID, which
+ * is slow and traps when running virtualized.
+ */
+void cpu_features_init(void)
+{
+	uint32_t max_leaf, max_ext_leaf, ebx, ecx, edx;
+
+	cpu_features = 0;
+	cpuid(0, &max_leaf, NULL, NULL, NULL);
+	cpuid(1, NULL, NULL, &ecx, NULL);
+
+	if (ecx & CPUID_1_ECX_PCID)
+		cpu_features |= CPU_FEATURE_PCID;
+
+	if (max_leaf >= 7) {
+		cpuid_count(7, 0, NULL, &ebx, NULL, NULL);
+
+		if (ebx & CPUID_7_EBX_ERMS)
+			cpu_features |= CPU_FEATURE_ERMS;
+
+		if (ebx & CPUID_7_EBX_AVX2)
+			cpu_features |= CPU_FEATURE_AVX2;
+
+		if (ebx & CPUID_7_EBX_INVPCID)
+			cpu_features |= CPU_FEATURE_INVPCID;
+	}
+
+	cpuid(0x80000000, &max_ext_leaf, NULL, NULL, NULL);
+
+	if (max_ext_leaf >= 0x80000001) {
+		cpuid(0x80000001, NULL, NULL, NULL, &edx);
+
+		if (edx & CPUID_80000001_EDX_PAGE1GB)
+			cpu_features |= CPU_FEATURE_PAGE1GB;
+
+		if (edx & CPUID_80000001_EDX_RDTSCP)
+			cpu_features |= CPU_FEATURE_RDTSCP;
+	}
+}
+
+void show_cpu_features(void)
+{
+	size_t i;
+
+	cprintf("CPU features:");
+
+	for (i = 0; i < CPU_NFEATURES; ++i) {
+		if (cpu_features & (1 << i))
+			cprintf(" %s", cpu_feature_names[i]);
+	}
+
+	cprintf("\n");
+}
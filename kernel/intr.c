@@ -0,0 +1,67 @@
+#include <types.h>
+#include <assert.h>
+#include <pic.h>
+#include <stdio.h>
+
+#include <x86-64/asm.h>
+#include <x86-64/gdt.h>
+#include <x86-64/idt.h>
+
+#include <kernel/intr.h>
+#include <kernel/pic.h>
+
+/* The entry stubs in isr.S. */
+extern void *isr_stubs[ISR_NSTUBS];
+
+static struct idt_entry idt[ISR_NSTUBS];
+static struct idtr idtr;
+static intr_handler_t intr_handlers[ISR_NSTUBS];
+
+/* Points the IDT at the entry stubs and loads it. Every vector gets an
+ * interrupt gate, such that handlers run with interrupts disabled.
+ */
+void idt_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < ISR_NSTUBS; ++i)
+		set_idt_entry(idt + i, isr_stubs[i],
+			IDT_PRESENT | IDT_PRIVL(0) | IDT_INT_GATE32, GDT_KCODE);
+
+	idtr.limit = sizeof idt - 1;
+	idtr.entries = idt;
+	idt_load();
+}
+
+/* Loads the IDT set up by idt_init() on the current CPU. */
+void idt_load(void)
+{
+	load_idt(&idtr);
+}
+
+/* Installs the handler for the vector, replacing the previous one. Pass NULL
+ * to remove the handler.
+ */
+void intr_register(unsigned vector, intr_handler_t handler)
+{
+	assert(vector < ISR_NSTUBS);
+	intr_handlers[vector] = handler;
+}
+
+/* Called by the entry stubs with the frame of the interrupted code. */
+void int_dispatch(struct int_frame *frame)
+{
+	unsigned vector = frame->int_no;
+	intr_handler_t handler = vector < ISR_NSTUBS ? intr_handlers[vector] :
+		NULL;
+
+	if (handler)
+		handler(frame);
+	else if (vector < IRQ_OFFSET)
+		panic("unhandled exception %u at %p, error code %p", vector,
+			frame->rip, frame->err_code);
+
+	/* Spurious and unhandled IRQs are simply acknowledged. */
+	if (vector >= IRQ_OFFSET && vector < IRQ_OFFSET + PIC_NIRQS)
+		pic_eoi(vector - IRQ_OFFSET);
+}
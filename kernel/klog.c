@@ -0,0 +1,304 @@
+#include <types.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/klog.h>
+#include <kernel/time.h>
+
+struct klog_ring klog_rings[NCPUS];
+int klog_console_level = KLOG_INFO;
+
+/* The position of the console in every ring, protected by klog_lock. */
+static struct klog_reader klog_console;
+static volatile uint32_t klog_lock;
+
+static const char * const klog_level_names[KLOG_NLEVELS] = {
+	[KLOG_ERR] = "err",
+	[KLOG_WARN] = "warn",
+	[KLOG_INFO] = "info",
+	[KLOG_DEBUG] = "debug",
+};
+
+static inline struct klog_rec *klog_rec_at(struct klog_ring *ring,
+	uint64_t pos)
+{
+	return (struct klog_rec *)(ring->buf + pos % KLOG_SIZE);
+}
+
+/* Appends a single record of at most KLOG_MAX_TEXT characters to the ring of
+ * the current CPU. Interrupts are disabled meanwhile, as an interrupt handler
+ * that logs would otherwise write to the same ring.
+ */
+static void klog_append(int level, const char *s, size_t n)
+{
+	struct klog_ring *ring = this_cpu()->log;
+	uint64_t rflags = read_rflags();
+	struct klog_rec *rec;
+	uint64_t pos, end;
+	size_t size, pad;
+
+	size = ROUNDUP(sizeof *rec + n, sizeof *rec);
+
+	cli();
+
+	pos = ring->head;
+	pad = pos % KLOG_SIZE + size > KLOG_SIZE ?
+		KLOG_SIZE - pos % KLOG_SIZE : 0;
+	end = pos + pad + size;
+
+	/* Invalidate what we are about to overwrite before touching it. */
+	ring->reserve = end;
+	barrier();
+
+	while (ring->tail + KLOG_SIZE < end)
+		ring->tail += klog_rec_at(ring, ring->tail)->size;
+
+	barrier();
+
+	if (pad) {
+		rec = klog_rec_at(ring, pos);
+		rec->len = 0;
+		rec->size = pad;
+		rec->level = KLOG_PAD;
+		pos += pad;
+	}
+
+	rec = klog_rec_at(ring, pos);
+	rec->time = ktime_ns();
+	rec->len = n;
+	rec->size = size;
+	rec->level = level;
+	rec->cpu = this_cpu_id();
+	memcpy(rec + 1, s, n);
+
+	barrier();
+	ring->head = end;
+
+	if (rflags & FLAGS_IF)
+		sti();
+}
+
+/* Logs the characters at the level, without writing them to the console. */
+void klog_write(int level, const char *s, size_t n)
+{
+	size_t count;
+
+	while (n > 0) {
+		count = MIN(n, KLOG_MAX_TEXT);
+		klog_append(level, s, count);
+		s += count;
+		n -= count;
+	}
+}
+
+/* Starts reading at the oldest record of every ring and stops at the records
+ * that are there now.
+ */
+void klog_reader_init(struct klog_reader *reader)
+{
+	size_t i;
+
+	for (i = 0; i < NCPUS; ++i) {
+		reader->pos[i] = klog_rings[i].tail;
+		reader->end[i] = klog_rings[i].head;
+	}
+}
+
+/* Copies the header of the next record of the ring into rec, skipping padding
+ * and moving pos past records that have been overwritten.
+ *
+ * Returns 0 if there is no record before end.
+ */
+static int klog_peek(struct klog_ring *ring, uint64_t *pos, uint64_t end,
+	struct klog_rec *rec)
+{
+	while (1) {
+		if (*pos < ring->tail)
+			*pos = ring->tail;
+
+		if (*pos >= MIN(end, ring->head))
+			return 0;
+
+		barrier();
+		*rec = *klog_rec_at(ring, *pos);
+		barrier();
+
+		if (ring->reserve - *pos > KLOG_SIZE)
+			continue;
+
+		if (rec->level != KLOG_PAD)
+			return 1;
+
+		*pos += rec->size;
+	}
+}
+
+/* Copies the next record in order of time into rec and its text into text,
+ * which must hold KLOG_MAX_TEXT characters.
+ *
+ * Returns 0 if there are no more records.
+ */
+int klog_reader_next(struct klog_reader *reader, struct klog_rec *rec,
+	char *text)
+{
+	struct klog_ring *ring;
+	struct klog_rec next;
+	size_t i, cpu;
+
+	while (1) {
+		cpu = NCPUS;
+
+		for (i = 0; i < NCPUS; ++i) {
+			if (!klog_peek(klog_rings + i, reader->pos + i,
+			    reader->end[i], &next))
+				continue;
+
+			if (cpu == NCPUS || next.time < rec->time) {
+				*rec = next;
+				cpu = i;
+			}
+		}
+
+		if (cpu == NCPUS)
+			return 0;
+
+		ring = klog_rings + cpu;
+		memcpy(text, klog_rec_at(ring, reader->pos[cpu]) + 1,
+			MIN(rec->len, KLOG_MAX_TEXT));
+		barrier();
+
+		/* Try again if the record got overwritten while copying. */
+		if (ring->reserve - reader->pos[cpu] > KLOG_SIZE)
+			continue;
+
+		reader->pos[cpu] += rec->size;
+
+		return 1;
+	}
+}
+
+/* Writes the records that have not been written to the console yet, unless
+ * another CPU is already doing so, in which case that CPU picks up our records
+ * as well. After a panic, the lock is ignored, as its holder may be dead.
+ */
+void klog_flush(void)
+{
+	struct klog_rec rec;
+	char text[KLOG_MAX_TEXT];
+	size_t i;
+
+	while (1) {
+		if (xchg(&klog_lock, 1) && !panicstr)
+			return;
+
+		for (i = 0; i < NCPUS; ++i)
+			klog_console.end[i] = ~(uint64_t)0;
+
+		while (klog_reader_next(&klog_console, &rec, text)) {
+			if (rec.level <= klog_console_level)
+				cputs(text, rec.len);
+		}
+
+		xchg(&klog_lock, 0);
+
+		/* Records logged while we held the lock would otherwise be stuck
+		 * until the next flush.
+		 */
+		for (i = 0; i < NCPUS; ++i) {
+			if (klog_console.pos[i] < klog_rings[i].head)
+				break;
+		}
+
+		if (i == NCPUS)
+			return;
+	}
+}
+
+static void klog_puts(const char *s, size_t n, void *putdat)
+{
+	klog_write(*(int *)putdat, s, n);
+}
+
+/* Formats the message into the log at the level and writes it to the console.
+ *
+ * Returns the number of characters logged.
+ */
+int vklog(int level, const char *fmt, va_list ap)
+{
+	char buf[PRINTBUF_SIZE];
+	struct printbuf pb = PRINTBUF_INIT(buf, sizeof buf, klog_puts, &level);
+	int cnt;
+
+	cnt = vbprintfmt(&pb, fmt, ap);
+	klog_flush();
+
+	return cnt;
+}
+
+int klog(int level, const char *fmt, ...)
+{
+	va_list ap;
+	int cnt;
+
+	va_start(ap, fmt);
+	cnt = vklog(level, fmt, ap);
+	va_end(ap);
+
+	return cnt;
+}
+
+/* Writes the records up to the level to the console, oldest first, with the
+ * time since boot at the start of every line. This bypasses the log, such that
+ * the dump does not end up in the log itself.
+ */
+void klog_dump(int level)
+{
+	struct klog_reader reader;
+	struct klog_rec rec;
+	char text[KLOG_MAX_TEXT], prefix[32];
+	int bol = 1, n;
+	size_t i, j;
+
+	klog_flush();
+	klog_reader_init(&reader);
+
+	while (klog_reader_next(&reader, &rec, text)) {
+		if (rec.level > level)
+			continue;
+
+		for (i = 0; i < rec.len; i = j) {
+			for (j = i; j < rec.len && text[j++] != '\n';)
+				;
+
+			if (bol) {
+				n = snprintf(prefix, sizeof prefix,
+					"[%5lu.%06lu] ",
+					rec.time / NSEC_PER_SEC,
+					rec.time % NSEC_PER_SEC / NSEC_PER_USEC);
+				cputs(prefix, n);
+			}
+
+			cputs(text + i, j - i);
+			bol = text[j - 1] == '\n';
+		}
+	}
+
+	if (!bol)
+		cputs("\n", 1);
+}
+
+/* Returns the level with the name, or -1 if there is none. */
+int klog_parse_level(const char *name)
+{
+	int level;
+
+	for (level = 0; level < KLOG_NLEVELS; ++level) {
+		if (strcmp(name, klog_level_names[level]) == 0)
+			return level;
+	}
+
+	return -1;
+}
@@ -0,0 +1,46 @@
+#include <types.h>
+#include <stdio.h>
+
+#include <kernel/ksym.h>
+
+/* Looks up the symbol containing addr: the last symbol at or below addr. If
+ * offset is not NULL, it is set to the distance of addr from the symbol.
+ *
+ * Returns the name of the symbol or NULL if addr lies before the first one.
+ */
+const char *ksym_lookup(uintptr_t addr, uintptr_t *offset)
+{
+	size_t lo = 0, hi = ksym_count, mid;
+
+	/* Find the first symbol beyond addr. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (ksym_addrs[mid] <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo)
+		return NULL;
+
+	if (offset)
+		*offset = addr - ksym_addrs[lo - 1];
+
+	return ksym_names + ksym_offsets[lo - 1];
+}
+
+/* Prints the address as <symbol>+<offset>, or as is without a symbol. */
+void print_ksym(uintptr_t addr)
+{
+	const char *name;
+	uintptr_t offset;
+
+	name = ksym_lookup(addr, &offset);
+
+	if (name)
+		cprintf("%s+0x%lx", name, offset);
+	else
+		cprintf("%016p", addr);
+}
@@ -0,0 +1,41 @@
+# Turns the output of nm -n into an assembly file holding a table of the text
+# symbols of the kernel, sorted by address, for ksym_lookup() in kernel/ksym.c.
+# Without input it generates an empty table, for the first link of the kernel.
+
+BEGIN {
+	n = 0
+}
+
+$2 ~ /^[TtW]$/ {
+	addr[n] = $1
+	name[n] = $3
+	n++
+}
+
+END {
+	print "/* Generated by kernel/ksyms.awk, do not edit. */"
+	print ".section .rodata"
+	print ".balign 8"
+	print ".global ksym_count"
+	print "ksym_count:"
+	printf "\t.quad %d\n", n
+	print ".global ksym_addrs"
+	print "ksym_addrs:"
+
+	for (i = 0; i < n; i++)
+		printf "\t.quad 0x%s\n", addr[i]
+
+	print ".global ksym_offsets"
+	print "ksym_offsets:"
+
+	for (i = off = 0; i < n; i++) {
+		printf "\t.long %d\n", off
+		off += length(name[i]) + 1
+	}
+
+	print ".global ksym_names"
+	print "ksym_names:"
+
+	for (i = 0; i < n; i++)
+		printf "\t.asciz \"%s\"\n", name[i]
+}
@@ -0,0 +1,213 @@
+#include <types.h>
+#include <assert.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+#include <kernel/intr.h>
+#include <kernel/kwork.h>
+#include <kernel/lapic.h>
+#include <kernel/mem.h>
+
+static struct kwork_queue kwork_queues[NCPUS];
+
+/* The CPUs that are halted or about to halt, waiting for work. */
+static volatile uint64_t kwork_idle_mask;
+
+/* The wakeup IPI only has to get the CPU out of hlt. */
+static void kwork_intr(struct int_frame *frame)
+{
+	lapic_eoi();
+}
+
+/* Sets up the empty queues and installs the handler of the wakeup IPI. */
+void kwork_init(void)
+{
+	struct kwork_queue *queue;
+	size_t i;
+
+	for (i = 0; i < NCPUS; ++i) {
+		queue = kwork_queues + i;
+		spin_init(&queue->lock);
+		queue->head = 0;
+		queue->tail = 0;
+	}
+
+	kwork_idle_mask = 0;
+	intr_register(INT_KWORK_WAKE, kwork_intr);
+}
+
+/* Sends the wakeup IPI to the CPU, unless someone else already took it off the
+ * idle mask and is waking it up.
+ */
+static void kwork_wake(unsigned cpu)
+{
+	uint64_t bit = (uint64_t)1 << cpu;
+
+	if (__atomic_fetch_and(&kwork_idle_mask, ~bit, __ATOMIC_SEQ_CST) & bit)
+		lapic_ipi(cpus[cpu].lapic_id, INT_KWORK_WAKE);
+}
+
+/* Wakes up every idle CPU, for when something other than queued work changes
+ * what they are waiting for in kwork_idle().
+ */
+void kwork_wake_all(void)
+{
+	uint64_t idle = kwork_idle_mask;
+
+	while (idle) {
+		kwork_wake(bsf(idle));
+		idle &= idle - 1;
+	}
+}
+
+/* Runs the work and marks it as done. The item may be gone as soon as pending
+ * is cleared, so it must not be touched afterwards.
+ */
+static void kwork_exec(struct kwork *work)
+{
+	work->fn(work->arg);
+	__atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+}
+
+/* Queues the work on the current CPU, and wakes up an idle CPU to steal it.
+ * Submitting work that is still pending does nothing. This must not be called
+ * from interrupt handlers.
+ */
+void kwork_submit(struct kwork *work)
+{
+	unsigned self = this_cpu_id();
+	struct kwork_queue *queue = kwork_queues + self;
+	uint64_t idle;
+
+	if (xchg(&work->pending, 1))
+		return;
+
+	spin_lock(&queue->lock);
+
+	if (queue->tail - queue->head == KWORK_QUEUE_SIZE) {
+		spin_unlock(&queue->lock);
+		kwork_exec(work);
+		return;
+	}
+
+	queue->items[queue->tail % KWORK_QUEUE_SIZE] = work;
+	++queue->tail;
+	spin_unlock(&queue->lock);
+
+	/* Queue the work before looking for idle CPUs: a CPU that announces
+	 * itself as idle afterwards sees the work before it halts.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	idle = kwork_idle_mask & ~((uint64_t)1 << self);
+
+	if (idle)
+		kwork_wake(bsf(idle));
+}
+
+/* Takes the newest work of our own queue or the oldest work of another queue.
+ * Other queues are skipped if they are locked, as there is no point in waiting
+ * for them when there are other queues to steal from.
+ *
+ * Returns NULL if the queue is empty.
+ */
+static struct kwork *kwork_take(struct kwork_queue *queue, int own)
+{
+	struct kwork *work = NULL;
+
+	if (queue->head == queue->tail)
+		return NULL;
+
+	if (own)
+		spin_lock(&queue->lock);
+	else if (!spin_trylock(&queue->lock))
+		return NULL;
+
+	if (queue->head != queue->tail) {
+		if (own)
+			work = queue->items[--queue->tail % KWORK_QUEUE_SIZE];
+		else
+			work = queue->items[queue->head++ % KWORK_QUEUE_SIZE];
+	}
+
+	spin_unlock(&queue->lock);
+
+	return work;
+}
+
+/* Runs a single piece of work, from the queue of the current CPU if there is
+ * any, and stolen from the other CPUs otherwise.
+ *
+ * Returns 0 if there was no work to run.
+ */
+int kwork_run(void)
+{
+	unsigned self = this_cpu_id();
+	struct kwork *work;
+	size_t i;
+
+	work = kwork_take(kwork_queues + self, 1);
+
+	for (i = 1; !work && i < ncpus; ++i)
+		work = kwork_take(kwork_queues + (self + i) % ncpus, 0);
+
+	if (!work)
+		return 0;
+
+	kwork_exec(work);
+
+	return 1;
+}
+
+/* Waits for the work to be done, running queued work meanwhile, which may well
+ * be the work itself. As any work may run, the caller must not hold locks that
+ * work might take.
+ */
+void kwork_wait(struct kwork *work)
+{
+	while (work->pending) {
+		if (kwork_run())
+			continue;
+
+		tlb_poll(this_cpu_id());
+		pause();
+	}
+
+	/* Keep the accesses to the results of the work after the check. */
+	barrier();
+}
+
+/* Returns whether any CPU has work queued. */
+static int kwork_queued(void)
+{
+	size_t i;
+
+	for (i = 0; i < ncpus; ++i) {
+		if (kwork_queues[i].head != kwork_queues[i].tail)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Halts the CPU until there is work to run or *word no longer holds val,
+ * whoever changes it has to call kwork_wake_all() afterwards. This has to be
+ * called with interrupts disabled, and they are only enabled while halted.
+ */
+void kwork_idle(volatile uint32_t *word, uint32_t val)
+{
+	uint64_t bit = (uint64_t)1 << this_cpu_id();
+
+	__atomic_fetch_or(&kwork_idle_mask, bit, __ATOMIC_SEQ_CST);
+
+	/* Anyone changing things from here on sees us in the idle mask and
+	 * wakes us up. sti only takes effect after hlt has started, so the
+	 * wakeup cannot slip in between.
+	 */
+	if (*word == val && !kwork_queued()) {
+		sti_hlt();
+		cli();
+	}
+
+	__atomic_fetch_and(&kwork_idle_mask, ~bit, __ATOMIC_SEQ_CST);
+}
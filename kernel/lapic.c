@@ -0,0 +1,105 @@
+#include <types.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/intr.h>
+#include <kernel/lapic.h>
+#include <kernel/mem.h>
+#include <kernel/time.h>
+
+/* The memory mapped registers of the local APIC. The boot stub maps at least
+ * the first 4 GiB, which covers the default base at 0xFEE00000.
+ */
+static volatile uint32_t *lapic;
+
+static inline uint32_t lapic_read(size_t reg)
+{
+	return lapic[reg / sizeof *lapic];
+}
+
+static inline void lapic_write(size_t reg, uint32_t val)
+{
+	lapic[reg / sizeof *lapic] = val;
+
+	/* Wait for the write to finish by reading back the ID. */
+	(void)lapic[LAPIC_ID / sizeof *lapic];
+}
+
+/* Sets up the local APIC of the boot CPU at physical address pa, or at the
+ * address in the APIC base MSR if pa is zero.
+ */
+void lapic_init(physaddr_t pa)
+{
+	uint64_t base;
+
+	base = read_msr(MSR_APIC_BASE);
+
+	if (!pa)
+		pa = PAGE_ADDR(base);
+
+	write_msr(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+
+	if (pa >= boot_map_lim)
+		panic("lapic_init: local APIC at %p is not mapped", pa);
+
+	lapic = (volatile uint32_t *)(KERNEL_VMA + pa);
+	lapic_cpu_init();
+}
+
+/* Software enables the local APIC of the CPU we are running on, which it needs
+ * to accept IPIs. Spurious interrupts have no handler and need no EOI.
+ */
+void lapic_cpu_init(void)
+{
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | INT_SPURIOUS);
+}
+
+/* Returns the APIC ID of the CPU we are running on. */
+unsigned lapic_id(void)
+{
+	if (!lapic)
+		return 0;
+
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+static void lapic_send_ipi(unsigned apic_id, uint32_t cmd)
+{
+	lapic_write(LAPIC_ICR_HI, apic_id << 24);
+	lapic_write(LAPIC_ICR_LO, cmd);
+
+	while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+		pause();
+}
+
+/* Sends an IPI with the vector to the CPU with the given APIC ID. */
+void lapic_ipi(unsigned apic_id, unsigned vector)
+{
+	lapic_send_ipi(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+/* Signals the end of the interrupt that is being handled. */
+void lapic_eoi(void)
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/* Starts the AP with the given APIC ID at the page aligned physical address
+ * entry below 1 MiB, using the INIT-SIPI-SIPI sequence of the MultiProcessor
+ * Specification.
+ */
+void lapic_start_ap(unsigned apic_id, physaddr_t entry)
+{
+	size_t i;
+
+	lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL |
+		LAPIC_ICR_ASSERT);
+	udelay(200);
+	lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+	udelay(10000);
+
+	for (i = 0; i < 2; ++i) {
+		lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (entry >> 12));
+		udelay(200);
+	}
+}
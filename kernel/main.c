@@ -1,6 +1,12 @@
 #include <kernel/console.h>
+#include <kernel/cpufeature.h>
+#include <kernel/intr.h>
+#include <kernel/klog.h>
 #include <kernel/mem.h>
 #include <kernel/monitor.h>
+#include <kernel/pic.h>
+#include <kernel/tests.h>
+#include <kernel/time.h>
 
 #include <boot.h>
 #include <stdio.h>
@@ -16,14 +22,40 @@ void kmain(struct boot_info *boot_info)
 	 */
 	memset(edata, 0, end - edata);
 
+	/* Set up the per-CPU data area of the boot CPU. */
+	cpu_init(0);
+
+	/* Probe the CPU and patch in the string routines that are the fastest
+	 * on it.
+	 */
+	cpu_features_init();
+	string_init();
+
+	/* Calibrate the TSC, such that the console can time its polling. */
+	tsc_init();
+
 	/* Initialize the console.
 	 * Can't call cprintf until after we do this! */
 	cons_init();
 	cprintf("\n");
+	cprintf("TSC: %u kHz\n", tsc_khz);
+	show_cpu_features();
+
+	/* Set up the IDT and the PICs, leaving all IRQs but the ones of the
+	 * console masked.
+	 */
+	idt_init();
+	pic_init();
+	cons_intr_init();
 
 	/* Lab 1 memory management initialization functions */
 	mem_init(boot_info);
 
+#ifdef BENCH
+	/* Benchmark kernels are built by make bench. */
+	mem_bench();
+#endif
+
 	/* Drop into the kernel monitor. */
 	while (1)
 		monitor(NULL);
@@ -52,10 +84,12 @@ void _panic(const char *file, int line, const char *fmt,...)
 	__asm __volatile("cli; cld");
 
 	va_start(ap, fmt);
-	cprintf("kernel panic at %s:%d: ", file, line);
-	vcprintf(fmt, ap);
-	cprintf("\n");
+	klog(KLOG_ERR, "kernel panic at %s:%d: ", file, line);
+	vklog(KLOG_ERR, fmt, ap);
+	klog(KLOG_ERR, "\n");
 	va_end(ap);
+	mon_backtrace(0, NULL, NULL);
+	cons_flush();
 
 dead:
 	/* Break into the kernel monitor */
@@ -69,8 +103,8 @@ void _warn(const char *file, int line, const char *fmt,...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	cprintf("kernel warning at %s:%d: ", file, line);
-	vcprintf(fmt, ap);
-	cprintf("\n");
+	klog(KLOG_WARN, "kernel warning at %s:%d: ", file, line);
+	vklog(KLOG_WARN, fmt, ap);
+	klog(KLOG_WARN, "\n");
 	va_end(ap);
 }
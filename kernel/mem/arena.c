@@ -0,0 +1,126 @@
+#include <types.h>
+#include <list.h>
+#include <paging.h>
+
+#include <kernel/mem.h>
+
+/* Sets up an empty arena that is backed by chunks of 2^order pages. No memory
+ * is allocated until the first call to arena_alloc().
+ */
+void arena_init(struct arena *arena, size_t order)
+{
+	list_init(&arena->chunks);
+	arena->cur = NULL;
+	arena->end = NULL;
+	arena->order = order;
+}
+
+static inline char *arena_chunk_end(struct arena_chunk *chunk)
+{
+	return (char *)chunk + (PAGE_SIZE << chunk->order);
+}
+
+/* Allocates a new chunk large enough to hold size bytes aligned to align bytes
+ * and makes it the current chunk.
+ *
+ * Returns NULL if out of memory.
+ */
+static struct arena_chunk *arena_grow(struct arena *arena, size_t size,
+	size_t align)
+{
+	struct arena_chunk *chunk;
+	struct page_info *page;
+	size_t order = arena->order;
+	size_t need = ROUNDUP(sizeof *chunk, align) + size;
+
+	while (order < BUDDY_MAX_ORDER && (PAGE_SIZE << order) < need)
+		++order;
+
+	if (order >= BUDDY_MAX_ORDER)
+		return NULL;
+
+	page = page_alloc_order(order, 0);
+
+	if (!page)
+		return NULL;
+
+	chunk = page2kva(page);
+	chunk->order = order;
+	list_add_tail(&arena->chunks, &chunk->node);
+
+	arena->cur = (char *)(chunk + 1);
+	arena->end = arena_chunk_end(chunk);
+
+	return chunk;
+}
+
+/* Allocates size bytes aligned to align bytes, which must be a power of two,
+ * or to the size of a pointer if align is zero. Requests that do not fit the
+ * current chunk start a new chunk, leaving the rest of the current chunk
+ * unused until the arena is reset.
+ *
+ * Returns NULL if out of memory.
+ */
+void *arena_alloc(struct arena *arena, size_t size, size_t align)
+{
+	char *ptr;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+
+	ptr = ROUNDUP(arena->cur, align);
+
+	if (!arena->cur || ptr > arena->end || size > (size_t)(arena->end - ptr)) {
+		if (!arena_grow(arena, size, align))
+			return NULL;
+
+		ptr = ROUNDUP(arena->cur, align);
+	}
+
+	arena->cur = ptr + size;
+
+	return ptr;
+}
+
+/* Records the current position of the arena. */
+void arena_mark(struct arena *arena, struct arena_mark *mark)
+{
+	struct list *node = list_tail(&arena->chunks);
+
+	mark->chunk = node ? container_of(node, struct arena_chunk, node) :
+		NULL;
+	mark->cur = arena->cur;
+}
+
+/* Frees everything allocated since the mark was taken, returning the chunks
+ * allocated since then to the buddy allocator. Marks taken after this mark are
+ * no longer valid.
+ */
+void arena_reset(struct arena *arena, struct arena_mark *mark)
+{
+	struct arena_chunk *chunk;
+	struct list *node;
+
+	while ((node = list_tail(&arena->chunks))) {
+		chunk = container_of(node, struct arena_chunk, node);
+
+		if (chunk == mark->chunk)
+			break;
+
+		list_del(node);
+		page_free(pa2page(PADDR(chunk)));
+	}
+
+	arena->cur = mark->cur;
+	arena->end = mark->chunk ? arena_chunk_end(mark->chunk) : NULL;
+}
+
+/* Returns all memory of the arena to the buddy allocator. The arena is empty
+ * afterwards and may be used again.
+ */
+void arena_release(struct arena *arena)
+{
+	struct arena_mark mark = { NULL, NULL };
+
+	arena_reset(arena, &mark);
+}
@@ -1,5 +1,6 @@
 #include <types.h>
 #include <paging.h>
+#include <string.h>
 
 #include <kernel/mem.h>
 
@@ -25,11 +26,14 @@ void *boot_alloc(uint32_t n)
 	/* Initialize next_free if this is the first time. 'end' is a magic
 	 * symbol automatically generated by the linker, which points to the
 	 * end of the kernel's bss segment: the first virtual address that the
-	 * linker did not assign to any kernel code or global variables.
+	 * linker did not assign to any kernel code or global variables. The
+	 * boot stub may have placed page directories right after it, so skip
+	 * those as well.
 	 */
 	if (!next_free) {
 		extern char end[];
-		next_free = ROUNDUP((char *)end, PAGE_SIZE);
+		next_free = MAX(ROUNDUP((char *)end, PAGE_SIZE),
+			(char *)KERNEL_VMA + boot_pt_end);
 	}
 
 	/* Allocate a chunk large enough to hold 'n' bytes, then update
@@ -80,6 +84,112 @@ void align_boot_info(struct boot_info *boot_info)
 	}
 }
 
+/* The free physical memory, as a list of page-aligned regions sorted by
+ * address, none of which overlap or touch each other.
+ */
+struct boot_region boot_regions[BOOT_NREGIONS];
+size_t boot_nregions;
+
+static void boot_region_insert(size_t i, physaddr_t start, physaddr_t end)
+{
+	if (boot_nregions == BOOT_NREGIONS)
+		panic("boot_region_insert: too many regions\n");
+
+	memmove(boot_regions + i + 1, boot_regions + i,
+		(boot_nregions - i) * sizeof *boot_regions);
+	boot_regions[i].start = start;
+	boot_regions[i].end = end;
+	++boot_nregions;
+}
+
+static void boot_region_delete(size_t i)
+{
+	--boot_nregions;
+	memmove(boot_regions + i, boot_regions + i + 1,
+		(boot_nregions - i) * sizeof *boot_regions);
+}
+
+/* Removes [start, end) from the free regions, trimming or splitting the
+ * regions it overlaps.
+ */
+void boot_regions_remove(physaddr_t start, physaddr_t end)
+{
+	struct boot_region *region;
+	size_t i = 0;
+
+	while (i < boot_nregions) {
+		region = boot_regions + i;
+
+		if (region->end <= start) {
+			++i;
+			continue;
+		}
+
+		if (region->start >= end)
+			break;
+
+		if (region->start < start && region->end > end) {
+			boot_region_insert(i + 1, end, region->end);
+			boot_regions[i].end = start;
+			break;
+		}
+
+		if (region->start < start) {
+			region->end = start;
+			++i;
+		} else if (region->end > end) {
+			region->start = end;
+			break;
+		} else {
+			boot_region_delete(i);
+		}
+	}
+}
+
+/* Builds the list of free regions from the memory map, which must have been
+ * aligned by align_boot_info() already. The free entries are sorted and merged
+ * with their neighbours, and then anything any other entry claims is taken out
+ * again, as the firmware may report overlapping entries.
+ */
+void boot_regions_init(struct boot_info *boot_info)
+{
+	struct mmap_entry *entry, *mmap;
+	struct boot_region *region;
+	size_t i, j;
+
+	mmap = (struct mmap_entry *)((physaddr_t)boot_info->mmap_addr);
+	boot_nregions = 0;
+
+	for (i = 0, entry = mmap; i < boot_info->mmap_len; ++i, ++entry) {
+		if (entry->type != MMAP_FREE || !entry->len)
+			continue;
+
+		for (j = boot_nregions; j > 0 &&
+		     boot_regions[j - 1].start > entry->addr; --j)
+			;
+
+		boot_region_insert(j, entry->addr, entry->addr + entry->len);
+	}
+
+	for (i = 1; i < boot_nregions;) {
+		region = boot_regions + i - 1;
+
+		if (boot_regions[i].start > region->end) {
+			++i;
+			continue;
+		}
+
+		region->end = MAX(region->end, boot_regions[i].end);
+		boot_region_delete(i);
+	}
+
+	for (i = 0, entry = mmap; i < boot_info->mmap_len; ++i, ++entry) {
+		if (entry->type != MMAP_FREE)
+			boot_regions_remove(entry->addr,
+				entry->addr + entry->len);
+	}
+}
+
 void show_boot_mmap(struct boot_info *boot_info)
 {
 	struct mmap_entry *entry;
@@ -1,37 +1,125 @@
 #include <types.h>
-#include <list.h>
 #include <paging.h>
 #include <string.h>
 
+#include <x86-64/asm.h>
+
 #include <kernel/mem.h>
 
-/* Physical page metadata. */
+/* Physical page metadata. Only the first npages_init entries of pages have
+ * been initialized, see page_init_deferred().
+ */
 size_t npages;
+size_t npages_init;
 struct page_info *pages;
 
+/* The migrate type of every pageblock, see page_migrate_type(). */
+uint8_t *pageblock_types;
+
 /*
- * List of free buddy chunks (often also referred to as buddy pages or simply
- * pages). Each order has a list containing all free buddy chunks of the
- * specific buddy order. Buddy orders go from 0 to BUDDY_MAX_ORDER - 1
+ * The buddy zones of the NUMA nodes. Every zone has a free list for every
+ * order containing all free buddy chunks of the specific buddy order in that
+ * zone (often also referred to as buddy pages or simply pages). Buddy orders
+ * go from 0 to BUDDY_MAX_ORDER - 1.
+ */
+struct buddy_zone buddy_zones[NNODES];
+
+/* The types to claim pageblocks from once a migrate type runs out of free
+ * chunks, in order of preference.
+ */
+static const uint8_t migrate_fallback[MIGRATE_TYPES][MIGRATE_TYPES - 1] = {
+	[MIGRATE_UNMOVABLE] = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE },
+	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE, MIGRATE_MOVABLE },
+	[MIGRATE_MOVABLE] = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE },
+};
+
+/* Sets up empty free lists for every zone. */
+void buddy_init(void)
+{
+	struct buddy_zone *zone;
+	size_t node, order, migrate;
+
+	for (node = 0; node < NNODES; ++node) {
+		zone = buddy_zones + node;
+
+		for (migrate = 0; migrate < MIGRATE_TYPES; ++migrate) {
+			for (order = 0; order < BUDDY_MAX_ORDER; ++order)
+				page_list_init(zone->free_list[migrate] + order);
+
+			zone->free_mask[migrate] = 0;
+		}
+
+		spin_init(&zone->lock);
+		memset(&zone->stats, 0, sizeof zone->stats);
+	}
+}
+
+/* Adds the free page to the free list of the given order and the migrate type
+ * of its pageblock in its zone. The caller must hold the lock of the zone.
+ */
+static void buddy_list_add(struct page_info *page, size_t order)
+{
+	struct buddy_zone *zone = buddy_zones + page->pp_node;
+	unsigned migrate = page_migrate_type(page);
+
+	page_list_add(zone->free_list[migrate] + order, page);
+	zone->free_mask[migrate] |= UINT32_C(1) << order;
+	++zone->stats.nfree[order];
+	zone->stats.nfree_pages += (size_t)1 << order;
+}
+
+/* Removes the free page from the free list of the given order and the migrate
+ * type of its pageblock in its zone. The caller must hold the lock of the zone.
  */
-struct list buddy_free_list[BUDDY_MAX_ORDER];
+static void buddy_list_del(struct page_info *page, size_t order)
+{
+	struct buddy_zone *zone = buddy_zones + page->pp_node;
+	unsigned migrate = page_migrate_type(page);
+
+	page_list_del(zone->free_list[migrate] + order, page);
+
+	if (page_list_is_empty(zone->free_list[migrate] + order))
+		zone->free_mask[migrate] &= ~(UINT32_C(1) << order);
+
+	--zone->stats.nfree[order];
+	zone->stats.nfree_pages -= (size_t)1 << order;
+}
+
+/* Sums up the free page counters of all zones into stats. The counters of
+ * every zone are only written with the lock of the zone held, so there is no
+ * shared counter for the CPUs to fight over.
+ */
+void buddy_get_stats(struct buddy_stats *stats)
+{
+	struct buddy_stats *zone_stats;
+	size_t node, order;
+
+	memset(stats, 0, sizeof *stats);
+
+	for (node = 0; node < nnodes; ++node) {
+		zone_stats = &buddy_zones[node].stats;
+
+		for (order = 0; order < BUDDY_MAX_ORDER; ++order)
+			stats->nfree[order] += zone_stats->nfree[order];
+
+		stats->nfree_pages += zone_stats->nfree_pages;
+	}
+}
 
 /* Counts the number of free pages for the given order.
  */
 size_t count_free_pages(size_t order)
 {
-	struct list *node;
-	size_t nfree_pages = 0;
+	size_t node, n = 0;
 
 	if (order >= BUDDY_MAX_ORDER) {
 		return 0;
 	}
 
-	list_foreach(buddy_free_list + order, node) {
-		++nfree_pages;
-	}
+	for (node = 0; node < nnodes; ++node)
+		n += buddy_zones[node].stats.nfree[order];
 
-	return nfree_pages;
+	return n;
 }
 
 /* Shows the number of free pages in the buddy allocator as well as the amount
@@ -41,40 +129,65 @@ size_t count_free_pages(size_t order)
  */
 void show_buddy_info(void)
 {
-	struct page_info *page;
-	struct list *node;
-	size_t order;
-	size_t nfree_pages;
-	size_t nfree = 0;
+	struct buddy_stats stats;
+	size_t nblocks[MIGRATE_TYPES];
+	size_t order, node;
+
+	buddy_get_stats(&stats);
 
 	cprintf("Buddy allocator:\n");
 
 	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		nfree_pages = count_free_pages(order);
-
-		cprintf("  order #%u pages=%u\n", order, nfree_pages);
-
-		nfree += nfree_pages * (1 << (order + 12));
+		cprintf("  order #%u pages=%u\n", order, stats.nfree[order]);
 	}
 
-	cprintf("  free: %u kiB\n", nfree / 1024);
+	cprintf("  cached pages=%u\n", count_cached_pages());
+	cprintf("  zeroed pages=%u\n", count_zeroed_pages());
+	cprintf("  page table pages=%u\n", count_pt_pool_pages());
+	cprintf("  free: %u kiB\n", stats.nfree_pages * (PAGE_SIZE / 1024));
+
+	count_pageblocks(nblocks);
+	cprintf("  pageblocks: unmovable=%u reclaimable=%u movable=%u\n",
+		nblocks[MIGRATE_UNMOVABLE], nblocks[MIGRATE_RECLAIMABLE],
+		nblocks[MIGRATE_MOVABLE]);
+
+	if (nnodes > 1) {
+		for (node = 0; node < nnodes; ++node) {
+			cprintf("  node #%u free: %u kiB\n", node,
+				count_node_free_pages(node) * (PAGE_SIZE / 1024));
+		}
+	}
 }
 
 /* Gets the total amount of free pages. */
 size_t count_total_free_pages(void)
 {
-	struct page_info *page;
-	struct list *node;
-	size_t order;
-	size_t nfree_pages;
-	size_t nfree = 0;
+	size_t node, n = 0;
 
-	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		nfree_pages = count_free_pages(order);
-		nfree += nfree_pages * (1 << order);
-	}
+	for (node = 0; node < nnodes; ++node)
+		n += buddy_zones[node].stats.nfree_pages;
+
+	return n;
+}
+
+/* Counts the initialized pageblocks of every migrate type. */
+void count_pageblocks(size_t *nblocks)
+{
+	size_t i;
+
+	memset(nblocks, 0, MIGRATE_TYPES * sizeof *nblocks);
+
+	for (i = 0; i < npages_init; i += PAGEBLOCK_PAGES)
+		++nblocks[page_migrate_type(pages + i)];
+}
+
+/* Gets the amount of free pages in the zone of the given node. */
+size_t count_node_free_pages(unsigned node)
+{
+	if (node >= NNODES)
+		return 0;
 
-	return nfree;
+	return buddy_zones[node].stats.nfree_pages;
 }
 
 /* Splits lhs into free pages until the order of the page is the requested
@@ -86,31 +199,34 @@ size_t count_total_free_pages(void)
  *  - Mark the buddy page as free and add it to the free list.
  *  - Repeat until the page is of the requested order.
  *
+ * The caller must hold the lock of the zone of the page.
+ *
  * Returns a page of the requested order.
  */
- struct page_info *buddy_split(struct page_info *lhs, size_t req_order)
+struct page_info *buddy_split(struct page_info *lhs, size_t req_order)
 {
 	/* LAB 1: your code here. */
-	size_t order = 0;
+	size_t order;
 	struct page_info *buddy;
 	physaddr_t buddy_pa;
-	physaddr_t lhs_pa;
+
+	mem_trace_split(lhs->pp_order - req_order);
 
 	while (lhs->pp_order > req_order) {
-        order = lhs->pp_order - 1;
-		lhs_pa = page2pa(lhs);
-		buddy_pa = lhs_pa ^ (PAGE_SIZE << (lhs->pp_order - 1));
+		order = lhs->pp_order - 1;
+		buddy_pa = page2pa(lhs) ^ (PAGE_SIZE << order);
 		buddy = pa2page(buddy_pa);
 
-        lhs->pp_order = order;
+		lhs->pp_order = order;
 		lhs->pp_free = 0;
 
-        buddy->pp_order = order;
-        buddy->pp_free = 1;
+		buddy->pp_order = order;
+		buddy->pp_free = 1;
 
-        list_add(&buddy_free_list[order], &(buddy->pp_node));
-    }
-    return lhs;
+		buddy_list_add(buddy, order);
+	}
+
+	return lhs;
 }
 
 /* Merges the buddy of the page with the page if the buddy is free to form
@@ -120,78 +236,427 @@ size_t count_total_free_pages(void)
  * The algorithm to merge pages is as follows:
  *  - Given the page of order k, locate the page with the lowest address
  *    and its buddy of order k.
- *  - Check if both the page and the buddy are free and whether the order
- *    matches.
+ *  - Check if both the page and the buddy are free, whether the order
+ *    matches and whether they belong to the same node.
  *  - Remove the page and its buddy from the free list.
  *  - Increment the order of the page.
  *  - Repeat until the maximum order has been reached or until the buddy is not
  *    free.
  *
+ * The zone of the page is locked for the duration of the merge.
+ *
  * Returns the largest merged free page possible.
  */
 struct page_info *buddy_merge(struct page_info *page)
 {
 	/* LAB 1: your code here. */
 	size_t order = page->pp_order;
-
+	size_t start_order = order;
+	struct buddy_zone *zone = buddy_zones + page->pp_node;
 	struct page_info *buddy;
-	struct page_info *tmp_page;
-	
 	physaddr_t buddy_pa;
 	physaddr_t page_pa;
-	while (order < BUDDY_MAX_ORDER) {
-        //size_t buddy_page_num = page_num ^ (1 << order);
-        //struct page_info *buddy = &pages[buddy_page_num];
+
+	spin_lock(&zone->lock);
+
+	while (order < BUDDY_MAX_ORDER - 1) {
 		page_pa = page2pa(page);
-		buddy_pa = page_pa ^ (PAGE_SIZE << (page->pp_order));
+		buddy_pa = page_pa ^ (PAGE_SIZE << order);
+
+		/* The buddy may lie beyond the end of physical memory. */
+		if (PAGE_INDEX(buddy_pa) >= npages)
+			break;
+
 		buddy = pa2page(buddy_pa);
 
-        if (!buddy->pp_free || buddy->pp_order != order) {
-            break;
-        }
+		if (!buddy->pp_free || buddy->pp_order != order ||
+		    buddy->pp_node != page->pp_node)
+			break;
+
+		buddy_list_del(buddy, order);
+
+		if (buddy_pa < page_pa)
+			page = buddy;
 
-        if (buddy_pa < page_pa) {
-            page = buddy;  
-        }
-		list_del(&buddy->pp_node);
-        order++;
+		++order;
 		buddy->pp_order = order;
 		buddy->pp_free = 0;
-        page->pp_order = order;
+		page->pp_order = order;
 		page->pp_free = 0;
-    }
+	}
+
 	page->pp_free = 1;
-	list_add(&buddy_free_list[page->pp_order], &page->pp_node);
-    return page;
+	buddy_list_add(page, page->pp_order);
+
+	spin_unlock(&zone->lock);
+	mem_trace_merge(order - start_order);
+
+	return page;
+}
+
+/* Hands the pages in the physical address range [start, end) to the buddy
+ * allocator. Rather than merging every single page, the range is carved into
+ * the largest naturally aligned chunks that fit, such that only the ragged
+ * edges of the range and of the nodes within it end up as smaller chunks.
+ * Every chunk still goes through buddy_merge() to combine it with free chunks
+ * bordering the range.
+ *
+ * Both start and end must be page aligned and lie within physical memory.
+ */
+void buddy_free_range(physaddr_t start, physaddr_t end)
+{
+	struct page_info *page;
+	physaddr_t node_end;
+	size_t idx, n, order;
+
+	idx = PAGE_INDEX(start);
+
+	while (idx < PAGE_INDEX(end)) {
+		/* Chunks may not span multiple nodes. */
+		numa_lookup(idx * PAGE_SIZE, &node_end);
+		n = PAGE_INDEX(MIN(end, node_end)) - idx;
+		/* The chunk is limited by both the alignment of its index and
+		 * the number of pages left.
+		 */
+		order = bsr(n);
+
+		if (idx && bsf(idx) < order)
+			order = bsf(idx);
+
+		if (order > BUDDY_MAX_ORDER - 1)
+			order = BUDDY_MAX_ORDER - 1;
+
+		page = pages + idx;
+		page->pp_order = order;
+		page->pp_free = 0;
+		buddy_merge(page);
+
+		idx += (size_t)1 << order;
+	}
+}
+
+/* Takes the first free chunk of the given order and migrate type off its list.
+ */
+static struct page_info *buddy_zone_take(struct buddy_zone *zone,
+	unsigned migrate, size_t order)
+{
+	struct page_info *page;
+
+	page = page_list_head(zone->free_list[migrate] + order);
+	buddy_list_del(page, order);
+	page->pp_free = 0;
+
+	return page;
+}
+
+/* Moves the pageblock of the page over to the given migrate type, along with
+ * any free chunks in it, if at least half of the pageblock is free. The page
+ * itself has already been taken off the free lists.
+ */
+static void buddy_claim_pageblock(struct page_info *page, unsigned migrate)
+{
+	struct page_info *block = pageblock_of(page);
+	size_t i, end, nfree = (size_t)1 << page->pp_order;
+
+	end = MIN(page_index(block) + PAGEBLOCK_PAGES, npages_init);
+
+	for (i = page_index(block); i < end; ++i) {
+		if (pages[i].pp_free) {
+			nfree += (size_t)1 << pages[i].pp_order;
+			i += ((size_t)1 << pages[i].pp_order) - 1;
+		}
+	}
+
+	if (nfree < PAGEBLOCK_PAGES / 2)
+		return;
+
+	/* Take the free chunks off the lists of the old type, and put them on
+	 * the lists of the new type.
+	 */
+	for (i = page_index(block); i < end; ++i) {
+		if (pages[i].pp_free) {
+			buddy_list_del(pages + i, pages[i].pp_order);
+			i += ((size_t)1 << pages[i].pp_order) - 1;
+		}
+	}
+
+	pageblock_set_migrate(block, migrate);
+
+	for (i = page_index(block); i < end; ++i) {
+		if (pages[i].pp_free) {
+			buddy_list_add(pages + i, pages[i].pp_order);
+			i += ((size_t)1 << pages[i].pp_order) - 1;
+		}
+	}
+}
+
+/* Takes a free chunk of at least order req_order from another migrate type, as
+ * the given type ran out. A whole free pageblock is claimed if there is one,
+ * as the rest of the pageblock then serves the type for future allocations.
+ * Otherwise, the largest free chunk is taken, such that there are less
+ * pageblocks of mixed types.
+ *
+ * Returns the chunk, which may be larger than requested, or NULL if there are
+ * no free chunks large enough at all.
+ */
+static struct page_info *buddy_zone_steal(struct buddy_zone *zone,
+	size_t req_order, unsigned migrate)
+{
+	struct page_info *page;
+	uint32_t mask;
+	size_t i, order;
+	unsigned from;
+
+	for (i = 0; i < MIGRATE_TYPES - 1; ++i) {
+		from = migrate_fallback[migrate][i];
+		order = MAX(req_order, PAGEBLOCK_ORDER);
+		mask = zone->free_mask[from] & ~((UINT32_C(1) << order) - 1);
+
+		if (!mask)
+			continue;
+
+		/* The allocation ends up in the first pageblock of the chunk.
+		 * The chunk is off the lists, so the type can be changed.
+		 */
+		page = buddy_zone_take(zone, from, bsf(mask));
+		pageblock_set_migrate(page, migrate);
+
+		return page;
+	}
+
+	for (i = 0; i < MIGRATE_TYPES - 1; ++i) {
+		from = migrate_fallback[migrate][i];
+		mask = zone->free_mask[from] &
+			~((UINT32_C(1) << req_order) - 1);
+
+		if (!mask)
+			continue;
+
+		page = buddy_zone_take(zone, from, bsr(mask));
+		buddy_claim_pageblock(page, migrate);
+
+		return page;
+	}
+
+	return NULL;
+}
+
+/* Takes all free chunks in the pageblock off the free lists, such that nothing
+ * is allocated from the pageblock while its pages are moved elsewhere. The
+ * chunks keep their order, but are no longer marked as free and are marked as
+ * isolated instead, and have to be handed back with buddy_merge().
+ *
+ * The pageblock is checked again with the lock of the zone held, as other CPUs
+ * may have allocated from it since it was found suitable for compaction. Every
+ * chunk has to be either free or movable and unpinned, and on the node of the
+ * pageblock, as the lock only covers the chunks of its own zone.
+ *
+ * Returns 0 on success and -1 if the pageblock cannot be compacted, in which
+ * case nothing is taken.
+ */
+int buddy_isolate_pageblock(struct page_info *block)
+{
+	struct buddy_zone *zone = buddy_zones + block->pp_node;
+	struct page_info *page;
+	size_t i, end;
+
+	end = MIN(page_index(block) + PAGEBLOCK_PAGES, npages_init);
+	spin_lock(&zone->lock);
+
+	for (i = page_index(block); i < end;
+	     i += (size_t)1 << pages[i].pp_order) {
+		page = pages + i;
+
+		if (page->pp_node != block->pp_node ||
+		    (!page->pp_free &&
+		     (!page->pp_movable || page->pp_ref != 0))) {
+			spin_unlock(&zone->lock);
+			return -1;
+		}
+	}
+
+	for (i = page_index(block); i < end;
+	     i += (size_t)1 << pages[i].pp_order) {
+		if (!pages[i].pp_free)
+			continue;
+
+		buddy_list_del(pages + i, pages[i].pp_order);
+		pages[i].pp_free = 0;
+		pages[i].pp_isolated = 1;
+	}
+
+	spin_unlock(&zone->lock);
+
+	return 0;
 }
 
 /* Given the order req_order, attempts to find a page of that order or a larger
- * order in the free list. In case the order of the free page is larger than the
- * requested order, the page is split down to the requested order using
- * buddy_split().
+ * order in the free lists of the zone for the migrate type, claiming memory of
+ * other types if it runs out. In case the order of the free page is larger
+ * than the requested order, the page is split down to the requested order
+ * using buddy_split().
+ *
+ * The smallest order with a free page is found in a single step by scanning
+ * the free mask of the zone for the lowest set bit at or above req_order. The
+ * masks are checked once without the lock, such that CPUs do not queue up on
+ * the lock of a zone that has nothing to offer.
+ *
+ * Returns a page of the requested order or NULL if no such page can be found.
+ */
+static struct page_info *buddy_zone_find(struct buddy_zone *zone,
+	size_t req_order, unsigned migrate)
+{
+	struct page_info *page;
+	uint32_t mask = 0, order_mask = ~((UINT32_C(1) << req_order) - 1);
+	size_t i;
+
+	for (i = 0; i < MIGRATE_TYPES; ++i)
+		mask |= *(volatile uint32_t *)(zone->free_mask + i);
+
+	if (!(mask & order_mask))
+		return NULL;
+
+	spin_lock(&zone->lock);
+	mask = zone->free_mask[migrate] & order_mask;
+
+	if (mask)
+		page = buddy_zone_take(zone, migrate, bsf(mask));
+	else
+		page = buddy_zone_steal(zone, req_order, migrate);
+
+	if (!page) {
+		spin_unlock(&zone->lock);
+		return NULL;
+	}
+
+	if (page->pp_order > req_order)
+		page = buddy_split(page, req_order);
+
+	/* Allocations of whole pageblocks determine the type of all of them. */
+	for (i = 0; req_order >= PAGEBLOCK_ORDER &&
+	     i < ((size_t)1 << req_order); i += PAGEBLOCK_PAGES)
+		pageblock_set_migrate(page + i, migrate);
+
+	spin_unlock(&zone->lock);
+
+	return page;
+}
+
+/* Attempts to find a page of order req_order and the given migrate type on the
+ * given node, falling back to the other nodes in order of distance.
+ *
+ * Returns a page of the requested order or NULL if no such page can be found.
+ */
+struct page_info *buddy_find_node(unsigned node, size_t req_order,
+	unsigned migrate)
+{
+	struct page_info *page = NULL;
+	uint64_t start = mem_trace_begin();
+	size_t i;
+
+	if (req_order >= BUDDY_MAX_ORDER || node >= nnodes ||
+	    migrate >= MIGRATE_TYPES)
+		return NULL;
+
+	for (i = 0; i < nnodes && !page; ++i)
+		page = buddy_zone_find(buddy_zones + numa_fallback[node][i],
+			req_order, migrate);
+
+	mem_trace_latency(MEM_TRACE_FIND, req_order, start);
+
+	return page;
+}
+
+/* Attempts to find a page of order req_order and the given migrate type,
+ * preferring the node of the CPU we are running on.
+ *
+ * Returns a page of the requested order or NULL if no such page can be found.
+ */
+struct page_info *buddy_find_type(size_t req_order, unsigned migrate)
+{
+	return buddy_find_node(numa_local_node(), req_order, migrate);
+}
+
+/* Attempts to find an unmovable page of order req_order, preferring the node
+ * of the CPU we are running on.
  *
  * Returns a page of the requested order or NULL if no such page can be found.
  */
 struct page_info *buddy_find(size_t req_order)
 {
 	/* LAB 1: your code here. */
-	struct list *node;
+	return buddy_find_type(req_order, MIGRATE_UNMOVABLE);
+}
+
+/*
+ * Allocates a physically contiguous chunk of 2^order pages, aligned to its
+ * size.
+ *
+ * if (alloc_flags & ALLOC_ZERO), fills the entire returned chunk with '\0'
+ * bytes.
+ *
+ * Beware: this function does NOT increment the reference count of the page -
+ * this is the caller's responsibility.
+ *
+ * Returns NULL if out of free memory or if there is no chunk of that order.
+ *
+ * Order 0 pages are taken from the per-CPU page cache. If the buddy allocator
+ * runs out of memory, the per-CPU page caches and the pools of zeroed pages and
+ * of page-table pages are drained and the allocation is retried. Requests for
+ * huge pages then fall back to compaction.
+ *
+ * Requests for zeroed pages are served from the pools of zeroed pages first,
+ * such that the page only has to be cleared if the pool is empty.
+ *
+ * If (alloc_flags & ALLOC_MOVABLE) or (alloc_flags & ALLOC_RECLAIMABLE), the
+ * page is taken from a pageblock of that type. The per-CPU page caches and
+ * the pools of zeroed pages only hold unmovable pages.
+ */
+struct page_info *page_alloc_order(size_t order, int alloc_flags)
+{
 	struct page_info *page;
-	for (size_t order = req_order; order <= BUDDY_MAX_ORDER; order++) {
-
-        if (!list_is_empty(&buddy_free_list[order])) {
-			node = list_pop(&buddy_free_list[order]);
-			page = container_of(node, struct page_info, pp_node);
-            if (order > req_order) {
-                page = buddy_split(page, req_order);  
-            }
-            //page->pp_free = 0;  
-            return page;
-        }
-    }
-
-    //fail to find page block with required order
-	return NULL;
+	unsigned migrate = alloc_migrate_type(alloc_flags);
+	uint64_t start = mem_trace_begin();
+
+	if (order >= BUDDY_MAX_ORDER)
+		return NULL;
+
+	if ((alloc_flags & ALLOC_ZERO) && migrate == MIGRATE_UNMOVABLE) {
+		page = zero_pool_alloc(order);
+
+		if (page) {
+			mem_trace_latency(MEM_TRACE_ALLOC, order, start);
+			return page;
+		}
+	}
+
+	if (order == BUDDY_4K_PAGE && migrate == MIGRATE_UNMOVABLE)
+		page = page_cache_alloc();
+	else
+		page = buddy_find_type(order, migrate);
+
+	if (!page && page_cache_drain_all() + zero_pool_drain() +
+	    pt_pool_drain())
+		page = buddy_find_type(order, migrate);
+
+	while (!page && page_init_deferred())
+		page = buddy_find_type(order, migrate);
+
+	/* Huge pages may still be recovered by moving pages out of the way. */
+	if (!page && order >= PAGEBLOCK_ORDER && compact_memory(order))
+		page = buddy_find_type(order, migrate);
+
+	if(page == NULL){
+		mem_trace_failed(order);
+		return NULL;
+	}
+
+	if(alloc_flags & ALLOC_ZERO){
+		memset(page2kva(page), 0, (PAGE_SIZE << (page -> pp_order)));
+	}
+
+	mem_trace_latency(MEM_TRACE_ALLOC, order, start);
+	return page;
 }
 
 /*
@@ -200,6 +665,7 @@ struct page_info *buddy_find(size_t req_order)
  * if (alloc_flags & ALLOC_ZERO), fills the entire returned physical page with
  * '\0' bytes.
  * if (alloc_flags & ALLOC_HUGE), returns a huge physical 2M page.
+ * if (alloc_flags & ALLOC_1G), returns a huge physical 1G page.
  *
  * Beware: this function does NOT increment the reference count of the page -
  * this is the caller's responsibility.
@@ -213,34 +679,210 @@ struct page_info *page_alloc(int alloc_flags)
 {
 	/* LAB 1: your code here. */
 	size_t order;
-	if(alloc_flags & ALLOC_HUGE){
+	if(alloc_flags & ALLOC_1G){
+		order = BUDDY_1G_PAGE;
+	} else if(alloc_flags & ALLOC_HUGE){
 		order = BUDDY_2M_PAGE;
 	} else {
 		order = BUDDY_4K_PAGE;
 	}
 
-	struct page_info *page = buddy_find(order);
-	if(page == NULL){
-		return NULL;
-	}
-
-	if(alloc_flags & ALLOC_ZERO){
-		memset(page2kva(page), 0, (PAGE_SIZE << (page -> pp_order)));
-	}
-	return page;
+	return page_alloc_order(order, alloc_flags);
 }
 
 /*
  * Return a page to the free list.
  * (This function should only be called when pp->pp_ref reaches 0.)
  *
+ * Unmovable order 0 pages are returned to the per-CPU page cache instead.
+ *
  * Hint: mark the page as free and use buddy_merge() to merge the free page
  * with its buddies before returning the page to the free list.
  */
 void page_free(struct page_info *pp)
 {
 	/* LAB 1: your code here. */
-	buddy_merge(pp);
+	size_t order = pp->pp_order;
+	uint64_t start = mem_trace_begin();
+
+	if (order == BUDDY_4K_PAGE &&
+	    page_migrate_type(pp) == MIGRATE_UNMOVABLE)
+		page_cache_free(pp);
+	else
+		buddy_merge(pp);
+
+	mem_trace_latency(MEM_TRACE_FREE, order, start);
+}
+
+/* Takes a chunk of at most 2^max_order pages of pieces of the given order and
+ * migrate type from the buddy allocator, preferring the largest chunk that
+ * does not exceed it. Nodes are tried in order of distance from the local
+ * node.
+ *
+ * Returns NULL if there is no chunk of at least the given order.
+ */
+static struct page_info *buddy_find_upto(size_t order, size_t max_order,
+	unsigned migrate)
+{
+	struct buddy_zone *zone;
+	struct page_info *page;
+	unsigned local = numa_local_node();
+	uint32_t mask;
+	size_t i, req_order;
+
+	for (i = 0; i < nnodes; ++i) {
+		/* Use the largest free chunk that fits, or split a larger one
+		 * if there are none. The mask is only a hint, buddy_zone_find()
+		 * checks again with the lock held.
+		 */
+		zone = buddy_zones + numa_fallback[local][i];
+		mask = *(volatile uint32_t *)(zone->free_mask + migrate) &
+			~((UINT32_C(1) << order) - 1) &
+			((UINT32_C(2) << max_order) - 1);
+		req_order = mask ? bsr(mask) : max_order;
+
+		page = buddy_zone_find(zone, req_order, migrate);
+
+		if (!page && req_order > order)
+			page = buddy_zone_find(zone, order, migrate);
+
+		if (page)
+			return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Allocates n physical pages of the given order and stores them in pp. If
+ * (alloc_flags & ALLOC_ZERO), the pages are filled with '\0' bytes.
+ *
+ * Rather than looking up every single page, chunks that hold as many of the
+ * requested pages as possible are taken from the buddy allocator at once and
+ * carved into pages of the requested order.
+ *
+ * Beware: this function does NOT increment the reference count of the pages.
+ *
+ * Returns the number of pages allocated, which is less than n if the allocator
+ * ran out of memory.
+ */
+size_t page_alloc_bulk(struct page_info **pp, size_t n, size_t order,
+	int alloc_flags)
+{
+	struct page_info *page;
+	size_t i, max_order, count, nalloc = 0;
+	unsigned migrate = alloc_migrate_type(alloc_flags);
+	int drained = 0;
+
+	if (order >= BUDDY_MAX_ORDER)
+		return 0;
+
+	while (nalloc < n) {
+		/* The largest chunk that does not hold more pages than needed. */
+		for (max_order = order; max_order + 1 < BUDDY_MAX_ORDER &&
+		     ((size_t)2 << (max_order - order)) <= n - nalloc; ++max_order);
+
+		page = buddy_find_upto(order, max_order, migrate);
+
+		if (!page) {
+			if (drained || !(page_cache_drain_all() +
+			    zero_pool_drain() + pt_pool_drain()))
+				break;
+
+			drained = 1;
+			continue;
+		}
+
+		count = (size_t)1 << (page->pp_order - order);
+
+		if (alloc_flags & ALLOC_ZERO)
+			memset(page2kva(page), 0, PAGE_SIZE << page->pp_order);
+
+		for (i = 0; i < count; ++i, page += (size_t)1 << order) {
+			page->pp_order = order;
+			page->pp_free = 0;
+			pp[nalloc++] = page;
+		}
+	}
+
+	return nalloc;
+}
+
+/* Sorts the pages by physical address. */
+static void page_sort(struct page_info **pp, size_t n)
+{
+	struct page_info *page;
+	size_t gap, i, j;
+
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < n; ++i) {
+			page = pp[i];
+
+			for (j = i; j >= gap && pp[j - gap] > page; j -= gap)
+				pp[j] = pp[j - gap];
+
+			pp[j] = page;
+		}
+	}
+}
+
+/* Returns whether lhs and rhs are in-use buddies of the same order on the
+ * same node, with lhs being the lower half. Like buddy_merge(), chunks are not
+ * combined across nodes, as the combined chunk would end up in one zone.
+ */
+static int page_is_lower_buddy(struct page_info *lhs, struct page_info *rhs)
+{
+	size_t order = lhs->pp_order;
+
+	return order + 1 < BUDDY_MAX_ORDER && rhs->pp_order == order &&
+		lhs->pp_node == rhs->pp_node &&
+		lhs + ((size_t)1 << order) == rhs &&
+		!(page_index(lhs) & (((size_t)2 << order) - 1));
+}
+
+/*
+ * Returns the n pages in pp to the free lists. The pages are sorted by address
+ * first, such that runs of buddies can be combined into larger chunks before
+ * they are merged with the free chunks in the buddy allocator. Note that this
+ * reorders the array.
+ * (This function should only be called when the pp_ref of all pages is 0.)
+ */
+void page_free_bulk(struct page_info **pp, size_t n)
+{
+	struct page_info *page;
+	size_t i, top = 0;
+
+	page_sort(pp, n);
+
+	/* Use the start of the array as a stack of combined chunks: only the top
+	 * chunk can be combined with the next page, as the pages are sorted. */
+	for (i = 0; i < n; ++i) {
+		page = pp[i];
+
+		while (top > 0 && page_is_lower_buddy(pp[top - 1], page)) {
+			page->pp_order = pp[top - 1]->pp_order + 1;
+			page = pp[--top];
+			page->pp_order++;
+		}
+
+		pp[top++] = page;
+	}
+
+	for (i = 0; i < top; ++i)
+		buddy_merge(pp[i]);
+}
+
+/* Drops a reference to the page. The CPU that drops the last reference frees
+ * the page, which is deferred until the CPU has a batch of pages to free.
+ */
+void page_put(struct page_info *pp)
+{
+	uint32_t ref = xadd(&pp->pp_ref, (uint32_t)-1);
+
+	assert(ref > 0);
+
+	if (ref == 1)
+		page_cache_defer(pp);
 }
 
 /*
@@ -249,8 +891,6 @@ void page_free(struct page_info *pp)
  */
 void page_decref(struct page_info *pp)
 {
-	if (--pp->pp_ref == 0) {
-		page_free(pp);
-	}
+	page_put(pp);
 }
 
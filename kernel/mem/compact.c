@@ -0,0 +1,353 @@
+#include <types.h>
+#include <assert.h>
+#include <hash.h>
+#include <paging.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/mem.h>
+
+/* The number of buckets the table of movable pages starts out with. */
+#define MOVABLE_NBUCKETS 64
+
+/* The movable pages by page index, and the cache their entries come from. */
+static struct hash_table movable_pages;
+static struct kmem_cache *movable_cache;
+static struct spinlock movable_lock = SPINLOCK_INIT;
+
+/* Only one CPU compacts memory at a time. */
+static struct spinlock compact_lock = SPINLOCK_INIT;
+
+static int movable_match(const void *key, struct hash_node *node)
+{
+	return hash_entry(node, struct movable_page, node)->page == key;
+}
+
+/* Looks up the entry of the movable page. The caller must hold movable_lock.
+ */
+static struct movable_page *movable_find(struct page_info *page)
+{
+	return hash_entry(hash_find(&movable_pages, hash64(page_index(page)),
+		page, movable_match), struct movable_page, node);
+}
+
+/* Doubles the number of buckets once the table is too full. If that fails, the
+ * table keeps working with longer chains. The caller must not hold
+ * movable_lock, as kmalloc() may compact memory to get the new buckets.
+ */
+static void movable_grow(void)
+{
+	struct hash_node **buckets, **old;
+	size_t nbuckets;
+
+	spin_lock(&movable_lock);
+	nbuckets = movable_pages.nbuckets * 2;
+
+	if (!hash_needs_resize(&movable_pages)) {
+		spin_unlock(&movable_lock);
+		return;
+	}
+
+	spin_unlock(&movable_lock);
+
+	buckets = kmalloc(nbuckets * sizeof *buckets, 0);
+
+	if (!buckets)
+		return;
+
+	/* Another CPU may have grown the table meanwhile. */
+	spin_lock(&movable_lock);
+
+	if (movable_pages.nbuckets * 2 == nbuckets &&
+	    hash_needs_resize(&movable_pages))
+		old = hash_resize(&movable_pages, buckets, nbuckets);
+	else
+		old = buckets;
+
+	spin_unlock(&movable_lock);
+
+	kfree(old);
+}
+
+/* Sets up the table of movable pages. Call this once kmalloc() works. */
+void compact_init(void)
+{
+	struct hash_node **buckets;
+
+	buckets = kmalloc(MOVABLE_NBUCKETS * sizeof *buckets, 0);
+	movable_cache = kmem_cache_create("movable_page",
+		sizeof(struct movable_page), 0, NULL);
+
+	if (!buckets || !movable_cache)
+		panic("compact_init: out of memory");
+
+	hash_init(&movable_pages, buckets, MOVABLE_NBUCKETS);
+}
+
+/* Allocates a chunk of 2^order pages from a movable pageblock and stores it
+ * in *owner. Compaction may move the chunk elsewhere, in which case *owner is
+ * updated.
+ *
+ * Returns the chunk or NULL if out of memory.
+ */
+struct page_info *page_alloc_movable(size_t order, int alloc_flags,
+	struct page_info **owner)
+{
+	struct movable_page *movable;
+	struct page_info *page;
+
+	movable = kmem_cache_alloc(movable_cache);
+
+	if (!movable)
+		return NULL;
+
+	page = page_alloc_order(order, alloc_flags | ALLOC_MOVABLE);
+
+	if (!page) {
+		kmem_cache_free(movable_cache, movable);
+		return NULL;
+	}
+
+	movable->page = page;
+	movable->owner = owner;
+	*owner = page;
+
+	spin_lock(&movable_lock);
+	page->pp_movable = 1;
+	hash_insert(&movable_pages, &movable->node, hash64(page_index(page)));
+	spin_unlock(&movable_lock);
+
+	movable_grow();
+
+	return page;
+}
+
+/* Frees a chunk allocated with page_alloc_movable(). This waits for
+ * compaction to finish, as the chunk may be part of an isolated pageblock.
+ */
+void page_free_movable(struct page_info *page)
+{
+	struct movable_page *movable;
+
+	spin_lock(&compact_lock);
+	spin_lock(&movable_lock);
+	movable = movable_find(page);
+	assert(movable);
+	hash_remove(&movable_pages, &movable->node);
+	page->pp_movable = 0;
+	spin_unlock(&movable_lock);
+
+	page_free(page);
+	spin_unlock(&compact_lock);
+
+	kmem_cache_free(movable_cache, movable);
+}
+
+/* Pins the chunk the owner points to, such that compaction leaves it where it
+ * is until it is unpinned again. The owner must only access the chunk while
+ * it is pinned, as compaction may be copying it otherwise.
+ *
+ * Returns the chunk.
+ */
+struct page_info *page_pin_movable(struct page_info **owner)
+{
+	struct page_info *page;
+
+	/* Compaction holds movable_lock while moving a chunk, so the reference
+	 * is taken either before it checks the chunk or after it moved it.
+	 */
+	spin_lock(&movable_lock);
+	page = *owner;
+	page_get(page);
+	spin_unlock(&movable_lock);
+
+	return page;
+}
+
+/* Unpins a chunk pinned with page_pin_movable(). */
+void page_unpin_movable(struct page_info *page)
+{
+	uint32_t ref = xadd(&page->pp_ref, (uint32_t)-1);
+
+	assert(ref > 0);
+}
+
+/* Returns the number of chunks allocated with page_alloc_movable(). */
+size_t count_movable_pages(void)
+{
+	return movable_pages.count;
+}
+
+/* Scans the pageblock for pages that are in use. The pageblock can be
+ * compacted if all of them are movable and if enough of the pageblock is free.
+ * This is only a hint, as the zone lock is not held, and the pageblock is
+ * checked again by buddy_isolate_pageblock().
+ */
+static int compact_suitable(struct page_info *block)
+{
+	struct page_info *page;
+	size_t i, end, nfree = 0, nmovable = 0;
+
+	end = MIN(page_index(block) + PAGEBLOCK_PAGES, npages_init);
+
+	/* Nothing to do if the pageblock is free already. */
+	if (end - page_index(block) < PAGEBLOCK_PAGES ||
+	    (block->pp_free && block->pp_order >= PAGEBLOCK_ORDER))
+		return 0;
+
+	for (i = page_index(block); i < end;
+	     i += (size_t)1 << page->pp_order) {
+		page = pages + i;
+
+		if (page->pp_free)
+			nfree += (size_t)1 << page->pp_order;
+		else if (page->pp_movable && page->pp_ref == 0)
+			++nmovable;
+		else
+			return 0;
+	}
+
+	return nmovable > 0 && nfree >= COMPACT_MIN_FREE;
+}
+
+/* Moves the movable page to a new chunk outside of the pageblock being
+ * compacted, which has been isolated, and points its owner at the new chunk.
+ * The page is copied with movable_lock held, such that the owner cannot pin it
+ * meanwhile.
+ *
+ * Returns 0 on success and -1 if out of memory or if the page is pinned.
+ */
+static int compact_move(struct page_info *page)
+{
+	struct movable_page *movable;
+	struct page_info *new;
+
+	new = buddy_find_node(page->pp_node, page->pp_order, MIGRATE_MOVABLE);
+
+	if (!new)
+		return -1;
+
+	spin_lock(&movable_lock);
+
+	if (page->pp_ref) {
+		spin_unlock(&movable_lock);
+		page_free(new);
+		return -1;
+	}
+
+	memcpy(page2kva(new), page2kva(page), PAGE_SIZE << page->pp_order);
+	movable = movable_find(page);
+	assert(movable);
+	hash_remove(&movable_pages, &movable->node);
+
+	movable->page = new;
+	*movable->owner = new;
+	new->pp_movable = 1;
+	new->pp_zero = 0;
+	page->pp_movable = 0;
+	hash_insert(&movable_pages, &movable->node, hash64(page_index(new)));
+	spin_unlock(&movable_lock);
+
+	return 0;
+}
+
+/* Moves the movable pages out of the pageblock and hands the pageblock back to
+ * the buddy allocator as a whole, such that it merges into a huge page. If the
+ * pages cannot all be moved, the free parts of the pageblock are handed back
+ * instead.
+ *
+ * Returns 1 if the pageblock was freed up and 0 otherwise.
+ */
+static int compact_pageblock(struct page_info *block)
+{
+	struct page_info *page;
+	size_t i, n, end;
+	int ret = 1;
+
+	end = page_index(block) + PAGEBLOCK_PAGES;
+
+	if (buddy_isolate_pageblock(block) < 0)
+		return 0;
+
+	for (i = page_index(block); i < end; i += n) {
+		page = pages + i;
+		n = (size_t)1 << page->pp_order;
+
+		if (page->pp_isolated)
+			continue;
+
+		/* Anything else in use would be handed out twice. */
+		if (!page->pp_movable || compact_move(page) < 0) {
+			ret = 0;
+			break;
+		}
+
+		/* The old chunk is ours now, just like the free ones. */
+		page->pp_isolated = 1;
+	}
+
+	if (ret) {
+		for (i = page_index(block); i < end; ++i)
+			pages[i].pp_isolated = 0;
+
+		block->pp_order = PAGEBLOCK_ORDER;
+		buddy_merge(block);
+		return 1;
+	}
+
+	/* Hand back the isolated chunks, including the ones whose pages got
+	 * moved already, but not the pages that are still in use.
+	 */
+	for (i = page_index(block); i < end; i += n) {
+		page = pages + i;
+		n = (size_t)1 << page->pp_order;
+
+		if (page->pp_isolated) {
+			page->pp_isolated = 0;
+			buddy_merge(page);
+		}
+	}
+
+	return 0;
+}
+
+/* Returns whether there is a free chunk of at least the given order. */
+static int compact_done(size_t order)
+{
+	size_t i;
+
+	for (i = order; i < BUDDY_MAX_ORDER; ++i) {
+		if (count_free_pages(i))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Recovers huge pages by moving the pages in use out of pageblocks that are
+ * mostly free, until there is a free chunk of at least the given order. Pass
+ * BUDDY_MAX_ORDER to compact as much memory as possible. Only pageblocks that
+ * contain nothing but free and movable pages are considered.
+ *
+ * Returns the number of pageblocks freed up.
+ */
+size_t compact_memory(size_t order)
+{
+	size_t i, n = 0;
+
+	if (!movable_cache || !spin_trylock(&compact_lock))
+		return 0;
+
+	page_cache_drain_all();
+
+	for (i = 0; i + PAGEBLOCK_PAGES <= npages_init &&
+	     !compact_done(order); i += PAGEBLOCK_PAGES) {
+		if (compact_suitable(pages + i))
+			n += compact_pageblock(pages + i);
+	}
+
+	spin_unlock(&compact_lock);
+
+	return n;
+}
@@ -0,0 +1,139 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
+
+/* Serializes sharing pages with resolving faults on them. Otherwise two CPUs
+ * faulting on the same page could both copy it, or a fault could see a single
+ * reference and make a page writable that is about to be shared. There is no
+ * structure for an address space to keep it in, so one lock covers them all.
+ */
+static struct spinlock cow_lock = SPINLOCK_INIT;
+
+/* The flags of a mapping, without the ones the CPU keeps track of. */
+static inline uint64_t cow_flags(physaddr_t entry)
+{
+	return entry & PAGE_MASK & ~(PAGE_PRESENT | PAGE_ACCESSED | PAGE_DIRTY);
+}
+
+/* Takes cow_lock, serving TLB shootdowns while waiting. Faults run with
+ * interrupts disabled, and the CPU holding the lock may be waiting for us to
+ * flush our TLB.
+ */
+static void cow_lock_poll(void)
+{
+	while (!spin_trylock(&cow_lock)) {
+		tlb_poll(this_cpu_id());
+		pause();
+	}
+}
+
+/* Shares the pages mapped with page_insert() in len bytes starting at va of
+ * src with dst, at the same addresses. Writable pages become read-only and
+ * copy-on-write in both, such that either side gets its own copy once it
+ * writes to the page. The TLBs of src are flushed once for the entire range.
+ *
+ * Returns -1 if out of memory, in which case part of the range may have been
+ * shared.
+ */
+int cow_share(struct page_table *dst, struct page_table *src, uintptr_t va,
+	size_t len)
+{
+	struct tlb_batch batch;
+	struct page_info *page;
+	physaddr_t *entry;
+	uintptr_t end = va + len;
+	int ret = 0;
+
+	assert(page_aligned(va) && page_aligned(len));
+	cow_lock_poll();
+	tlb_batch_init(&batch, src);
+
+	for (; va < end; va += PAGE_SIZE) {
+		page = page_lookup(src, va, &entry);
+
+		if (!page)
+			continue;
+
+		if (*entry & PAGE_WRITE) {
+			*entry = (*entry & ~PAGE_WRITE) | PAGE_COW;
+			tlb_batch_add(&batch, va);
+		}
+
+		if (page_insert(dst, page, va, cow_flags(*entry)) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	tlb_batch_flush(&batch);
+	spin_unlock(&cow_lock);
+
+	return ret;
+}
+
+/* Resolves a write fault at va in the page tables of pml4. If the page is not
+ * shared anymore, it is simply made writable again. Otherwise the mapping gets
+ * replaced by a copy of the page.
+ *
+ * Returns -1 if va is not mapped copy-on-write or if out of memory.
+ */
+int cow_fault(struct page_table *pml4, uintptr_t va)
+{
+	struct page_info *page, *copy;
+	physaddr_t *entry;
+	uint64_t flags;
+	int ret = -1;
+
+	va = ROUNDDOWN(va, PAGE_SIZE);
+	cow_lock_poll();
+	page = page_lookup(pml4, va, &entry);
+
+	if (!page)
+		goto out;
+
+	/* Another CPU may have resolved the fault meanwhile. */
+	if (*entry & PAGE_WRITE) {
+		ret = 0;
+		goto out;
+	}
+
+	if (!(*entry & PAGE_COW))
+		goto out;
+
+	flags = (cow_flags(*entry) & ~PAGE_COW) | PAGE_WRITE;
+
+	/* Making the page writable needs no flush: the fault already dropped
+	 * the translation on this CPU, and other CPUs fault at worst.
+	 */
+	if (page->pp_ref == 1) {
+		*entry = page2pa(page) | flags | PAGE_PRESENT;
+		ret = 0;
+		goto out;
+	}
+
+	copy = page_alloc_order(BUDDY_4K_PAGE, 0);
+
+	if (!copy)
+		goto out;
+
+	memcpy(page2kva(copy), page2kva(page), PAGE_SIZE);
+
+	/* This drops the reference to the shared page. */
+	if (page_insert(pml4, copy, va, flags) < 0) {
+		page_free(copy);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	spin_unlock(&cow_lock);
+
+	return ret;
+}
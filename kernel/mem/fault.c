@@ -0,0 +1,34 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+
+#include <x86-64/asm.h>
+#include <x86-64/idt.h>
+
+#include <kernel/intr.h>
+#include <kernel/mem.h>
+
+/* Resolves write faults on lazy and copy-on-write pages of the page tables in
+ * use, and panics on any other fault.
+ */
+static void page_fault(struct int_frame *frame)
+{
+	uintptr_t va = read_cr2();
+	struct page_table *pml4;
+
+	pml4 = (struct page_table *)(KERNEL_VMA + PAGE_ADDR(read_cr3()));
+
+	if ((frame->err_code & (PF_PRESENT | PF_WRITE)) ==
+	    (PF_PRESENT | PF_WRITE) &&
+	    (lazy_fault(pml4, va) == 0 || cow_fault(pml4, va) == 0))
+		return;
+
+	panic("page fault at %p accessing %p, error code %p", frame->rip, va,
+		frame->err_code);
+}
+
+/* Installs the page fault handler. */
+void fault_init(void)
+{
+	intr_register(INT_PAGE_FAULT, page_fault);
+}
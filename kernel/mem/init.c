@@ -1,15 +1,15 @@
 #include <types.h>
 #include <boot.h>
-#include <list.h>
 #include <paging.h>
+#include <string.h>
 
 #include <x86-64/asm.h>
 
+#include <kernel/kwork.h>
 #include <kernel/mem.h>
+#include <kernel/smp.h>
 #include <kernel/tests.h>
 
-extern struct list buddy_free_list[];
-
 /*
  * Set up a four-level page table:
  * kernel_pml4 is its linear (virtual) address of the root
@@ -23,33 +23,36 @@ extern struct list buddy_free_list[];
  */
 void mem_init(struct boot_info *boot_info)
 {
-	struct mmap_entry *entry;
 	uintptr_t highest_addr = 0;
 	uint32_t cr0;
 	size_t i, n;
 
-	/* Align the areas in the memory map. */
+	/* Align the areas in the memory map, and turn it into a sorted list of
+	 * free regions.
+	 */
 	align_boot_info(boot_info);
+	boot_regions_init(boot_info);
 
-	/* Set up the buddy free lists. */
-	for (i = 0; i < BUDDY_MAX_ORDER; ++i) {
-		list_init(buddy_free_list + i);
-	};
-
-	/* Find the amount of pages to allocate structs for. */
-	entry = (struct mmap_entry *)((physaddr_t)boot_info->mmap_addr);
+	/* Set up the buddy free lists of every zone. */
+	buddy_init();
 
-	for (i = 0; i < boot_info->mmap_len; ++i, ++entry) {
-		if (entry->type != MMAP_FREE)
-			continue;
+	/* Set up the per-CPU page caches and the pools of zeroed pages and of
+	 * page-table pages.
+	 */
+	page_cache_init();
+	zero_pool_init();
+	pt_pool_init();
 
-		highest_addr = entry->addr + entry->len;
-	}
+	/* Find the amount of pages to allocate structs for. */
+	if (boot_nregions)
+		highest_addr = boot_regions[boot_nregions - 1].end;
 
-	/* Limit the struct page_info array to the first 8 MiB, as the rest is
-	 * still not accessible until lab 2.
+	/* Map all of physical memory with huge pages, and limit the struct
+	 * page_info array to what got mapped, as anything beyond it is not
+	 * accessible.
 	 */
-	npages = MIN(BOOT_MAP_LIM, highest_addr) / PAGE_SIZE;
+	direct_map_init(highest_addr);
+	npages = MIN(boot_map_lim, highest_addr) / PAGE_SIZE;
 
 	/* Remove this line when you're ready to test this function. */
 	//panic("mem_init: This function is not finished\n");
@@ -61,6 +64,14 @@ void mem_init(struct boot_info *boot_info)
 	 * 'npages' is the number of physical pages in memory.  Your code goes here.
 	 */
 	pages = boot_alloc(npages * sizeof *pages);
+	pageblock_types = boot_alloc(ROUNDUP(npages, PAGEBLOCK_PAGES) /
+		PAGEBLOCK_PAGES);
+
+	/* Start the other CPUs, such that they can help out setting up the
+	 * pages, and find out which memory and CPUs belong to which node.
+	 */
+	smp_init();
+	numa_init();
 
 	/*
 	 * Now that we've allocated the initial kernel data structures, we set
@@ -70,75 +81,231 @@ void mem_init(struct boot_info *boot_info)
 	 */
 	page_init(boot_info);
 
+	/* Set up the slab allocator on top of the buddy allocator, and the
+	 * general purpose allocator on top of that.
+	 */
+	kmem_init();
+	kmalloc_init();
+	compact_init();
+
+	/* Resolve copy-on-write and demand paging faults from now on. */
+	fault_init();
+
 	/* Perform the tests of lab 1. */
 	lab1_check_mem(boot_info);
 
 	/* We will set up page tables here in lab 2. */
 }
 
-/*
- * Initialize page structure and memory free list. After this is done, NEVER
- * use boot_alloc() again. After this function has been called to set up the
- * memory allocator, ONLY the buddy allocator should be used to allocate and
- * free physical memory.
+/* The struct page_info structs are initialized one section at a time. A
+ * section spans a chunk of the maximum order, such that buddies never cross
+ * into a section that has not been initialized yet.
  */
-void page_init(struct boot_info *boot_info)
+#define PAGE_SECTION_PAGES ((size_t)1 << (BUDDY_MAX_ORDER - 1))
+
+/* The number of order 0 pages worth of memory the background work clears at a
+ * time, such that other work gets to run in between.
+ */
+#define MEM_IDLE_BUDGET 64
+
+struct page_range {
+	physaddr_t start, end;
+};
+
+/* One slice of a section of struct page_info structs, for every CPU. Any CPU
+ * may pick up any slice, as they are handed out through kwork.
+ */
+struct page_init_work {
+	struct kwork work;
+	struct page_range *range;
+	unsigned slice;
+};
+
+/* The first free region that has not been handed to the buddy allocator in
+ * full yet. As the sections get set up in order, the regions are too.
+ */
+static size_t page_region;
+
+/* Set while a CPU initializes a section, and the CPU that does, or NCPUS. */
+static volatile uint32_t page_init_busy;
+static volatile unsigned page_init_cpu = NCPUS;
+
+/* Goes through the slice of the range of struct page_info structs and:
+ *  1) calls page_node_init() to initialize the linked list node.
+ *  2) sets the reference count pp_ref to zero.
+ *  3) marks the page as in use by setting pp_free to zero.
+ *  4) sets the order pp_order to zero.
+ *  5) sets pp_node to the NUMA node the page belongs to.
+ */
+static void page_init_slice(void *arg)
 {
+	struct page_init_work *work = arg;
+	struct page_range *range = work->range;
 	struct page_info *page;
-	struct mmap_entry *entry;
-	uintptr_t pa, end;
-	size_t i;
+	physaddr_t node_end;
+	size_t i, start, stop, n;
+	unsigned node = 0;
+
+	start = PAGE_INDEX(range->start);
+	n = PAGE_INDEX(range->end) - start;
+	stop = start + n * (work->slice + 1) / ncpus;
+	start += n * work->slice / ncpus;
+	node_end = 0;
+
+	for (i = start; i < stop; ++i) {
+		if (i * PAGE_SIZE >= node_end)
+			node = numa_lookup(i * PAGE_SIZE, &node_end);
 
-	/* Go through the array of struct page_info structs and:
-	 *  1) call list_init() to initialize the linked list node.
-	 *  2) set the reference count pp_ref to zero.
-	 *  3) mark the page as in use by setting pp_free to zero.
-	 *  4) set the order pp_order to zero.
-	 */
-	for (i = 0; i < npages; ++i) {
-		/* LAB 1: your code here. */
 		page = pages + i;
-		list_init(&page->pp_node);
+		page_node_init(page);
 		page->pp_ref = 0;
 		page->pp_free = 0;
 		page->pp_order = 0;
-		
+		page->pp_zero = 0;
+		page->pp_slab = 0;
+		page->pp_movable = 0;
+		page->pp_isolated = 0;
+		page->pp_pt = 0;
+		page->pp_nents = 0;
+		page->pp_node = node;
+
+		if (i % PAGEBLOCK_PAGES == 0)
+			pageblock_set_migrate(page, MIGRATE_MOVABLE);
 	}
+}
 
-	entry = (struct mmap_entry *)KADDR(boot_info->mmap_addr);
-	end = PADDR(boot_alloc(0));
+/* Initializes the struct page_info structs of the next section of physical
+ * memory, split up in a slice for every CPU that idle CPUs pick up, and hands
+ * the free pages in the section to the buddy allocator. This is called for the
+ * first section during boot, and afterwards whenever the buddy allocator runs
+ * out of memory or the kernel is idle.
+ *
+ * Returns zero if all pages have been initialized already, or if this CPU is
+ * already initializing a section further up the stack.
+ */
+int page_init_deferred(void)
+{
+	struct page_init_work works[NCPUS];
+	struct boot_region *region;
+	struct page_range range;
+	size_t i;
 
-	/* Go through the entries in the memory map:
-	 *  1) Ignore the entry if the region is not free memory.
-	 *  2) Iterate through the pages in the region.
-	 *  3) If the physical address is above BOOT_MAP_LIM, ignore.
-	 *  4) Hand the page to the buddy allocator by calling page_free() if
-	 *     the page is not reserved.
-	 *
-	 * What memory is reserved?
+	if (npages_init >= npages)
+		return 0;
+
+	/* Only one CPU sets up a section at a time, the others simply retry
+	 * until it is done.
+	 */
+	if (xchg(&page_init_busy, 1))
+		return page_init_cpu != this_cpu_id();
+
+	page_init_cpu = this_cpu_id();
+
+	if (npages_init >= npages) {
+		page_init_cpu = NCPUS;
+		xchg(&page_init_busy, 0);
+		return 0;
+	}
+
+	range.start = npages_init * PAGE_SIZE;
+	range.end = MIN(npages_init + PAGE_SECTION_PAGES, npages) * PAGE_SIZE;
+
+	for (i = 0; i < ncpus; ++i) {
+		kwork_init_item(&works[i].work, page_init_slice, works + i);
+		works[i].range = &range;
+		works[i].slice = i;
+		kwork_submit(&works[i].work);
+	}
+
+	for (i = 0; i < ncpus; ++i)
+		kwork_wait(&works[i].work);
+
+	npages_init = PAGE_INDEX(range.end);
+
+	/* Hand the free regions in the section to the buddy allocator by
+	 * calling buddy_free_range(), which inserts the largest aligned chunks
+	 * directly. Don't use page_free() here, as that would stash the pages
+	 * in the per-CPU page cache. A region that extends past the section is
+	 * picked up again by the next one.
+	 */
+	for (; page_region < boot_nregions; ++page_region) {
+		region = boot_regions + page_region;
+
+		if (region->start >= range.end)
+			break;
+
+		buddy_free_range(MAX(region->start, range.start),
+			MIN(region->end, range.end));
+
+		if (region->end > range.end)
+			break;
+	}
+
+	page_init_cpu = NCPUS;
+	xchg(&page_init_busy, 0);
+
+	return 1;
+}
+
+static void mem_idle_work(void *arg)
+{
+	while (page_init_deferred() || zero_pool_refill(MEM_IDLE_BUDGET))
+		;
+}
+
+static struct kwork mem_idle_kwork = KWORK_INIT(mem_idle_work, NULL);
+
+/* Sets up the remaining sections of memory and refills the pools of zeroed
+ * pages while the kernel is idle. If there are other CPUs, this is left to
+ * them, such that the current CPU can go back to sleep right away. Otherwise,
+ * a single step is taken at a time to keep the caller responsive.
+ *
+ * Returns zero if there is nothing left for the current CPU to do.
+ */
+int mem_idle(void)
+{
+	if (ncpus == 1)
+		return page_init_deferred() || zero_pool_refill(1);
+
+	kwork_submit(&mem_idle_kwork);
+
+	return 0;
+}
+
+/*
+ * Initialize page structure and memory free list. After this is done, NEVER
+ * use boot_alloc() again. After this function has been called to set up the
+ * memory allocator, ONLY the buddy allocator should be used to allocate and
+ * free physical memory.
+ *
+ * Only the first section of memory is set up here, such that booting does
+ * not take longer as more memory is installed. The remaining sections are
+ * set up on demand by page_init_deferred().
+ */
+void page_init(struct boot_info *boot_info)
+{
+	physaddr_t pa;
+
+	/* What memory is reserved?
 	 *  - Address 0 contains the IVT and BIOS data.
+	 *  - The page holding boot_info itself.
 	 *  - boot_info->elf_hdr points to the ELF header.
 	 *  - Any address in [KERNEL_LMA, end) is part of the kernel.
+	 *
+	 * Take these out of the free regions once, such that the sections
+	 * only have to clip the regions.
 	 */
-	for (i = 0; i < boot_info->mmap_len; ++i, ++entry) {
-		/* LAB 1: your code here. */
-		if (entry->type == MMAP_FREE){
-			for (pa = entry->addr; pa < entry->addr + entry->len; pa += PAGE_SIZE) {
-
-				if (pa < BOOT_MAP_LIM){
-					if ((pa == 0 ||
-						pa == PAGE_ADDR(PADDR(boot_info)) ||
-						pa == (uintptr_t)boot_info->elf_hdr ||
-						(pa >= KERNEL_LMA && pa < end))) {
-							continue;
-						}else{
-							// page can be managed by buddy allocator
-							// we use reserved member to identify the page is managed by buddy allocator, its for invalid free check purpose
-							page_free(pa2page(pa));
-						}
-				}
-			}
-		}
-	}
-}
+	boot_regions_remove(0, PAGE_SIZE);
+
+	pa = PAGE_ADDR(PADDR(boot_info));
+	boot_regions_remove(pa, pa + PAGE_SIZE);
+
+	pa = PAGE_ADDR((physaddr_t)boot_info->elf_hdr);
+	boot_regions_remove(pa, pa + PAGE_SIZE);
 
+	boot_regions_remove(KERNEL_LMA, PADDR(boot_alloc(0)));
+
+	page_region = 0;
+	npages_init = 0;
+	page_init_deferred();
+}
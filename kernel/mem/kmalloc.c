@@ -0,0 +1,127 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/mem.h>
+
+/* The size classes, with their index into kmalloc_caches[]. */
+static const size_t kmalloc_sizes[] = {
+	8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+	2048,
+};
+
+static const char *kmalloc_names[] = {
+	"kmalloc-8", "kmalloc-16", "kmalloc-24", "kmalloc-32", "kmalloc-48",
+	"kmalloc-64", "kmalloc-96", "kmalloc-128", "kmalloc-192",
+	"kmalloc-256", "kmalloc-384", "kmalloc-512", "kmalloc-768",
+	"kmalloc-1024", "kmalloc-1536", "kmalloc-2048",
+};
+
+#define KMALLOC_NCLASSES length_of(kmalloc_sizes)
+
+static struct kmem_cache *kmalloc_caches[KMALLOC_NCLASSES];
+
+/* The size class of requests up to 192 bytes, indexed by (size - 1) / 8. */
+static const uint8_t kmalloc_small_index[] = {
+	0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+	8, 8, 8, 8, 8, 8, 8, 8,
+};
+
+#define KMALLOC_SMALL_MAX (length_of(kmalloc_small_index) * 8)
+
+/* Looks up the size class of a request in constant time. Small requests are
+ * looked up in a table. For larger requests, the classes between 2^n and
+ * 2^(n + 1) are 3 * 2^(n - 1) and 2^(n + 1), where n is the index of the most
+ * significant bit of size - 1.
+ */
+static size_t kmalloc_index(size_t size)
+{
+	size_t n;
+
+	if (size <= KMALLOC_SMALL_MAX)
+		return kmalloc_small_index[(size - 1) / 8];
+
+	/* 256 is class 9, 384 class 10, 512 class 11 and so on. */
+	n = bsr(size - 1);
+
+	return 2 * n - 6 + (size > (size_t)3 << (n - 1));
+}
+
+/* Sets up the slab caches for every size class. */
+void kmalloc_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < KMALLOC_NCLASSES; ++i) {
+		kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i],
+			kmalloc_sizes[i], 0, NULL);
+
+		if (!kmalloc_caches[i])
+			panic("kmalloc_init: cannot create %s", kmalloc_names[i]);
+	}
+}
+
+/* Allocates size bytes. If (alloc_flags & ALLOC_ZERO), the memory is filled
+ * with '\0' bytes. Allocations of more than KMALLOC_MAX_SIZE bytes are rounded
+ * up to a naturally aligned chunk of pages.
+ *
+ * Returns a kernel virtual address or NULL if out of memory.
+ */
+void *kmalloc(size_t size, int alloc_flags)
+{
+	struct page_info *page;
+	size_t order;
+	void *ptr;
+
+	if (size == 0)
+		return NULL;
+
+	if (size > KMALLOC_MAX_SIZE) {
+		order = size > PAGE_SIZE ? bsr((size - 1) >> PAGE_TABLE_SHIFT) + 1 :
+			0;
+		page = page_alloc_order(order, alloc_flags);
+
+		return page ? page2kva(page) : NULL;
+	}
+
+	ptr = kmem_cache_alloc(kmalloc_caches[kmalloc_index(size)]);
+
+	if (ptr && (alloc_flags & ALLOC_ZERO))
+		memset(ptr, 0, size);
+
+	return ptr;
+}
+
+/* Returns memory allocated through kmalloc(). ptr may be NULL. */
+void kfree(void *ptr)
+{
+	struct kmem_cache *cache;
+
+	if (!ptr)
+		return;
+
+	cache = kmem_cache_of(ptr);
+
+	if (cache) {
+		kmem_cache_free(cache, ptr);
+		return;
+	}
+
+	assert(!((uintptr_t)ptr & (PAGE_SIZE - 1)));
+	page_free(pa2page(PADDR(ptr)));
+}
+
+/* Returns the number of bytes usable at ptr, which was returned by kmalloc().
+ */
+size_t ksize(void *ptr)
+{
+	struct kmem_cache *cache = kmem_cache_of(ptr);
+
+	if (cache)
+		return cache->size;
+
+	return PAGE_SIZE << pa2page(PADDR(ptr))->pp_order;
+}
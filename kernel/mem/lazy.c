@@ -0,0 +1,200 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
+
+/* The huge page of zeroes that backs every lazy page until it is written to,
+ * allocated on first use. lazy_lock also serializes the faults, such that two
+ * CPUs writing to the same lazy page do not both allocate a page for it.
+ */
+static struct page_info *lazy_zero;
+static struct spinlock lazy_lock = SPINLOCK_INIT;
+
+/* Allocates the zero page if there is none yet.
+ *
+ * Returns NULL if out of memory.
+ */
+static struct page_info *lazy_zero_alloc(void)
+{
+	struct page_info *page;
+
+	if (lazy_zero)
+		return lazy_zero;
+
+	spin_lock(&lazy_lock);
+
+	if (!lazy_zero) {
+		page = page_alloc(ALLOC_HUGE | ALLOC_ZERO);
+
+		if (page)
+			page_get(page);
+
+		lazy_zero = page;
+	}
+
+	spin_unlock(&lazy_lock);
+
+	return lazy_zero;
+}
+
+/* Returns whether the physical address is part of the zero page. */
+static inline int lazy_is_zero(physaddr_t pa)
+{
+	return lazy_zero && pa - page2pa(lazy_zero) < HPAGE_SIZE;
+}
+
+/* Maps len bytes starting at va such that they read as zeroes, but only get
+ * memory once they are written to. Parts of the range that are aligned to
+ * 2 MiB are mapped by huge pages, such that the first write can back them by a
+ * huge page. The flags must allow writes.
+ *
+ * Returns -1 if out of memory, in which case part of the range may have been
+ * mapped.
+ */
+int lazy_map(struct page_table *pml4, uintptr_t va, size_t len,
+	uint64_t flags)
+{
+	struct page_info *zero;
+	size_t size;
+
+	assert(page_aligned(va) && page_aligned(len));
+	assert(flags & PAGE_WRITE);
+
+	zero = lazy_zero_alloc();
+
+	if (!zero)
+		return -1;
+
+	flags = (flags & ~PAGE_WRITE) | PAGE_LAZY;
+
+	while (len > 0) {
+		size = hpage_aligned(va) && len >= HPAGE_SIZE ? HPAGE_SIZE :
+			PAGE_SIZE;
+
+		if (map_range(pml4, va, page2pa(zero), size, flags) < 0)
+			return -1;
+
+		va += size;
+		len -= size;
+	}
+
+	return 0;
+}
+
+static void lazy_put_pages(struct page_info **pages, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		page_put(pages[i]);
+}
+
+/* Unmaps len bytes starting at va of a range set up by lazy_map(), and frees
+ * the pages that got written to. The range must not cover only part of a huge
+ * page.
+ */
+void lazy_unmap(struct page_table *pml4, uintptr_t va, size_t len)
+{
+	struct page_info *found[TLB_BATCH_MAX];
+	uintptr_t start = va, end = va + len;
+	physaddr_t pa;
+	size_t size, n = 0;
+
+	assert(page_aligned(va) && page_aligned(len));
+
+	for (; va < end; va += size) {
+		if (map_lookup(pml4, va, &pa, &size) < 0) {
+			size = PAGE_SIZE;
+			continue;
+		}
+
+		size -= va & (size - 1);
+
+		if (lazy_is_zero(pa))
+			continue;
+
+		found[n++] = pa2page(pa);
+
+		/* The pages may only be freed once they are unmapped. */
+		if (n == TLB_BATCH_MAX) {
+			unmap_range(pml4, start, va + size - start);
+			lazy_put_pages(found, n);
+			start = va + size;
+			n = 0;
+		}
+	}
+
+	unmap_range(pml4, start, end - start);
+	lazy_put_pages(found, n);
+}
+
+/* Takes lazy_lock from a fault handler. Faults run with interrupts disabled,
+ * and the CPU holding the lock may be waiting for us to flush our TLB when it
+ * maps the page, so keep serving its shootdowns while waiting, like
+ * tlb_shootdown() does.
+ */
+static void lazy_lock_fault(void)
+{
+	while (!spin_trylock(&lazy_lock)) {
+		tlb_poll(this_cpu_id());
+		pause();
+	}
+}
+
+/* Backs the lazy page at va with a zeroed page of its own, which is a huge page
+ * if the lazy page is a huge page and there is a huge page available.
+ *
+ * Returns -1 if va is not mapped by a lazy page or if out of memory.
+ */
+int lazy_fault(struct page_table *pml4, uintptr_t va)
+{
+	struct page_info *page = NULL;
+	physaddr_t *entry;
+	uint64_t flags;
+	size_t size = PAGE_SIZE;
+	int level, ret = -1;
+
+	lazy_lock_fault();
+	entry = map_find(pml4, va, &level);
+
+	if (!entry || !(*entry & PAGE_LAZY))
+		goto out;
+
+	flags = (*entry & PAGE_MASK & ~(PAGE_PRESENT | PAGE_ACCESSED |
+		PAGE_DIRTY | PAGE_HUGE | PAGE_LAZY)) | PAGE_WRITE;
+
+	/* Map a single page out of the huge zero page if there is no huge page
+	 * to back it.
+	 */
+	if (level != MAP_PAGE_TABLE) {
+		page = page_alloc(ALLOC_HUGE | ALLOC_ZERO);
+		size = HPAGE_SIZE;
+	}
+
+	if (!page) {
+		page = page_alloc(ALLOC_ZERO);
+		size = PAGE_SIZE;
+	}
+
+	if (!page)
+		goto out;
+
+	page_get(page);
+
+	if (map_range(pml4, ROUNDDOWN(va, size), page2pa(page), size,
+	    flags) < 0) {
+		page_put(page);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	spin_unlock(&lazy_lock);
+
+	return ret;
+}
@@ -0,0 +1,591 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpufeature.h>
+#include <kernel/mem.h>
+
+struct page_table *kernel_pml4;
+
+/* Set while direct_map_init() runs, as the buddy allocator is not up yet and
+ * page tables come from boot_alloc() instead.
+ */
+static int map_boot;
+
+/* The number of address bits translated below every level. */
+static const unsigned map_shifts[MAP_LEVELS] = {
+	[MAP_PML4] = PML4_SHIFT,
+	[MAP_PDPT] = PDPT_SHIFT,
+	[MAP_PAGE_DIR] = PAGE_DIR_SHIFT,
+	[MAP_PAGE_TABLE] = PAGE_TABLE_SHIFT,
+};
+
+/* Returns the table the entry points to. Page tables are always part of the
+ * memory mapped at KERNEL_VMA.
+ */
+static inline struct page_table *map_table(physaddr_t entry)
+{
+	return (struct page_table *)(KERNEL_VMA + PAGE_ADDR(entry));
+}
+
+/* Returns whether the entry at the level maps a page rather than pointing to
+ * a table.
+ */
+static inline int map_is_leaf(physaddr_t entry, int level)
+{
+	return level == MAP_PAGE_TABLE || (entry & PAGE_HUGE);
+}
+
+/* Allocates a zeroed page table from the pool of page-table pages.
+ *
+ * Returns NULL if out of memory.
+ */
+static struct page_table *map_alloc_table(void)
+{
+	struct page_info *page;
+	void *table;
+
+	if (map_boot) {
+		table = boot_alloc(PAGE_SIZE);
+		memset(table, 0, PAGE_SIZE);
+		return table;
+	}
+
+	page = pt_alloc();
+
+	return page ? page2kva(page) : NULL;
+}
+
+/* Returns the page of the table the entry is part of, if the table is from the
+ * pool of page-table pages. The tables set up at boot are not tracked.
+ */
+static struct page_info *map_table_page(physaddr_t *entry)
+{
+	struct page_info *page;
+
+	if (map_boot)
+		return NULL;
+
+	page = pa2page(PADDR(ROUNDDOWN(entry, PAGE_SIZE)));
+
+	return page->pp_pt ? page : NULL;
+}
+
+/* Adjusts the number of entries in use of the table the entry is part of. */
+static inline void map_count(physaddr_t *entry, int delta)
+{
+	struct page_info *page = map_table_page(entry);
+
+	if (page)
+		page->pp_nents += delta;
+}
+
+/* Points the entry at a new table. The permissions are left to the entries
+ * further down, except for user access, which has to be allowed all the way.
+ *
+ * Returns -1 if out of memory.
+ */
+static int map_new_table(physaddr_t *entry, uint64_t flags)
+{
+	struct page_table *table = map_alloc_table();
+
+	if (!table)
+		return -1;
+
+	*entry = PADDR(table) | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+	map_count(entry, 1);
+
+	return 0;
+}
+
+/* Replaces the huge page mapped by the entry at the level with a table of
+ * entries of the next level that map the same memory with the same flags.
+ *
+ * Returns -1 if out of memory.
+ */
+static int map_split(physaddr_t *entry, int level)
+{
+	physaddr_t pa = PAGE_ADDR(*entry), flags = *entry & PAGE_MASK;
+	struct page_table *table;
+	size_t i;
+
+	table = map_alloc_table();
+
+	if (!table)
+		return -1;
+
+	/* Bit 7 is the PAT bit rather than the huge bit in a page table. */
+	if (level + 1 == MAP_PAGE_TABLE)
+		flags &= ~PAGE_HUGE;
+
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i)
+		table->entries[i] = (pa + (i << map_shifts[level + 1])) | flags;
+
+	map_count(table->entries, PAGE_TABLE_ENTRIES);
+
+	*entry = PADDR(table) | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+
+	return 0;
+}
+
+/* Looks up the entry at the level that translates va, allocating the tables
+ * above it and splitting huge pages in the way.
+ *
+ * Returns NULL if out of memory.
+ */
+static physaddr_t *map_walk(struct page_table *pml4, uintptr_t va, int level,
+	uint64_t flags)
+{
+	struct page_table *table = pml4;
+	physaddr_t *entry;
+	int i;
+
+	for (i = MAP_PML4; ; ++i) {
+		entry = table->entries + ((va >> map_shifts[i]) & PAGE_TABLE_MASK);
+
+		if (i == level)
+			return entry;
+
+		if (!(*entry & PAGE_PRESENT)) {
+			if (map_new_table(entry, flags) < 0)
+				return NULL;
+		} else if (map_is_leaf(*entry, i)) {
+			if (map_split(entry, i) < 0)
+				return NULL;
+		}
+
+		*entry |= flags & PAGE_USER;
+		table = map_table(*entry);
+	}
+}
+
+/* Returns the level of the largest page that maps the start of the range. */
+static int map_level(uintptr_t va, physaddr_t pa, size_t len)
+{
+	uintptr_t align = va | pa;
+
+	if (cpu_has(CPU_FEATURE_PAGE1GB) && !(align & (PAGE_DIR_SPAN - 1)) &&
+	    len >= PAGE_DIR_SPAN)
+		return MAP_PDPT;
+
+	if (!(align & (PAGE_TABLE_SPAN - 1)) && len >= PAGE_TABLE_SPAN)
+		return MAP_PAGE_DIR;
+
+	return MAP_PAGE_TABLE;
+}
+
+/* Adds the invalidation of the old entry at the level that translated va to
+ * the batch. If the entry pointed to a table, the translations of all the
+ * pages below it have to go, which is done by flushing the entire TLB.
+ */
+static void map_invalidate(struct tlb_batch *batch, uintptr_t va,
+	physaddr_t old, int level)
+{
+	if (!(old & PAGE_PRESENT))
+		return;
+
+	if (map_is_leaf(old, level))
+		tlb_batch_add(batch, va);
+	else
+		tlb_batch_add_all(batch);
+}
+
+/* Hands the table at the level and the tables below it to the batch, such that
+ * they are freed once no TLB caches their entries anymore.
+ */
+static void map_release(struct tlb_batch *batch, struct page_table *table,
+	int level)
+{
+	struct page_info *page = map_table_page(table->entries);
+	size_t i;
+
+	for (i = 0; level < MAP_PAGE_TABLE && i < PAGE_TABLE_ENTRIES; ++i) {
+		if ((table->entries[i] & PAGE_PRESENT) &&
+		    !map_is_leaf(table->entries[i], level))
+			map_release(batch, map_table(table->entries[i]),
+				level + 1);
+	}
+
+	if (page)
+		tlb_batch_put_table(batch, page);
+}
+
+/* Frees the tables on the way to va that no longer have any entries in use,
+ * from the bottom up, once the batch is flushed.
+ */
+static void map_prune(struct tlb_batch *batch, uintptr_t va)
+{
+	physaddr_t *path[MAP_LEVELS];
+	struct page_table *table = batch->pml4;
+	struct page_info *page;
+	int i;
+
+	for (i = MAP_PML4; ; ++i) {
+		path[i] = table->entries + ((va >> map_shifts[i]) & PAGE_TABLE_MASK);
+
+		if (!(*path[i] & PAGE_PRESENT) || map_is_leaf(*path[i], i))
+			break;
+
+		table = map_table(*path[i]);
+	}
+
+	for (; i > MAP_PML4; --i) {
+		page = map_table_page(path[i]);
+
+		if (!page || page->pp_nents)
+			break;
+
+		*path[i - 1] = 0;
+		map_count(path[i - 1], -1);
+		tlb_batch_put_table(batch, page);
+	}
+}
+
+/* Maps len bytes starting at va to the physical memory at pa with the flags,
+ * using the largest pages that the alignment of va and pa and the length
+ * allow. Any existing mappings in the range are replaced, and the TLBs are
+ * flushed once for the entire range. The tables below entries that get
+ * replaced by a huge page are freed, unless they were set up at boot.
+ *
+ * Returns -1 if out of memory, in which case part of the range may have been
+ * mapped.
+ */
+int map_range(struct page_table *pml4, uintptr_t va, physaddr_t pa, size_t len,
+	uint64_t flags)
+{
+	struct tlb_batch batch;
+	physaddr_t *entry, old;
+	size_t size;
+	int level, ret = 0;
+
+	assert(page_aligned(va) && page_aligned(pa) && page_aligned(len));
+	tlb_batch_init(&batch, pml4);
+
+	while (len > 0) {
+		level = map_level(va, pa, len);
+		entry = map_walk(pml4, va, level, flags);
+
+		if (!entry) {
+			ret = -1;
+			break;
+		}
+
+		old = *entry;
+		*entry = pa | flags | PAGE_PRESENT |
+			(level != MAP_PAGE_TABLE ? PAGE_HUGE : 0);
+		map_invalidate(&batch, va, old, level);
+
+		if (!(old & PAGE_PRESENT))
+			map_count(entry, 1);
+		else if (!map_is_leaf(old, level))
+			map_release(&batch, map_table(old), level + 1);
+
+		size = (size_t)1 << map_shifts[level];
+		va += size;
+		pa += size;
+		len -= size;
+	}
+
+	tlb_batch_flush(&batch);
+
+	return ret;
+}
+
+/* Unmaps len bytes starting at va, flushing the TLBs once for the entire
+ * range. Huge pages that are only partially part of the range are split first,
+ * and tables that end up empty are freed.
+ *
+ * Returns -1 if out of memory, in which case part of the range may have been
+ * unmapped.
+ */
+int unmap_range(struct page_table *pml4, uintptr_t va, size_t len)
+{
+	struct tlb_batch batch;
+	struct page_table *table;
+	physaddr_t *entry;
+	size_t span, n;
+	int i, ret = 0;
+
+	assert(page_aligned(va) && page_aligned(len));
+	tlb_batch_init(&batch, pml4);
+
+	while (len > 0 && ret == 0) {
+		table = pml4;
+
+		for (i = MAP_PML4; ; ++i) {
+			span = (size_t)1 << map_shifts[i];
+			entry = table->entries +
+				((va >> map_shifts[i]) & PAGE_TABLE_MASK);
+			n = MIN(span - (va & (span - 1)), len);
+
+			if (!(*entry & PAGE_PRESENT))
+				break;
+
+			if (map_is_leaf(*entry, i)) {
+				if (n == span) {
+					map_invalidate(&batch, va, *entry, i);
+					*entry = 0;
+					map_count(entry, -1);
+					map_prune(&batch, va);
+					break;
+				}
+
+				if (map_split(entry, i) < 0) {
+					ret = -1;
+					break;
+				}
+			}
+
+			table = map_table(*entry);
+		}
+
+		va += n;
+		len -= n;
+	}
+
+	tlb_batch_flush(&batch);
+
+	return ret;
+}
+
+/* Looks up the entry of the page that maps va, without allocating anything.
+ * The level of the entry is stored in level.
+ *
+ * Returns NULL if va is not mapped.
+ */
+physaddr_t *map_find(struct page_table *pml4, uintptr_t va, int *level)
+{
+	struct page_table *table = pml4;
+	physaddr_t *entry;
+	int i;
+
+	for (i = MAP_PML4; ; ++i) {
+		entry = table->entries + ((va >> map_shifts[i]) & PAGE_TABLE_MASK);
+
+		if (!(*entry & PAGE_PRESENT))
+			return NULL;
+
+		if (map_is_leaf(*entry, i))
+			break;
+
+		table = map_table(*entry);
+	}
+
+	*level = i;
+
+	return entry;
+}
+
+/* Looks up the physical address va is mapped to. If size is not NULL, it is
+ * set to the size of the page that maps va.
+ *
+ * Returns -1 if va is not mapped.
+ */
+int map_lookup(struct page_table *pml4, uintptr_t va, physaddr_t *pa,
+	size_t *size)
+{
+	physaddr_t *entry;
+	size_t span;
+	int level;
+
+	entry = map_find(pml4, va, &level);
+
+	if (!entry)
+		return -1;
+
+	span = (size_t)1 << map_shifts[level];
+
+	/* Leave out the PAT bit of huge pages. */
+	*pa = (PAGE_ADDR(*entry) & ~(span - 1)) + (va & (span - 1));
+
+	if (size)
+		*size = span;
+
+	return 0;
+}
+
+/* Maps the pages of size bytes starting at va to the physical memory at pa
+ * with the flags. This is meant for setting up static mappings, hence it
+ * panics if out of memory. Before page_init(), the page tables come from
+ * boot_alloc(), like those of the direct map.
+ */
+void boot_map_region(struct page_table *pml4, uintptr_t va, size_t size,
+	physaddr_t pa, uint64_t flags)
+{
+	int boot = map_boot;
+
+	if (!npages_init)
+		map_boot = 1;
+
+	if (map_range(pml4, va, pa, ROUNDUP(size, PAGE_SIZE), flags) < 0)
+		panic("boot_map_region: out of memory");
+
+	map_boot = boot;
+}
+
+/* Looks up the page mapped at va by a 4 KiB page. If entry_store is not NULL,
+ * it is set to the address of the entry that maps the page.
+ *
+ * Returns NULL if there is no such page.
+ */
+struct page_info *page_lookup(struct page_table *pml4, uintptr_t va,
+	physaddr_t **entry_store)
+{
+	physaddr_t *entry;
+	int level;
+
+	entry = map_find(pml4, va, &level);
+
+	if (!entry || level != MAP_PAGE_TABLE)
+		return NULL;
+
+	if (entry_store)
+		*entry_store = entry;
+
+	return pa2page(PAGE_ADDR(*entry));
+}
+
+/* Unmaps the page at va as part of the batch, which drops the reference of the
+ * mapping to the page once the batch is flushed. Does nothing if there is no
+ * page at va.
+ */
+void page_remove_batch(struct tlb_batch *batch, uintptr_t va)
+{
+	struct page_info *page;
+	physaddr_t *entry;
+
+	page = page_lookup(batch->pml4, va, &entry);
+
+	if (!page)
+		return;
+
+	*entry = 0;
+	map_count(entry, -1);
+	map_prune(batch, va);
+	tlb_batch_add(batch, va);
+	tlb_batch_put(batch, page);
+}
+
+/* Unmaps the page at va and drops the reference of the mapping to the page. */
+void page_remove(struct page_table *pml4, uintptr_t va)
+{
+	struct tlb_batch batch;
+
+	tlb_batch_init(&batch, pml4);
+	page_remove_batch(&batch, va);
+	tlb_batch_flush(&batch);
+}
+
+/* Maps the page at va with the flags, replacing the page that was mapped at
+ * va, which must have been mapped with page_insert() as well. The mapping
+ * holds a reference to the page.
+ *
+ * Returns -1 if out of memory.
+ */
+int page_insert(struct page_table *pml4, struct page_info *page, uintptr_t va,
+	uint64_t flags)
+{
+	struct tlb_batch batch;
+	physaddr_t *entry, old;
+
+	assert(page_aligned(va));
+	entry = map_walk(pml4, va, MAP_PAGE_TABLE, flags);
+
+	if (!entry)
+		return -1;
+
+	/* Take the reference first, in case the page is already mapped at va. */
+	page_get(page);
+	tlb_batch_init(&batch, pml4);
+	old = *entry;
+	*entry = page2pa(page) | flags | PAGE_PRESENT;
+
+	if (old & PAGE_PRESENT) {
+		tlb_batch_add(&batch, va);
+		tlb_batch_put(&batch, pa2page(PAGE_ADDR(old)));
+	} else {
+		map_count(entry, 1);
+	}
+
+	tlb_batch_flush(&batch);
+
+	return 0;
+}
+
+static void map_destroy_table(struct page_table *table, int level)
+{
+	struct page_info *page;
+	size_t i;
+
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+		if ((table->entries[i] & PAGE_PRESENT) &&
+		    !map_is_leaf(table->entries[i], level))
+			map_destroy_table(map_table(table->entries[i]),
+				level + 1);
+	}
+
+	page = pa2page(PADDR(table));
+
+	if (page->pp_pt)
+		pt_free(page);
+	else
+		page_free(page);
+}
+
+/* Frees the page tables, which must have been allocated by map_range() and
+ * unmap_range() after boot, and must not be in use. The PML4 itself may have
+ * been allocated with page_alloc() instead.
+ */
+void map_destroy(struct page_table *pml4)
+{
+	assert(pml4 != kernel_pml4);
+	tlb_forget(pml4);
+	map_destroy_table(pml4, MAP_PML4);
+}
+
+/* Switches the current CPU to the direct map, with global pages enabled such
+ * that the translations of the direct map survive switching page tables. The
+ * kernel honors read-only pages as well, such that its writes to copy-on-write
+ * pages fault.
+ */
+void direct_map_load(void)
+{
+	write_cr0(read_cr0() | CR0_WP);
+	write_cr4(read_cr4() | CR4_PGE);
+	write_cr3(PADDR(kernel_pml4));
+}
+
+/* Maps all physical memory up to top at KERNEL_VMA, with 1 GiB pages if the
+ * CPU supports them and 2 MiB pages otherwise, such that the kernel needs as
+ * few TLB entries as possible to access all of memory. The first 4 GiB are
+ * always mapped, as that is where memory mapped I/O lives. This replaces the
+ * mapping of the boot stub, which stops at 512 GiB, and has to run before
+ * page_init(), as the page tables are allocated with boot_alloc().
+ */
+void direct_map_init(physaddr_t top)
+{
+	struct page_table *boot_pml4 = map_table(read_cr3()), *pml4;
+
+	top = MAX(ROUNDUP(top, PAGE_DIR_SPAN), 4 * PAGE_DIR_SPAN);
+	top = MIN(top, (physaddr_t)0 - KERNEL_VMA);
+
+	map_boot = 1;
+	pml4 = map_alloc_table();
+
+	/* Keep the identity mapping of the boot stub, as the memory map of the
+	 * boot loader is still accessed through it.
+	 */
+	pml4->entries[0] = boot_pml4->entries[0];
+
+	if (map_range(pml4, KERNEL_VMA, 0, top, PAGE_WRITE | PAGE_GLOBAL) < 0)
+		panic("direct_map_init: out of memory");
+
+	map_boot = 0;
+	kernel_pml4 = pml4;
+	direct_map_load();
+	tlb_init();
+	boot_map_lim = top;
+}
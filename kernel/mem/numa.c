@@ -0,0 +1,204 @@
+#include <types.h>
+#include <stdio.h>
+
+#include <kernel/acpi.h>
+#include <kernel/mem.h>
+
+/* Without an SRAT, all memory and all CPUs belong to node 0. */
+size_t nnodes = 1;
+uint8_t numa_fallback[NNODES][NNODES];
+
+/* The memory ranges of the nodes, sorted by address. */
+static struct numa_range numa_ranges[NUMA_NRANGES];
+static size_t numa_nranges;
+
+/* The proximity domain of every node, used to look up distances in the SLIT.
+ */
+static uint32_t numa_domains[NNODES];
+static struct acpi_slit *numa_slit;
+
+/* Maps the proximity domain onto a node, allocating a new node for domains we
+ * have not seen before. Domains beyond NNODES end up in node 0.
+ */
+static unsigned numa_domain_node(uint32_t domain)
+{
+	size_t node;
+
+	for (node = 0; node < nnodes; ++node) {
+		if (numa_domains[node] == domain)
+			return node;
+	}
+
+	if (nnodes == NNODES) {
+		cprintf("NUMA: too many nodes, merging domain %u into node 0\n",
+			domain);
+		return 0;
+	}
+
+	numa_domains[nnodes] = domain;
+
+	return nnodes++;
+}
+
+static void numa_add_range(physaddr_t start, physaddr_t end, unsigned node)
+{
+	struct numa_range range;
+	size_t i;
+
+	if (numa_nranges == NUMA_NRANGES) {
+		cprintf("NUMA: too many memory ranges, ignoring %p - %p\n",
+			start, end);
+		return;
+	}
+
+	range.start = start;
+	range.end = end;
+	range.node = node;
+
+	for (i = numa_nranges; i > 0 && numa_ranges[i - 1].start > start; --i)
+		numa_ranges[i] = numa_ranges[i - 1];
+
+	numa_ranges[i] = range;
+	++numa_nranges;
+}
+
+/* Returns the distance between two nodes as found in the SLIT. */
+unsigned numa_distance(unsigned from, unsigned to)
+{
+	uint64_t n;
+
+	if (from == to)
+		return NUMA_LOCAL_DISTANCE;
+
+	if (!numa_slit)
+		return NUMA_REMOTE_DISTANCE;
+
+	n = numa_slit->nlocalities;
+
+	if (numa_domains[from] >= n || numa_domains[to] >= n)
+		return NUMA_REMOTE_DISTANCE;
+
+	return numa_slit->entries[numa_domains[from] * n + numa_domains[to]];
+}
+
+/* Sorts the nodes by their distance to every node, such that allocations fall
+ * back to the closest node first.
+ */
+static void numa_init_fallback(void)
+{
+	unsigned from, node, dist;
+	size_t i, j;
+
+	for (from = 0; from < nnodes; ++from) {
+		for (i = 0; i < nnodes; ++i) {
+			node = i;
+			dist = numa_distance(from, node);
+
+			for (j = i; j > 0 &&
+			     numa_distance(from, numa_fallback[from][j - 1]) > dist;
+			     --j)
+				numa_fallback[from][j] = numa_fallback[from][j - 1];
+
+			numa_fallback[from][j] = node;
+		}
+	}
+}
+
+/* Reads the memory and CPU affinity from the SRAT and the distances between
+ * the nodes from the SLIT. This relies on the ACPI tables having been found
+ * and the CPUs having been enumerated by smp_init().
+ */
+void numa_init(void)
+{
+	struct acpi_srat *srat;
+	struct acpi_srat_mem *mem;
+	struct acpi_srat_lapic *lapic;
+	struct acpi_madt_entry *entry;
+	uint32_t domain;
+	char *p, *end;
+	size_t i;
+
+	nnodes = 1;
+	numa_nranges = 0;
+	srat = acpi_find_table("SRAT");
+
+	if (srat) {
+		/* Allocate node 0 for the first domain we come across. */
+		nnodes = 0;
+		p = (char *)srat->entries;
+		end = (char *)srat + srat->hdr.len;
+
+		for (; p + sizeof *entry <= end &&
+		     ((struct acpi_madt_entry *)p)->len;
+		     p += ((struct acpi_madt_entry *)p)->len) {
+			entry = (struct acpi_madt_entry *)p;
+
+			if (entry->type == ACPI_SRAT_MEM) {
+				mem = (struct acpi_srat_mem *)entry;
+
+				if (!(mem->flags & ACPI_SRAT_ENABLED) || !mem->len)
+					continue;
+
+				numa_add_range(mem->base, mem->base + mem->len,
+					numa_domain_node(mem->domain));
+			} else if (entry->type == ACPI_SRAT_LAPIC) {
+				lapic = (struct acpi_srat_lapic *)entry;
+
+				if (!(lapic->flags & ACPI_SRAT_ENABLED))
+					continue;
+
+				domain = lapic->domain_lo |
+					lapic->domain_hi[0] << 8 |
+					lapic->domain_hi[1] << 16 |
+					lapic->domain_hi[2] << 24;
+
+				for (i = 0; i < ncpus; ++i) {
+					if (cpus[i].lapic_id == lapic->apic_id)
+						cpus[i].node =
+							numa_domain_node(domain);
+				}
+			}
+		}
+
+		if (!nnodes)
+			nnodes = 1;
+	}
+
+	numa_slit = acpi_find_table("SLIT");
+	numa_init_fallback();
+
+	if (nnodes > 1)
+		cprintf("NUMA: %u nodes\n", nnodes);
+}
+
+/* Looks up the node of the physical address pa. If end is not NULL, it is set
+ * to the end of the range of memory starting at pa that belongs to the same
+ * node. Memory not covered by the SRAT belongs to node 0.
+ *
+ * Returns the node.
+ */
+unsigned numa_lookup(physaddr_t pa, physaddr_t *end)
+{
+	size_t i;
+
+	for (i = 0; i < numa_nranges; ++i) {
+		if (pa < numa_ranges[i].start) {
+			if (end)
+				*end = numa_ranges[i].start;
+
+			return 0;
+		}
+
+		if (pa < numa_ranges[i].end) {
+			if (end)
+				*end = numa_ranges[i].end;
+
+			return numa_ranges[i].node;
+		}
+	}
+
+	if (end)
+		*end = ~(physaddr_t)0;
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+#include <types.h>
+#include <paging.h>
+
+#include <kernel/mem.h>
+
+/* Refill a cache with one order 4 chunk (16 pages) at a time. */
+#define PCP_BATCH_ORDER 4
+#define PCP_BATCH (1 << PCP_BATCH_ORDER)
+#define PCP_LOW (2 * PCP_BATCH)
+#define PCP_HIGH (6 * PCP_BATCH)
+
+struct page_cache page_caches[NCPUS];
+
+/* Sets up the per-CPU page caches. */
+void page_cache_init(void)
+{
+	struct page_cache *cache;
+	size_t i;
+
+	for (i = 0; i < NCPUS; ++i) {
+		cache = page_caches + i;
+		spin_init(&cache->lock);
+		page_list_init(&cache->free_list);
+		cache->count = 0;
+		cache->low = PCP_LOW;
+		cache->high = PCP_HIGH;
+		cache->batch = PCP_BATCH;
+		cache->ndeferred = 0;
+	}
+}
+
+/* Refills the cache with up to batch order 0 pages. The pages are preferably
+ * carved out of a single chunk of the batch order to avoid splitting a chunk
+ * for every single page. The caller must hold the lock of the cache.
+ *
+ * Returns the number of pages added to the cache.
+ */
+static size_t page_cache_refill(struct page_cache *cache)
+{
+	struct page_info *page;
+	size_t i, n;
+
+	page = buddy_find(PCP_BATCH_ORDER);
+
+	if (page) {
+		n = 1 << page->pp_order;
+
+		for (i = 0; i < n; ++i) {
+			page[i].pp_order = 0;
+			page[i].pp_free = 0;
+			page_list_add_tail(&cache->free_list, page + i);
+		}
+
+		cache->count += n;
+
+		return n;
+	}
+
+	/* Memory is fragmented: grab whatever order 0 pages we can get. */
+	for (n = 0; n < cache->batch; ++n) {
+		page = buddy_find(BUDDY_4K_PAGE);
+
+		if (!page)
+			break;
+
+		page_list_add_tail(&cache->free_list, page);
+	}
+
+	cache->count += n;
+
+	return n;
+}
+
+/* Takes an order 0 page from the cache of the current CPU, refilling the cache
+ * from the buddy allocator if it is empty.
+ *
+ * Returns NULL if both the cache and the buddy allocator are out of pages.
+ */
+struct page_info *page_cache_alloc(void)
+{
+	struct page_cache *cache = this_cpu()->cache;
+	struct page_info *page = NULL;
+
+	spin_lock(&cache->lock);
+
+	if (cache->count || page_cache_refill(cache)) {
+		--cache->count;
+		page = page_list_pop(&cache->free_list);
+	}
+
+	spin_unlock(&cache->lock);
+
+	return page;
+}
+
+/* Hands pages back from the cache to the buddy allocator until at most target
+ * pages remain, with the lock of the cache held.
+ */
+static size_t page_cache_drain_locked(struct page_cache *cache, size_t target)
+{
+	struct page_info *page;
+	size_t n = 0;
+
+	while (cache->count > target) {
+		page = page_list_pop_tail(&cache->free_list);
+		--cache->count;
+
+		buddy_merge(page);
+		++n;
+	}
+
+	return n;
+}
+
+/* Returns an order 0 page to the cache of the current CPU. If the cache grows
+ * beyond the high watermark, it is drained to the low watermark.
+ */
+void page_cache_free(struct page_info *page)
+{
+	struct page_cache *cache = this_cpu()->cache;
+
+	spin_lock(&cache->lock);
+	page_list_add(&cache->free_list, page);
+
+	if (++cache->count > cache->high)
+		page_cache_drain_locked(cache, cache->low);
+
+	spin_unlock(&cache->lock);
+}
+
+/* Frees the deferred pages of the cache, with the lock of the cache held.
+ * Unmovable order 0 pages stay in the cache like any other freed page.
+ *
+ * Returns the number of pages returned to the buddy allocator.
+ */
+static size_t page_cache_flush_locked(struct page_cache *cache)
+{
+	struct page_info *page;
+	size_t i, n = 0;
+
+	for (i = 0; i < cache->ndeferred; ++i) {
+		page = cache->deferred[i];
+
+		if (page->pp_order == BUDDY_4K_PAGE &&
+		    page_migrate_type(page) == MIGRATE_UNMOVABLE) {
+			page_list_add(&cache->free_list, page);
+			++cache->count;
+		} else {
+			n += (size_t)1 << page->pp_order;
+			buddy_merge(page);
+		}
+	}
+
+	cache->ndeferred = 0;
+
+	return n;
+}
+
+/* Queues a page whose last reference was dropped to be freed by the current
+ * CPU along with the next PCP_DEFER_MAX - 1 such pages.
+ */
+void page_cache_defer(struct page_info *page)
+{
+	struct page_cache *cache = this_cpu()->cache;
+
+	spin_lock(&cache->lock);
+	cache->deferred[cache->ndeferred++] = page;
+
+	if (cache->ndeferred == PCP_DEFER_MAX) {
+		page_cache_flush_locked(cache);
+
+		if (cache->count > cache->high)
+			page_cache_drain_locked(cache, cache->low);
+	}
+
+	spin_unlock(&cache->lock);
+}
+
+/* Hands pages back from the cache to the buddy allocator until at most target
+ * pages remain, after freeing the deferred pages. The least recently freed
+ * pages are returned first, as they are the least likely to still be cache
+ * hot.
+ *
+ * Returns the number of pages returned to the buddy allocator.
+ */
+size_t page_cache_drain(struct page_cache *cache, size_t target)
+{
+	size_t n;
+
+	spin_lock(&cache->lock);
+	n = page_cache_flush_locked(cache);
+	n += page_cache_drain_locked(cache, target);
+	spin_unlock(&cache->lock);
+
+	return n;
+}
+
+/* Drains the caches of all CPUs. Call this when the buddy allocator runs out of
+ * memory to allow the cached pages to be merged into larger chunks.
+ *
+ * Returns the number of pages returned to the buddy allocator.
+ */
+size_t page_cache_drain_all(void)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < NCPUS; ++i)
+		n += page_cache_drain(page_caches + i, 0);
+
+	return n;
+}
+
+/* Gets the total amount of pages held by the per-CPU caches, including the
+ * deferred ones.
+ */
+size_t count_cached_pages(void)
+{
+	size_t i, j, n = 0;
+
+	for (i = 0; i < NCPUS; ++i) {
+		n += page_caches[i].count;
+
+		for (j = 0; j < page_caches[i].ndeferred; ++j)
+			n += (size_t)1 << page_caches[i].deferred[j]->pp_order;
+	}
+
+	return n;
+}
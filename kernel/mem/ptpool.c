@@ -0,0 +1,114 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+
+#include <kernel/mem.h>
+
+static struct pt_pool pt_pool;
+
+/* Sets up the pool of page-table pages, which starts out empty. */
+void pt_pool_init(void)
+{
+	spin_init(&pt_pool.lock);
+	page_list_init(&pt_pool.free_list);
+	pt_pool.count = 0;
+}
+
+/* Allocates a zeroed page table, from the pool if possible.
+ *
+ * Returns NULL if out of memory.
+ */
+struct page_info *pt_alloc(void)
+{
+	struct page_info *page = NULL;
+
+	if (pt_pool.count) {
+		spin_lock(&pt_pool.lock);
+		page = page_list_pop(&pt_pool.free_list);
+
+		if (page)
+			--pt_pool.count;
+
+		spin_unlock(&pt_pool.lock);
+	}
+
+	if (!page) {
+		page = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+
+		if (!page)
+			return NULL;
+
+		page->pp_pt = 1;
+		page->pp_nents = 0;
+	}
+
+	return page;
+}
+
+/* Clears the entries of the page table that are still in use and returns it
+ * to the pool, or to the buddy allocator if the pool is full. The page table
+ * must not be in use by any TLB anymore.
+ */
+void pt_free(struct page_info *page)
+{
+	struct page_table *table = page2kva(page);
+	size_t i;
+
+	assert(page->pp_pt);
+
+	for (i = 0; page->pp_nents > 0; ++i) {
+		assert(i < PAGE_TABLE_ENTRIES);
+
+		if (table->entries[i]) {
+			table->entries[i] = 0;
+			--page->pp_nents;
+		}
+	}
+
+	if (pt_pool.count < PT_POOL_MAX) {
+		spin_lock(&pt_pool.lock);
+
+		if (pt_pool.count < PT_POOL_MAX) {
+			page_list_add(&pt_pool.free_list, page);
+			++pt_pool.count;
+			page = NULL;
+		}
+
+		spin_unlock(&pt_pool.lock);
+	}
+
+	if (page) {
+		page->pp_pt = 0;
+		page_free(page);
+	}
+}
+
+/* Returns all pages of the pool to the buddy allocator. Call this when the
+ * buddy allocator runs out of memory.
+ *
+ * Returns the number of pages returned to the buddy allocator.
+ */
+size_t pt_pool_drain(void)
+{
+	struct page_info *page;
+	size_t n = 0;
+
+	spin_lock(&pt_pool.lock);
+
+	while ((page = page_list_pop(&pt_pool.free_list))) {
+		--pt_pool.count;
+		page->pp_pt = 0;
+		buddy_merge(page);
+		++n;
+	}
+
+	spin_unlock(&pt_pool.lock);
+
+	return n;
+}
+
+/* Gets the number of pages held by the pool. */
+size_t count_pt_pool_pages(void)
+{
+	return pt_pool.count;
+}
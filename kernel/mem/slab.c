@@ -0,0 +1,413 @@
+#include <types.h>
+#include <assert.h>
+#include <list.h>
+#include <paging.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/mem.h>
+
+/* The cache the struct kmem_cache structs themselves are allocated from. */
+static struct kmem_cache kmem_cache_cache;
+
+/* The list of all caches. */
+static struct list kmem_caches = LIST_INIT(kmem_caches);
+static struct spinlock kmem_caches_lock = SPINLOCK_INIT;
+
+/* Returns the free pointer of a free object. */
+static inline void **kmem_free_ptr(struct kmem_cache *cache, void *obj)
+{
+	return (void **)((char *)obj + cache->free_offset);
+}
+
+/* Returns the slab the object belongs to. */
+static inline struct kmem_slab *kmem_slab_of(struct kmem_cache *cache,
+	void *obj)
+{
+	return ROUNDDOWN(obj, PAGE_SIZE << cache->order);
+}
+
+/* Fills in the layout of the cache and sets up empty lists.
+ *
+ * Returns -1 if the objects do not fit in the largest slab.
+ */
+static int kmem_cache_setup(struct kmem_cache *cache, const char *name,
+	size_t size, size_t align, void (*ctor)(void *obj))
+{
+	size_t i, stride, free_offset, obj_offset, order, nobjs = 0;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+
+	if (align & (align - 1))
+		return -1;
+
+	/* A free object holds a pointer to the next free object. If there is
+	 * a constructor, the pointer goes after the object, as it would clobber
+	 * the constructed state otherwise.
+	 */
+	free_offset = ctor ? ROUNDUP(size, sizeof(void *)) : 0;
+	stride = ROUNDUP(MAX(size, free_offset + sizeof(void *)), align);
+	obj_offset = ROUNDUP(sizeof(struct kmem_slab), align);
+
+	for (order = 0; order <= KMEM_MAX_ORDER; ++order) {
+		if ((PAGE_SIZE << order) <= obj_offset)
+			continue;
+
+		nobjs = ((PAGE_SIZE << order) - obj_offset) / stride;
+
+		if (nobjs >= KMEM_MIN_OBJS)
+			break;
+	}
+
+	if (order > KMEM_MAX_ORDER)
+		order = KMEM_MAX_ORDER;
+
+	if (!nobjs)
+		return -1;
+
+	cache->name = name;
+	cache->size = size;
+	cache->stride = stride;
+	cache->free_offset = free_offset;
+	cache->order = order;
+	cache->nobjs = nobjs;
+	cache->obj_offset = obj_offset;
+	cache->ctor = ctor;
+
+	spin_init(&cache->lock);
+	list_init(&cache->partial);
+	list_init(&cache->full);
+	list_init(&cache->empty);
+	cache->nslabs = 0;
+	cache->nempty = 0;
+
+	for (i = 0; i < NCPUS; ++i)
+		cache->cpu[i].count = 0;
+
+	spin_lock(&kmem_caches_lock);
+	list_add_tail(&kmem_caches, &cache->node);
+	spin_unlock(&kmem_caches_lock);
+
+	return 0;
+}
+
+/* Sets up the cache of caches. Call this once the buddy allocator is up. */
+void kmem_init(void)
+{
+	list_init(&kmem_caches);
+
+	if (kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+	    sizeof(struct kmem_cache), 0, NULL) < 0)
+		panic("kmem_init: cannot set up the cache of caches");
+}
+
+/* Creates a cache of objects of the given size, aligned to align bytes, or to
+ * the size of a pointer if align is zero. The constructor ctor may be NULL.
+ *
+ * Returns NULL if out of memory or if the objects are too large to fit in a
+ * slab, in which case the pages should be allocated directly.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+	size_t align, void (*ctor)(void *obj))
+{
+	struct kmem_cache *cache;
+
+	cache = kmem_cache_alloc(&kmem_cache_cache);
+
+	if (!cache)
+		return NULL;
+
+	if (kmem_cache_setup(cache, name, size, align, ctor) < 0) {
+		kmem_cache_free(&kmem_cache_cache, cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/* Allocates a new slab and constructs its objects.
+ *
+ * Returns NULL if out of memory.
+ */
+static struct kmem_slab *kmem_slab_create(struct kmem_cache *cache)
+{
+	struct page_info *page;
+	struct kmem_slab *slab;
+	char *obj;
+	size_t i;
+
+	page = page_alloc_order(cache->order, 0);
+
+	if (!page)
+		return NULL;
+
+	/* Mark every page of the slab, such that kmem_cache_of() can find the
+	 * slab of any object.
+	 */
+	for (i = 0; i < ((size_t)1 << cache->order); ++i) {
+		page[i].pp_slab = 1;
+		page[i].pp_order = cache->order;
+	}
+
+	slab = page2kva(page);
+	slab->cache = cache;
+	slab->free = NULL;
+	slab->inuse = 0;
+
+	/* Link the objects last to first, such that they are handed out in
+	 * order of address. */
+	for (i = cache->nobjs; i-- > 0;) {
+		obj = (char *)slab + cache->obj_offset + i * cache->stride;
+
+		if (cache->ctor)
+			cache->ctor(obj);
+
+		*kmem_free_ptr(cache, obj) = slab->free;
+		slab->free = obj;
+	}
+
+	list_add(&cache->empty, &slab->node);
+	++cache->nslabs;
+	++cache->nempty;
+
+	return slab;
+}
+
+static void kmem_slab_destroy(struct kmem_cache *cache, struct kmem_slab *slab)
+{
+	struct page_info *page = pa2page(PADDR(slab));
+	size_t i;
+
+	list_del(&slab->node);
+	--cache->nslabs;
+	--cache->nempty;
+
+	for (i = 0; i < ((size_t)1 << cache->order); ++i) {
+		page[i].pp_slab = 0;
+		page[i].pp_order = i ? 0 : cache->order;
+	}
+
+	page_free(page);
+}
+
+/* Takes a free object from the slabs, preferring partially used slabs to keep
+ * the number of slabs in use low.
+ *
+ * Returns NULL if out of memory.
+ */
+static void *kmem_slab_alloc(struct kmem_cache *cache)
+{
+	struct kmem_slab *slab;
+	struct list *node;
+	void *obj;
+
+	node = list_head(&cache->partial);
+
+	if (!node) {
+		node = list_head(&cache->empty);
+
+		if (!node) {
+			if (!kmem_slab_create(cache))
+				return NULL;
+
+			node = list_head(&cache->empty);
+		}
+
+		--cache->nempty;
+	}
+
+	slab = container_of(node, struct kmem_slab, node);
+	obj = slab->free;
+	slab->free = *kmem_free_ptr(cache, obj);
+
+	list_del(&slab->node);
+
+	if (++slab->inuse == cache->nobjs)
+		list_add(&cache->full, &slab->node);
+	else
+		list_add(&cache->partial, &slab->node);
+
+	return obj;
+}
+
+/* Returns the object to its slab. Once the cache holds more than
+ * KMEM_MAX_EMPTY empty slabs, the slab is returned to the buddy allocator.
+ */
+static void kmem_slab_free(struct kmem_cache *cache, void *obj)
+{
+	struct kmem_slab *slab = kmem_slab_of(cache, obj);
+
+	assert(slab->cache == cache);
+	assert(slab->inuse > 0);
+
+	*kmem_free_ptr(cache, obj) = slab->free;
+	slab->free = obj;
+
+	list_del(&slab->node);
+
+	if (--slab->inuse > 0) {
+		list_add(&cache->partial, &slab->node);
+		return;
+	}
+
+	list_add(&cache->empty, &slab->node);
+
+	if (++cache->nempty > KMEM_MAX_EMPTY)
+		kmem_slab_destroy(cache, slab);
+}
+
+/* Allocates an object from the cache. Objects are taken from the cache of the
+ * current CPU, which is refilled from the slabs a batch at a time.
+ *
+ * Returns NULL if out of memory.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	struct kmem_cpu_cache *cpu = cache->cpu + this_cpu_id();
+	void *obj;
+
+	/* Refill the per-CPU cache with at most a slab worth of objects, such
+	 * that caches of large objects do not allocate multiple slabs at once.
+	 */
+	if (!cpu->count) {
+		spin_lock(&cache->lock);
+
+		while (cpu->count < MIN(KMEM_CPU_BATCH, cache->nobjs)) {
+			obj = kmem_slab_alloc(cache);
+
+			if (!obj)
+				break;
+
+			cpu->objs[cpu->count++] = obj;
+		}
+
+		spin_unlock(&cache->lock);
+
+		if (!cpu->count)
+			return NULL;
+	}
+
+	return cpu->objs[--cpu->count];
+}
+
+/* Returns the object to the cache of the current CPU. If that is full, the
+ * oldest batch of objects goes back to the slabs.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct kmem_cpu_cache *cpu = cache->cpu + this_cpu_id();
+	size_t i;
+
+	if (cpu->count == KMEM_CPU_OBJS) {
+		spin_lock(&cache->lock);
+
+		for (i = 0; i < KMEM_CPU_BATCH; ++i)
+			kmem_slab_free(cache, cpu->objs[i]);
+
+		spin_unlock(&cache->lock);
+
+		memmove(cpu->objs, cpu->objs + KMEM_CPU_BATCH,
+			(KMEM_CPU_OBJS - KMEM_CPU_BATCH) * sizeof *cpu->objs);
+		cpu->count -= KMEM_CPU_BATCH;
+	}
+
+	cpu->objs[cpu->count++] = obj;
+}
+
+/* Returns the objects held by the per-CPU caches to the slabs and the empty
+ * slabs to the buddy allocator. The other CPUs must not be using the cache
+ * meanwhile, as their per-CPU caches are emptied as well.
+ *
+ * Returns the number of pages returned to the buddy allocator.
+ */
+size_t kmem_cache_shrink(struct kmem_cache *cache)
+{
+	struct kmem_cpu_cache *cpu;
+	struct list *node;
+	size_t i, n = 0;
+
+	spin_lock(&cache->lock);
+
+	for (i = 0; i < NCPUS; ++i) {
+		cpu = cache->cpu + i;
+
+		while (cpu->count > 0)
+			kmem_slab_free(cache, cpu->objs[--cpu->count]);
+	}
+
+	while ((node = list_head(&cache->empty))) {
+		kmem_slab_destroy(cache,
+			container_of(node, struct kmem_slab, node));
+		n += (size_t)1 << cache->order;
+	}
+
+	spin_unlock(&cache->lock);
+
+	return n;
+}
+
+/* Looks up the cache the object was allocated from.
+ *
+ * Returns NULL if the object is not part of a slab.
+ */
+struct kmem_cache *kmem_cache_of(void *obj)
+{
+	struct page_info *page = pa2page(PADDR(obj));
+	struct kmem_slab *slab;
+
+	if (!page->pp_slab)
+		return NULL;
+
+	slab = ROUNDDOWN(obj, PAGE_SIZE << page->pp_order);
+
+	return slab->cache;
+}
+
+/* Destroys the cache. All objects must have been freed. */
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	kmem_cache_shrink(cache);
+
+	if (cache->nslabs)
+		panic("kmem_cache_destroy: %s still has objects in use",
+			cache->name);
+
+	spin_lock(&kmem_caches_lock);
+	list_del(&cache->node);
+	spin_unlock(&kmem_caches_lock);
+
+	kmem_cache_free(&kmem_cache_cache, cache);
+}
+
+/* Shows the number of objects and slabs of every cache. */
+void show_slab_info(void)
+{
+	struct kmem_cache *cache;
+	struct kmem_slab *slab;
+	struct list *node, *slab_node;
+	size_t i, nactive;
+
+	cprintf("Slab caches:\n");
+
+	list_foreach(&kmem_caches, node) {
+		cache = container_of(node, struct kmem_cache, node);
+		nactive = 0;
+
+		list_foreach(&cache->partial, slab_node) {
+			slab = container_of(slab_node, struct kmem_slab, node);
+			nactive += slab->inuse;
+		}
+
+		list_foreach(&cache->full, slab_node)
+			nactive += cache->nobjs;
+
+		for (i = 0; i < NCPUS; ++i)
+			nactive -= cache->cpu[i].count;
+
+		cprintf("  %-16s size=%u objs=%u/%u slabs=%u order=%u\n",
+			cache->name, cache->size, nactive,
+			cache->nslabs * cache->nobjs, cache->nslabs,
+			cache->order);
+	}
+}
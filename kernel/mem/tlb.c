@@ -0,0 +1,339 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/cpu.h>
+#include <kernel/cpufeature.h>
+#include <kernel/intr.h>
+#include <kernel/lapic.h>
+#include <kernel/mem.h>
+
+/*
+ * The TLB state of every CPU. active is the physical address of the PML4 the
+ * CPU uses, and pcids holds the PML4 the translations cached under every PCID
+ * belong to, or zero if the PCID is free. Other CPUs only ever clear the
+ * entries of pcids, once they change the page tables of that PML4.
+ */
+struct tlb_cpu {
+	volatile physaddr_t active;
+	volatile physaddr_t pcids[TLB_NPCIDS];
+	unsigned next;
+	volatile uint32_t pending;
+} __attribute__((aligned(64)));
+
+static struct tlb_cpu tlb_cpus[NCPUS];
+
+/* The batch of the CPU that is shooting down the TLBs of the other CPUs, and
+ * the number of CPUs that have not flushed their TLB yet. Only one CPU at a
+ * time sends shootdowns, which is what tlb_lock is for.
+ */
+static struct spinlock tlb_lock = SPINLOCK_INIT;
+static struct tlb_batch *volatile tlb_req;
+static volatile uint32_t tlb_npending;
+
+/* Applies the invalidations of the batch to the TLB of the CPU, if it is using
+ * the page tables. Everything shares the page tables of the kernel, so those
+ * are flushed everywhere. A full flush of the kernel page tables toggles
+ * CR4.PGE, which drops the global pages and the translations of all PCIDs.
+ */
+static void tlb_flush_local(struct tlb_cpu *cpu, struct tlb_batch *batch)
+{
+	uintptr_t cr4;
+	size_t i;
+
+	if (batch->pml4 != kernel_pml4 &&
+	    cpu->active != PADDR(batch->pml4))
+		return;
+
+	if (!batch->full) {
+		for (i = 0; i < batch->naddrs; ++i)
+			flush_page((void *)batch->addrs[i]);
+
+		return;
+	}
+
+	if (batch->pml4 == kernel_pml4) {
+		cr4 = read_cr4();
+		write_cr4(cr4 & ~CR4_PGE);
+		write_cr4(cr4);
+	} else {
+		/* Loading CR3 without CR3_NOFLUSH flushes the current PCID. */
+		write_cr3(read_cr3() & ~CR3_NOFLUSH);
+	}
+}
+
+/* Flushes the TLB of the CPU if another CPU asked for it. The APs spin with
+ * interrupts disabled, so they call this while waiting for work instead of
+ * relying on the IPI.
+ */
+void tlb_poll(unsigned cpu)
+{
+	struct tlb_cpu *tc = tlb_cpus + cpu;
+	uint64_t rflags;
+
+	if (!tc->pending)
+		return;
+
+	/* The IPI must not run the same request again halfway through. */
+	rflags = read_rflags();
+	cli();
+
+	if (tc->pending) {
+		tlb_flush_local(tc, tlb_req);
+		tc->pending = 0;
+		xadd(&tlb_npending, (uint32_t)-1);
+	}
+
+	if (rflags & FLAGS_IF)
+		sti();
+}
+
+static void tlb_intr(struct int_frame *frame)
+{
+	tlb_poll(this_cpu_id());
+	lapic_eoi();
+}
+
+/* Drops the PCID of the page tables on every CPU other than the current one,
+ * if that is using them, such that switching back to the page tables flushes
+ * the stale translations. Every compare and exchange is a full barrier, which
+ * orders the stores to the page tables before the loads of the PML4 of every
+ * CPU by the caller.
+ */
+static void tlb_drop_pcids(struct page_table *pml4, unsigned self)
+{
+	physaddr_t pa = PADDR(pml4), expected;
+	size_t i, j;
+
+	for (i = 0; i < ncpus; ++i) {
+		if (i == self && tlb_cpus[i].active == pa)
+			continue;
+
+		for (j = 0; j < TLB_NPCIDS; ++j) {
+			expected = pa;
+
+			if (tlb_cpus[i].pcids[j] == pa)
+				__atomic_compare_exchange_n(
+					&tlb_cpus[i].pcids[j], &expected, 0, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+		}
+	}
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Sends a single IPI to every other CPU that uses the page tables, and waits
+ * for all of them to apply the batch. While waiting for another CPU to finish
+ * its shootdown, we have to keep serving its requests, as it might be waiting
+ * for us.
+ */
+static void tlb_shootdown(struct tlb_batch *batch, unsigned self)
+{
+	physaddr_t pa = PADDR(batch->pml4);
+	uint64_t targets = 0;
+	uint32_t n = 0;
+	size_t i;
+
+	for (i = 0; i < ncpus; ++i) {
+		if (i != self && (batch->pml4 == kernel_pml4 ||
+		    tlb_cpus[i].active == pa)) {
+			targets |= (uint64_t)1 << i;
+			++n;
+		}
+	}
+
+	if (!n)
+		return;
+
+	while (!spin_trylock(&tlb_lock)) {
+		tlb_poll(self);
+		pause();
+	}
+
+	tlb_req = batch;
+	tlb_npending = n;
+
+	for (i = 0; i < ncpus; ++i) {
+		if (!(targets & ((uint64_t)1 << i)))
+			continue;
+
+		tlb_cpus[i].pending = 1;
+		lapic_ipi(cpus[i].lapic_id, INT_TLB_SHOOTDOWN);
+	}
+
+	while (tlb_npending)
+		pause();
+
+	spin_unlock(&tlb_lock);
+}
+
+/* Starts an empty batch of changes to the page tables of pml4. */
+void tlb_batch_init(struct tlb_batch *batch, struct page_table *pml4)
+{
+	batch->pml4 = pml4;
+	batch->naddrs = 0;
+	batch->full = 0;
+	batch->npages = 0;
+	page_list_init(&batch->tables);
+}
+
+/* Adds the page at va to the batch. As invlpg drops the translation of a huge
+ * page for any address inside it, huge pages only need a single entry.
+ */
+void tlb_batch_add(struct tlb_batch *batch, uintptr_t va)
+{
+	if (batch->full)
+		return;
+
+	if (batch->naddrs == TLB_BATCH_MAX) {
+		batch->full = 1;
+		return;
+	}
+
+	batch->addrs[batch->naddrs++] = va;
+}
+
+/* Makes the batch flush the entire TLB, which is needed when a table gets
+ * replaced, as its entries may be cached by the paging-structure caches.
+ */
+void tlb_batch_add_all(struct tlb_batch *batch)
+{
+	batch->full = 1;
+}
+
+/* Drops a reference to the page once the batch is flushed, as other CPUs may
+ * be accessing the page through their TLB until then.
+ */
+void tlb_batch_put(struct tlb_batch *batch, struct page_info *page)
+{
+	if (batch->npages == TLB_BATCH_MAX)
+		tlb_batch_flush(batch);
+
+	batch->pages[batch->npages++] = page;
+}
+
+/* Returns the page table to the pool of page-table pages once the batch is
+ * flushed, as other CPUs may still be walking it until then.
+ */
+void tlb_batch_put_table(struct tlb_batch *batch, struct page_info *page)
+{
+	page_list_add(&batch->tables, page);
+}
+
+/* Invalidates the translations of the batch on every CPU that may have them
+ * cached, drops the references to the pages of the batch, frees its page
+ * tables and empties it.
+ */
+void tlb_batch_flush(struct tlb_batch *batch)
+{
+	struct page_info *page;
+	unsigned self;
+	size_t i;
+
+	if (batch->naddrs || batch->full) {
+		self = this_cpu_id();
+
+		tlb_drop_pcids(batch->pml4, self);
+		tlb_flush_local(tlb_cpus + self, batch);
+		tlb_shootdown(batch, self);
+	}
+
+	for (i = 0; i < batch->npages; ++i)
+		page_put(batch->pages[i]);
+
+	while ((page = page_list_pop(&batch->tables)))
+		pt_free(page);
+
+	tlb_batch_init(batch, batch->pml4);
+}
+
+/* Drops the PCIDs of the page tables on every CPU, which must not be using
+ * them, before they get freed and the PML4 might be reused for other page
+ * tables.
+ */
+void tlb_forget(struct page_table *pml4)
+{
+	physaddr_t pa = PADDR(pml4);
+	size_t i;
+
+	for (i = 0; i < ncpus; ++i)
+		assert(tlb_cpus[i].active != pa);
+
+	tlb_drop_pcids(pml4, NCPUS);
+}
+
+/* Switches the current CPU to the page tables. If the CPU still has a PCID
+ * for them, the translations it has cached are kept. Otherwise, the least
+ * recently assigned PCID is reused and flushed.
+ *
+ * The CPU publishes the page tables as active before looking up the PCID,
+ * such that a CPU that changes them either sees it as a target of the
+ * shootdown or has already dropped the PCID.
+ */
+void pml4_switch(struct page_table *pml4)
+{
+	struct tlb_cpu *cpu = tlb_cpus + this_cpu_id();
+	physaddr_t pa = PADDR(pml4);
+	uint64_t rflags = read_rflags();
+	unsigned pcid;
+
+	cli();
+
+	cpu->active = pa;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!cpu_has(CPU_FEATURE_PCID)) {
+		write_cr3(pa);
+		goto out;
+	}
+
+	for (pcid = 0; pcid < TLB_NPCIDS; ++pcid) {
+		if (cpu->pcids[pcid] == pa)
+			break;
+	}
+
+	if (pcid < TLB_NPCIDS) {
+		write_cr3(pa | pcid | CR3_NOFLUSH);
+		goto out;
+	}
+
+	pcid = cpu->next;
+	cpu->next = (pcid + 1) % TLB_NPCIDS;
+	cpu->pcids[pcid] = pa;
+	write_cr3(pa | pcid);
+
+out:
+	if (rflags & FLAGS_IF)
+		sti();
+}
+
+/* Sets up the TLB state of the CPU, which has just loaded the kernel page
+ * tables with PCID 0, and enables PCIDs if the CPU supports them.
+ */
+void tlb_cpu_init(unsigned cpu)
+{
+	struct tlb_cpu *tc = tlb_cpus + cpu;
+	size_t i;
+
+	if (cpu_has(CPU_FEATURE_PCID))
+		write_cr4(read_cr4() | CR4_PCIDE);
+
+	for (i = 0; i < TLB_NPCIDS; ++i)
+		tc->pcids[i] = 0;
+
+	tc->active = PADDR(kernel_pml4);
+	tc->pcids[0] = tc->active;
+	tc->next = 1;
+	tc->pending = 0;
+}
+
+/* Sets up the TLB state of the boot CPU once it runs on the kernel page tables,
+ * and installs the handler of the shootdown IPI.
+ */
+void tlb_init(void)
+{
+	tlb_cpu_init(0);
+	intr_register(INT_TLB_SHOOTDOWN, tlb_intr);
+}
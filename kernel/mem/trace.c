@@ -0,0 +1,150 @@
+#include <types.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/mem.h>
+
+#ifdef MEM_TRACE
+struct mem_trace mem_traces[NCPUS];
+
+static const char *mem_trace_ops[MEM_TRACE_NOPS] = {
+	[MEM_TRACE_ALLOC] = "page_alloc",
+	[MEM_TRACE_FIND] = "buddy_find",
+	[MEM_TRACE_FREE] = "page_free",
+};
+
+/* Returns the histogram bucket for the number of cycles. */
+static size_t mem_trace_bucket(uint64_t cycles)
+{
+	size_t bucket = 0;
+
+	cycles >>= MEM_TRACE_MIN_SHIFT + 1;
+
+	while (cycles && bucket < MEM_TRACE_NBUCKETS - 1) {
+		cycles >>= 1;
+		++bucket;
+	}
+
+	return bucket;
+}
+
+/* Records the time spent in the operation since start, as returned by
+ * mem_trace_begin().
+ */
+void mem_trace_latency(unsigned op, size_t order, uint64_t start)
+{
+	struct mem_trace *trace = mem_traces + this_cpu_id();
+
+	if (order >= BUDDY_MAX_ORDER)
+		return;
+
+	++trace->latency[op][order][mem_trace_bucket(read_tsc() - start)];
+}
+
+/* Records a split through the given number of orders. */
+void mem_trace_split(size_t depth)
+{
+	++mem_traces[this_cpu_id()].split_depth[depth];
+}
+
+/* Records a merge through the given number of orders. */
+void mem_trace_merge(size_t depth)
+{
+	++mem_traces[this_cpu_id()].merge_depth[depth];
+}
+
+void mem_trace_failed(size_t order)
+{
+	if (order < BUDDY_MAX_ORDER)
+		++mem_traces[this_cpu_id()].failed[order];
+}
+
+/* Clears the buffers of all CPUs. */
+void mem_trace_reset(void)
+{
+	memset(mem_traces, 0, sizeof mem_traces);
+}
+
+/* Sums up the buffers of all CPUs into trace. Other CPUs may be recording
+ * meanwhile, so the counts are only approximate.
+ */
+static void mem_trace_sum(struct mem_trace *trace)
+{
+	const struct mem_trace *cpu;
+	size_t i, op, order, bucket;
+
+	memset(trace, 0, sizeof *trace);
+
+	for (i = 0; i < ncpus; ++i) {
+		cpu = mem_traces + i;
+
+		for (op = 0; op < MEM_TRACE_NOPS; ++op) {
+			for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+				for (bucket = 0; bucket < MEM_TRACE_NBUCKETS;
+				     ++bucket)
+					trace->latency[op][order][bucket] +=
+						cpu->latency[op][order][bucket];
+			}
+		}
+
+		for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+			trace->split_depth[order] += cpu->split_depth[order];
+			trace->merge_depth[order] += cpu->merge_depth[order];
+			trace->failed[order] += cpu->failed[order];
+		}
+	}
+}
+
+/* Shows the latency histograms of the orders that have been used, followed by
+ * the split and merge depths and the failed allocations.
+ */
+void show_mem_trace(void)
+{
+	static struct mem_trace trace;
+	size_t op, order, bucket, n;
+
+	mem_trace_sum(&trace);
+
+	cprintf("Latency in cycles, from <2^%u to >=2^%u:\n",
+		MEM_TRACE_MIN_SHIFT + 1,
+		MEM_TRACE_MIN_SHIFT + MEM_TRACE_NBUCKETS - 1);
+
+	for (op = 0; op < MEM_TRACE_NOPS; ++op) {
+		cprintf("  %s:\n", mem_trace_ops[op]);
+
+		for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+			for (bucket = 0, n = 0; bucket < MEM_TRACE_NBUCKETS;
+			     ++bucket)
+				n += trace.latency[op][order][bucket];
+
+			if (!n)
+				continue;
+
+			cprintf("    order %2u:", order);
+
+			for (bucket = 0; bucket < MEM_TRACE_NBUCKETS; ++bucket)
+				cprintf(" %u", trace.latency[op][order][bucket]);
+
+			cprintf("\n");
+		}
+	}
+
+	cprintf("Split and merge depths:\n");
+
+	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+		if (!trace.split_depth[order] && !trace.merge_depth[order])
+			continue;
+
+		cprintf("  %2u orders: split %u merge %u\n", order,
+			trace.split_depth[order], trace.merge_depth[order]);
+	}
+
+	cprintf("Failed allocations:\n");
+
+	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+		if (trace.failed[order])
+			cprintf("  order %2u: %lu\n", order,
+				trace.failed[order]);
+	}
+}
+#endif
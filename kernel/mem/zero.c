@@ -0,0 +1,189 @@
+#include <types.h>
+#include <paging.h>
+#include <string.h>
+
+#include <kernel/mem.h>
+
+/* The number of chunks each pool tries to keep around. */
+#define ZERO_POOL_4K_TARGET 64
+#define ZERO_POOL_2M_TARGET 1
+
+#define ZERO_NPOOLS 2
+
+static struct zero_pool zero_pools[ZERO_NPOOLS];
+
+static struct zero_pool *zero_pool_get(size_t order)
+{
+	switch (order) {
+	case BUDDY_4K_PAGE: return zero_pools + 0;
+	case BUDDY_2M_PAGE: return zero_pools + 1;
+	default: return NULL;
+	}
+}
+
+/* Sets up the pools of zeroed pages. The pools start out empty. */
+void zero_pool_init(void)
+{
+	struct zero_pool *pool;
+	size_t i;
+
+	for (i = 0; i < ZERO_NPOOLS; ++i) {
+		pool = zero_pools + i;
+		spin_init(&pool->lock);
+		spin_init(&pool->fill_lock);
+		page_list_init(&pool->free_list);
+		pool->count = 0;
+		pool->pending = NULL;
+		pool->pending_done = 0;
+	}
+
+	zero_pools[0].order = BUDDY_4K_PAGE;
+	zero_pools[0].target = ZERO_POOL_4K_TARGET;
+	zero_pools[1].order = BUDDY_2M_PAGE;
+	zero_pools[1].target = ZERO_POOL_2M_TARGET;
+}
+
+/* Takes a zeroed page of the given order from the pool.
+ *
+ * Returns NULL if the pool is empty or if there is no pool for that order.
+ */
+struct page_info *zero_pool_alloc(size_t order)
+{
+	struct zero_pool *pool = zero_pool_get(order);
+	struct page_info *page;
+
+	if (!pool || !pool->count)
+		return NULL;
+
+	spin_lock(&pool->lock);
+	page = page_list_pop(&pool->free_list);
+
+	if (page)
+		--pool->count;
+
+	spin_unlock(&pool->lock);
+
+	/* The page is about to be written to by its new owner. */
+	if (page)
+		page->pp_zero = 0;
+
+	return page;
+}
+
+/* Clears up to budget order 0 pages worth of memory of the pending chunk of
+ * the pool, taking a new chunk from the buddy allocator if there is none. The
+ * pages are cleared with non-temporal stores, as they may sit in the pool for a
+ * while.
+ * Huge pages are cleared in multiple steps, such that a single call never
+ * takes much longer than clearing budget pages. If another CPU is already
+ * clearing pages for the pool, this does nothing.
+ *
+ * Returns the number of pages cleared.
+ */
+static size_t zero_pool_fill(struct zero_pool *pool, size_t budget)
+{
+	struct page_info *page;
+	size_t n;
+
+	if (!spin_trylock(&pool->fill_lock))
+		return 0;
+
+	if (!pool->pending) {
+		if (pool->count >= pool->target) {
+			spin_unlock(&pool->fill_lock);
+			return 0;
+		}
+
+		pool->pending = buddy_find(pool->order);
+		pool->pending_done = 0;
+
+		if (!pool->pending) {
+			spin_unlock(&pool->fill_lock);
+			return 0;
+		}
+	}
+
+	page = pool->pending;
+	n = MIN(budget, ((size_t)1 << pool->order) - pool->pending_done);
+	memset_nt((char *)page2kva(page) + pool->pending_done * PAGE_SIZE, 0,
+		n * PAGE_SIZE);
+	pool->pending_done += n;
+
+	if (pool->pending_done == ((size_t)1 << pool->order)) {
+		page->pp_zero = 1;
+		pool->pending = NULL;
+
+		spin_lock(&pool->lock);
+		page_list_add(&pool->free_list, page);
+		++pool->count;
+		spin_unlock(&pool->lock);
+	}
+
+	spin_unlock(&pool->fill_lock);
+
+	return n;
+}
+
+/* Idle-time hook that clears up to budget order 0 pages worth of memory to
+ * refill the pools. The pool of order 0 pages is refilled first, as these are
+ * allocated most often.
+ *
+ * Returns the number of pages cleared.
+ */
+size_t zero_pool_refill(size_t budget)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < ZERO_NPOOLS && n < budget; ++i)
+		n += zero_pool_fill(zero_pools + i, budget - n);
+
+	return n;
+}
+
+/* Returns all zeroed pages, including partially cleared chunks, to the buddy
+ * allocator. Call this when the buddy allocator runs out of memory.
+ *
+ * Returns the number of order 0 pages returned to the buddy allocator.
+ */
+size_t zero_pool_drain(void)
+{
+	struct zero_pool *pool;
+	struct page_info *page;
+	size_t i, n = 0;
+
+	for (i = 0; i < ZERO_NPOOLS; ++i) {
+		pool = zero_pools + i;
+		spin_lock(&pool->fill_lock);
+		spin_lock(&pool->lock);
+
+		while ((page = page_list_pop(&pool->free_list))) {
+			--pool->count;
+			page->pp_zero = 0;
+			buddy_merge(page);
+			n += (size_t)1 << pool->order;
+		}
+
+		spin_unlock(&pool->lock);
+
+		if (pool->pending) {
+			buddy_merge(pool->pending);
+			n += (size_t)1 << pool->order;
+			pool->pending = NULL;
+		}
+
+		spin_unlock(&pool->fill_lock);
+	}
+
+	return n;
+}
+
+/* Gets the total amount of order 0 pages held by the pools. */
+size_t count_zeroed_pages(void)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < ZERO_NPOOLS; ++i)
+		n += zero_pools[i].count << zero_pools[i].order;
+
+	return n;
+}
@@ -8,10 +8,15 @@
 #include <assert.h>
 
 #include <x86-64/asm.h>
+#include <x86-64/idt.h>
 
 #include <kernel/console.h>
+#include <kernel/klog.h>
 #include <kernel/monitor.h>
+#include <kernel/ksym.h>
 #include <kernel/mem.h>
+#include <kernel/profile.h>
+#include <kernel/smp.h>
 
 #define CMDBUF_SIZE 80  /* enough for one VGA text line */
 
@@ -28,10 +33,33 @@ static struct command commands[] = {
 	{ "backtrace", "Display stack backtrace", mon_backtrace },
 	{ "buddyinfo", "Display debugging information for the buddy allocator", mon_buddyinfo },
 	{ "pageinfo", "Display page information for a given page index", mon_pageinfo },
+	{ "slabinfo", "Display the caches of the slab allocator", mon_slabinfo },
+	{ "compact", "Compact memory to recover huge pages", mon_compact },
+	{ "dmesg", "Display the kernel log, optionally up to a level: err, warn, info or debug", mon_dmesg },
+	{ "profile", "Sample the RIP on every timer tick: start [-g], stop or dump [raw]", mon_profile },
+	{ "batch", "Run the script that follows up to a line with a single '.', without echo", mon_batch },
+#ifdef MEM_TRACE
+	{ "memtrace", "Display the allocator trace, or clear it with reset", mon_memtrace },
+#endif
 };
 
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
+/* The commands sorted by name, as runcmd() looks them up with a binary search.
+ * commands[] stays in the order help lists them in.
+ */
+static struct command *sorted_commands[NCOMMANDS];
+
+/* The size of the largest script batch mode accepts. */
+#define BATCH_SIZE 8192
+
+/* Set while running a script, such that commands print compact records
+ * instead of output meant for humans.
+ */
+static int mon_batch_mode;
+
+static int runcmd(char *buf, struct int_frame *frame);
+
 /***** Implementations of basic kernel monitor commands *****/
 
 int mon_help(int argc, char **argv, struct int_frame *frame)
@@ -58,27 +86,65 @@ int mon_kerninfo(int argc, char **argv, struct int_frame *frame)
 	return 0;
 }
 
+/* Returns whether rbp points to a stack frame that can be read, that is, into
+ * the memory mapped by the boot stub or into the kernel stack of an AP.
+ */
+static int stack_frame_valid(uintptr_t *rbp)
+{
+	uintptr_t lo = (uintptr_t)rbp, hi = (uintptr_t)(rbp + 2), top;
+	size_t cpu;
+
+	if (lo & (sizeof *rbp - 1))
+		return 0;
+
+	if (lo >= KERNEL_VMA && hi <= KERNEL_VMA + boot_map_lim)
+		return 1;
+
+	for (cpu = 1; cpu < ncpus; ++cpu) {
+		top = cpu_kstack_top(cpu);
+
+		if (lo >= top - KSTACK_SIZE && hi <= top)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Follows the chain of frame pointers starting at rbp, like mon_backtrace(),
+ * and stores up to n return addresses in rips. This is safe to call from an
+ * interrupt handler on the frame pointer of the interrupted code.
+ *
+ * Returns the number of return addresses stored.
+ */
+size_t walk_stack(uintptr_t *rbp, uintptr_t *rips, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n && stack_frame_valid(rbp); ++i) {
+		rips[i] = rbp[1];
+		rbp = (uintptr_t *)rbp[0];
+	}
+
+	return i;
+}
+
 int mon_backtrace(int argc, char **argv, struct int_frame *frame)
 {
-	int i;
-	uintptr_t *rbp = read_rbp();
+	uintptr_t *rbp = frame ? (uintptr_t *)frame->rbp : read_rbp();
+
 	cprintf("Stack backtrace:\n");
-	while (rbp) {
+
+	if (frame) {
+		cprintf("  RIP: %016p  ", frame->rip);
+		print_ksym(frame->rip);
+		cprintf("\n");
+	}
+
+	while (stack_frame_valid(rbp)) {
 		uintptr_t rip = *(rbp + 1);
-		//struct rip_debuginfo info;
-		uintptr_t *args = rbp + 2;
-		size_t nargs;
-
-		cprintf("  RIP: %016p ", rip);
-
-		/* TODO: implement support for DWARF. */
-		cprintf("<no debug info>\t");
-		nargs = 6;
-		cprintf("  RBP: %016p ", rbp);
-		if (nargs)
-			cprintf("  args ");
-		for (i = 0; i < nargs; i++)
-			cprintf("%016p ", args[i]);
+
+		cprintf("  RIP: %016p  RBP: %016p  ", rip, rbp);
+		print_ksym(rip);
 		cprintf("\n");
 		rbp = (uintptr_t *)*rbp;
 	}
@@ -87,7 +153,29 @@ int mon_backtrace(int argc, char **argv, struct int_frame *frame)
 
 int mon_buddyinfo(int argc, char **argv, struct int_frame *frame)
 {
-	show_buddy_info();
+	struct buddy_stats stats;
+	size_t nblocks[MIGRATE_TYPES];
+	size_t order;
+
+	if (!mon_batch_mode) {
+		show_buddy_info();
+		return 0;
+	}
+
+	/* The free pages of every order, then the cached, zeroed and page table
+	 * pages, then the pageblocks of every migrate type.
+	 */
+	buddy_get_stats(&stats);
+	count_pageblocks(nblocks);
+	cprintf("buddy");
+
+	for (order = 0; order < BUDDY_MAX_ORDER; ++order)
+		cprintf(" %u", stats.nfree[order]);
+
+	cprintf(" %u %u %u %u %u %u\n", count_cached_pages(),
+		count_zeroed_pages(), count_pt_pool_pages(),
+		nblocks[MIGRATE_UNMOVABLE], nblocks[MIGRATE_RECLAIMABLE],
+		nblocks[MIGRATE_MOVABLE]);
 
 	return 0;
 }
@@ -127,32 +215,226 @@ int mon_pageinfo(int argc, char **argv, struct int_frame *frame)
 		return 0;
 	}
 
+	if (idx >= npages_init) {
+		cprintf("error: page %u has not been initialized yet.\n", idx);
+		return 0;
+	}
+
+	if (mon_batch_mode) {
+		cprintf("page %u %p %s %u %u %u\n", idx, page2pa(page),
+			page->pp_free ? "free" : "used", page->pp_ref,
+			page->pp_order, page->pp_node);
+		return 0;
+	}
+
 	cprintf("  Page index: %u\n", idx);
 	cprintf("  Physical address: %p\n", page2pa(page));
 	cprintf("  State: %s\n", page->pp_free ? "free" : "used");
 	cprintf("  References: %u\n", page->pp_ref);
 	cprintf("  Order: %u\n", page->pp_order);
+	cprintf("  Node: %u\n", page->pp_node);
+
+	return 0;
+}
+
+int mon_slabinfo(int argc, char **argv, struct int_frame *frame)
+{
+	show_slab_info();
+
+	return 0;
+}
+
+int mon_compact(int argc, char **argv, struct int_frame *frame)
+{
+	cprintf("Recovered %u huge pages\n", compact_memory(BUDDY_MAX_ORDER));
+
+	return 0;
+}
+
+int mon_dmesg(int argc, char **argv, struct int_frame *frame)
+{
+	int level = KLOG_NLEVELS - 1;
+
+	if (argc > 1 && (level = klog_parse_level(argv[1])) < 0) {
+		cprintf("Usage: dmesg [err|warn|info|debug]\n");
+		return 0;
+	}
+
+	klog_dump(level);
+
+	return 0;
+}
+
+int mon_profile(int argc, char **argv, struct int_frame *frame)
+{
+	if (argc > 1 && strcmp(argv[1], "start") == 0) {
+		profile_start(argc > 2 && strcmp(argv[2], "-g") == 0);
+	} else if (argc > 1 && strcmp(argv[1], "stop") == 0) {
+		profile_stop();
+	} else if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+		profile_dump(argc > 2 && strcmp(argv[2], "raw") == 0);
+	} else {
+		cprintf("Usage: profile start [-g] | stop | dump [raw]\n");
+	}
 
 	return 0;
 }
 
+#ifdef MEM_TRACE
+int mon_memtrace(int argc, char **argv, struct int_frame *frame)
+{
+	if (argc > 1 && strcmp(argv[1], "reset") == 0)
+		mem_trace_reset();
+	else
+		show_mem_trace();
+
+	return 0;
+}
+#endif
+
+/* Reads the script up to the line holding a single '.' into buf, without
+ * echoing it, and runs it one line at a time. Every line ends with a record
+ * "= <line> <status>" after its output, such that whatever drives the monitor
+ * over the serial port can tell where the output of every command ends.
+ */
+int mon_batch(int argc, char **argv, struct int_frame *frame)
+{
+	static char buf[BATCH_SIZE];
+	size_t n = 0, bol = 0, line;
+	char *p, *next;
+	int c, prev = 0, first = 0, ret = 0;
+
+	if (mon_batch_mode) {
+		cprintf("error: batch does not nest\n");
+		return 0;
+	}
+
+	while (1) {
+		c = getchar();
+
+		if (c < 0) {
+			cprintf("read error: %e\n", c);
+			return 0;
+		}
+
+		/* A serial terminal may end lines with "\r\n". */
+		if (c == '\n' && prev == '\r') {
+			prev = c;
+			continue;
+		}
+
+		prev = c;
+
+		if (c == '\r')
+			c = '\n';
+
+		/* The terminator is tracked outside buf, as the line may not
+		 * have been stored.
+		 */
+		if (c == '\n') {
+			if (n - bol == 1 && first == '.')
+				break;
+
+			bol = n + 1;
+		} else if (n == bol) {
+			first = c;
+		}
+
+		/* Keep consuming an oversized script up to its end. */
+		if (n < sizeof buf - 1)
+			buf[n] = c;
+
+		++n;
+	}
+
+	if (n >= sizeof buf - 1) {
+		cprintf("error: script exceeds %u bytes\n", BATCH_SIZE);
+		return 0;
+	}
+
+	buf[bol] = '\0';
+	mon_batch_mode = 1;
+
+	for (p = buf, line = 1; *p && ret >= 0; p = next, ++line) {
+		next = strchr(p, '\n');
+
+		if (next)
+			*next++ = '\0';
+		else
+			next = p + strlen(p);
+
+		ret = runcmd(p, frame);
+		cprintf("= %u %d\n", line, ret);
+	}
+
+	mon_batch_mode = 0;
+	cprintf("= end\n");
+
+	return ret;
+}
+
 /***** Kernel monitor command interpreter *****/
 
-#define WHITESPACE "\t\r\n "
 #define MAXARGS 16
 
+static inline int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Returns the command with the name, or NULL if there is none. */
+static struct command *find_command(const char *name)
+{
+	size_t lo = 0, hi = NCOMMANDS, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = strcmp(name, sorted_commands[mid]->name);
+
+		if (cmp == 0)
+			return sorted_commands[mid];
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* Fills sorted_commands with an insertion sort, which is plenty for a dozen
+ * commands.
+ */
+static void sort_commands(void)
+{
+	struct command *cmd;
+	size_t i, j;
+
+	for (i = 0; i < NCOMMANDS; ++i) {
+		cmd = commands + i;
+
+		for (j = i; j > 0 &&
+		     strcmp(sorted_commands[j - 1]->name, cmd->name) > 0; --j)
+			sorted_commands[j] = sorted_commands[j - 1];
+
+		sorted_commands[j] = cmd;
+	}
+}
+
 static int runcmd(char *buf, struct int_frame *frame)
 {
 	int argc;
 	char *argv[MAXARGS];
-	int i;
+	struct command *cmd;
 
 	/* Parse the command buffer into whitespace-separated arguments */
 	argc = 0;
 	argv[argc] = 0;
 	while (1) {
 		/* gobble whitespace */
-		while (*buf && strchr(WHITESPACE, *buf))
+		while (is_space(*buf))
 			*buf++ = 0;
 		if (*buf == 0)
 			break;
@@ -163,7 +445,7 @@ static int runcmd(char *buf, struct int_frame *frame)
 			return 0;
 		}
 		argv[argc++] = buf;
-		while (*buf && !strchr(WHITESPACE, *buf))
+		while (*buf && !is_space(*buf))
 			buf++;
 	}
 	argv[argc] = 0;
@@ -171,10 +453,8 @@ static int runcmd(char *buf, struct int_frame *frame)
 	/* Lookup and invoke the command */
 	if (argc == 0)
 		return 0;
-	for (i = 0; i < NCOMMANDS; i++) {
-		if (strcmp(argv[0], commands[i].name) == 0)
-			return commands[i].func(argc, argv, frame);
-	}
+	if ((cmd = find_command(argv[0])))
+		return cmd->func(argc, argv, frame);
 	cprintf("Unknown command '%s'\n", argv[0]);
 	return 0;
 }
@@ -183,6 +463,9 @@ void monitor(struct int_frame *frame)
 {
 	char *buf;
 
+	if (!sorted_commands[0])
+		sort_commands();
+
 	cprintf("Welcome to the OpenLSD kernel monitor!\n");
 	cprintf("Type 'help' for a list of commands.\n");
 
@@ -1,24 +1,18 @@
 /*
- * Simple implementation of cprintf console output for the kernel, based on
- * printfmt() and the kernel console's cputchar().
+ * Simple implementation of cprintf console output for the kernel. Messages
+ * go through the kernel log at the info level, which writes them to the
+ * console.
  */
 
 #include <types.h>
 #include <stdio.h>
 #include <stdarg.h>
 
-static void putch(int ch, int *cnt)
-{
-	cputchar(ch);
-	*cnt++;
-}
+#include <kernel/klog.h>
 
 int vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
-
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+	return vklog(KLOG_INFO, fmt, ap);
 }
 
 int cprintf(const char *fmt, ...)
@@ -0,0 +1,172 @@
+#include <types.h>
+#include <pic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+#include <x86-64/idt.h>
+
+#include <kernel/intr.h>
+#include <kernel/ksym.h>
+#include <kernel/mem.h>
+#include <kernel/monitor.h>
+#include <kernel/pic.h>
+#include <kernel/profile.h>
+#include <kernel/time.h>
+
+/*
+ * A sampling profiler. Every tick of the PIT records the RIP of the interrupted
+ * code, and optionally its callers, into a ring that keeps the most recent
+ * PROFILE_NSAMPLES samples. The hot spots are symbolized with the symbol
+ * table built into the kernel. The raw samples are printed in hex, such that
+ * they can be symbolized in more detail on the host, e.g.:
+ *
+ *   grep ^PROFILE jos.out | cut -d' ' -f2- | tr ' ' '\n' |
+ *     addr2line -f -e obj/kernel/kernel
+ */
+static struct profile_sample profile_ring[PROFILE_NSAMPLES];
+static size_t profile_nsamples;
+static int profile_callchain;
+static int profile_running;
+
+static void profile_tick(struct int_frame *frame)
+{
+	struct profile_sample *sample;
+	size_t n = 0;
+
+	sample = profile_ring + profile_nsamples++ % PROFILE_NSAMPLES;
+	sample->rip = frame->rip;
+
+	if (profile_callchain)
+		n = walk_stack((uintptr_t *)frame->rbp, sample->callers,
+			PROFILE_DEPTH);
+
+	if (n < PROFILE_DEPTH)
+		sample->callers[n] = 0;
+}
+
+/* Clears the ring and starts taking samples, with call stacks if callchain is
+ * set. Interrupts stay enabled until profile_stop().
+ */
+void profile_start(int callchain)
+{
+	cli();
+	profile_nsamples = 0;
+	profile_callchain = callchain;
+	profile_running = 1;
+
+	intr_register(IRQ_TIMER, profile_tick);
+	pit_start_periodic(PROFILE_HZ);
+	pic_enable_irq(IRQ_TIMER - IRQ_OFFSET);
+	sti();
+}
+
+void profile_stop(void)
+{
+	cli();
+	pic_disable_irq(IRQ_TIMER - IRQ_OFFSET);
+	intr_register(IRQ_TIMER, NULL);
+	profile_running = 0;
+}
+
+/* Sorts the addresses in ascending order. */
+static void profile_sort(uintptr_t *rips, size_t n)
+{
+	size_t gap, i, j;
+	uintptr_t rip;
+
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < n; ++i) {
+			rip = rips[i];
+
+			for (j = i; j >= gap && rips[j - gap] > rip; j -= gap)
+				rips[j] = rips[j - gap];
+
+			rips[j] = rip;
+		}
+	}
+}
+
+/* Shows the addresses that were sampled most often. */
+static void profile_show_top(size_t n)
+{
+	uintptr_t *rips, rip;
+	size_t i, j, k, count, best, best_count;
+
+	rips = kmalloc(n * sizeof *rips, 0);
+
+	if (!rips) {
+		cprintf("profile: out of memory\n");
+		return;
+	}
+
+	for (i = 0; i < n; ++i)
+		rips[i] = profile_ring[i].rip;
+
+	profile_sort(rips, n);
+	cprintf("Samples   %%  RIP\n");
+
+	/* Pick the longest run of equal addresses and clear it, until we have
+	 * shown enough of them.
+	 */
+	for (k = 0; k < PROFILE_NTOP; ++k) {
+		best = n;
+		best_count = 0;
+
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n && rips[j] == rips[i]; ++j)
+				;
+
+			count = rips[i] ? j - i : 0;
+
+			if (count > best_count) {
+				best = i;
+				best_count = count;
+			}
+		}
+
+		if (!best_count)
+			break;
+
+		rip = rips[best];
+		cprintf("%7u %3u  %016p  ", best_count, best_count * 100 / n,
+			rip);
+		print_ksym(rip);
+		cprintf("\n");
+
+		for (i = best; i < n && rips[i] == rip; ++i)
+			rips[i] = 0;
+	}
+
+	kfree(rips);
+}
+
+/* Shows the hot spots, or every sample with its call stack if raw is set. */
+void profile_dump(int raw)
+{
+	struct profile_sample *sample;
+	size_t i, j, n = MIN(profile_nsamples, PROFILE_NSAMPLES);
+
+	if (profile_running)
+		profile_stop();
+
+	cprintf("profile: %u samples, %u kept\n", profile_nsamples, n);
+
+	if (!n)
+		return;
+
+	if (!raw) {
+		profile_show_top(n);
+		return;
+	}
+
+	for (i = 0; i < n; ++i) {
+		sample = profile_ring + i;
+		cprintf("PROFILE %p", sample->rip);
+
+		for (j = 0; j < PROFILE_DEPTH && sample->callers[j]; ++j)
+			cprintf(" %p", sample->callers[j]);
+
+		cprintf("\n");
+	}
+}
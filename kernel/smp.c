@@ -0,0 +1,219 @@
+#include <types.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/acpi.h>
+#include <kernel/intr.h>
+#include <kernel/klog.h>
+#include <kernel/kwork.h>
+#include <kernel/lapic.h>
+#include <kernel/mem.h>
+#include <kernel/smp.h>
+#include <kernel/time.h>
+
+struct cpuinfo cpus[NCPUS];
+size_t ncpus = 1;
+
+/* The page tables, stack and index of the AP that is being started, picked up
+ * by the trampoline in mpentry.S once it reaches long mode.
+ */
+physaddr_t mpentry_cr3;
+void *mpentry_stack;
+unsigned mpentry_cpu;
+
+/* The work handed to the APs by smp_run(). Every time smp_gen changes, the
+ * APs run smp_fn and bump smp_done once they are done.
+ */
+static void (*volatile smp_fn)(unsigned cpu, void *arg);
+static void *volatile smp_arg;
+static volatile uint32_t smp_gen;
+static volatile uint32_t smp_done;
+
+/* Sets up the per-CPU data area of the CPU, and points the GS base of the CPU
+ * we are running on at it. This has to run on every CPU before anything that
+ * looks at this_cpu().
+ */
+void cpu_init(unsigned cpu)
+{
+	struct cpuinfo *info = cpus + cpu;
+
+	info->self = info;
+	info->cpu_id = cpu;
+	info->cache = page_caches + cpu;
+	info->log = klog_rings + cpu;
+	write_msr(MSR_GS_BASE, (uintptr_t)info);
+}
+
+/* Called by mpentry.S on every AP. The AP runs the work handed to it through
+ * smp_run() and the work it finds in the kwork queues, and halts when there is
+ * none.
+ */
+void mp_main(unsigned cpu)
+{
+	uint32_t gen = smp_gen;
+	int ran;
+
+	cpu_init(cpu);
+
+	/* mpentry.S only loaded the kernel page tables, so finish setting up
+	 * paging the way the boot CPU did.
+	 */
+	direct_map_load();
+	tlb_cpu_init(cpu);
+	idt_load();
+	lapic_cpu_init();
+	cpus[cpu].started = 1;
+
+	/* Interrupts are only enabled while running kwork, which may take
+	 * locks other CPUs hold while shooting down TLBs, and while halted.
+	 * Otherwise, shootdowns are picked up by polling.
+	 */
+	for (;;) {
+		if (smp_gen != gen) {
+			gen = smp_gen;
+			smp_fn(cpu, smp_arg);
+			xadd(&smp_done, 1);
+			continue;
+		}
+
+		tlb_poll(cpu);
+
+		sti();
+		ran = kwork_run();
+		cli();
+
+		if (!ran)
+			kwork_idle(&smp_gen, gen);
+	}
+}
+
+/* Starts the AP with the given APIC ID as CPU ncpus.
+ *
+ * Returns whether the AP came up.
+ */
+static int smp_start_ap(unsigned apic_id)
+{
+	struct cpuinfo *cpu = cpus + ncpus;
+	uintptr_t top = cpu_kstack_top(ncpus);
+	size_t i;
+
+	cpu->cpu_id = ncpus;
+	cpu->lapic_id = apic_id;
+	cpu->started = 0;
+
+	boot_map_region(kernel_pml4, top - KSTACK_SIZE, KSTACK_SIZE,
+		PADDR(boot_alloc(KSTACK_SIZE)), PAGE_WRITE | PAGE_GLOBAL);
+
+	mpentry_cr3 = PADDR(kernel_pml4);
+	mpentry_stack = (void *)top;
+	mpentry_cpu = ncpus;
+
+	lapic_start_ap(apic_id, MPENTRY_PADDR);
+
+	/* Give the AP up to 100 ms to show up. */
+	for (i = 0; i < 1000 && !cpu->started; ++i)
+		udelay(100);
+
+	return cpu->started;
+}
+
+/* Finds the CPUs in the MADT and starts the APs. The kernel stacks of the APs
+ * come from boot_alloc(), so this has to run before page_init().
+ */
+void smp_init(void)
+{
+	extern char mpentry_start[], mpentry_end[];
+	struct acpi_madt *madt;
+	struct acpi_madt_entry *entry;
+	struct acpi_madt_lapic *lapic_entry;
+	physaddr_t lapic_addr;
+	char *p, *end;
+	unsigned bsp_id;
+
+	cpus[0].cpu_id = 0;
+	cpus[0].started = 1;
+	ncpus = 1;
+
+	/* The APs start taking work as soon as they are up. */
+	kwork_init();
+
+	acpi_init();
+	madt = acpi_find_table("APIC");
+
+	if (!madt) {
+		cprintf("SMP: no MADT, only using the boot CPU\n");
+		return;
+	}
+
+	lapic_addr = madt->lapic_addr;
+	p = (char *)madt->entries;
+	end = (char *)madt + madt->hdr.len;
+
+	for (; p + sizeof *entry <= end && ((struct acpi_madt_entry *)p)->len;
+	     p += ((struct acpi_madt_entry *)p)->len) {
+		entry = (struct acpi_madt_entry *)p;
+
+		if (entry->type == ACPI_MADT_LAPIC_ADDR)
+			lapic_addr = ((struct acpi_madt_lapic_addr *)entry)->addr;
+	}
+
+	lapic_init(lapic_addr);
+	bsp_id = lapic_id();
+	cpus[0].lapic_id = bsp_id;
+
+	/* Copy the trampoline to a page below 1 MiB for the APs to start in. */
+	memcpy((void *)(KERNEL_VMA + MPENTRY_PADDR), mpentry_start,
+		mpentry_end - mpentry_start);
+
+	for (p = (char *)madt->entries;
+	     p + sizeof *entry <= end && ((struct acpi_madt_entry *)p)->len;
+	     p += ((struct acpi_madt_entry *)p)->len) {
+		entry = (struct acpi_madt_entry *)p;
+
+		if (entry->type != ACPI_MADT_LAPIC)
+			continue;
+
+		lapic_entry = (struct acpi_madt_lapic *)entry;
+
+		if (!(lapic_entry->flags & ACPI_MADT_LAPIC_ENABLED) ||
+		    lapic_entry->apic_id == bsp_id)
+			continue;
+
+		if (ncpus == NCPUS) {
+			cprintf("SMP: ignoring CPUs beyond %u\n", NCPUS);
+			break;
+		}
+
+		if (smp_start_ap(lapic_entry->apic_id))
+			++ncpus;
+		else
+			cprintf("SMP: APIC %u did not start\n",
+				lapic_entry->apic_id);
+	}
+
+	cprintf("SMP: %u CPU(s) online\n", ncpus);
+}
+
+/* Runs fn on every CPU, including the boot CPU, and waits for all of them to
+ * finish. Every CPU gets its own index, such that fn can split up the work.
+ * This may only be called from the boot CPU.
+ */
+void smp_run(void (*fn)(unsigned cpu, void *arg), void *arg)
+{
+	smp_fn = fn;
+	smp_arg = arg;
+	smp_done = 0;
+
+	/* The APs pick up the work once the generation changes. */
+	xadd(&smp_gen, 1);
+	kwork_wake_all();
+
+	fn(0, arg);
+
+	while (smp_done < ncpus - 1) {
+		tlb_poll(0);
+		pause();
+	}
+}
@@ -0,0 +1,28 @@
+#include <types.h>
+#include <assert.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/static_call.h>
+
+/* Points the jump of the trampoline at func. The kernel text is mapped
+ * writable, so the displacement is simply overwritten.
+ */
+void static_call_patch(void *tramp, void *func)
+{
+	uint8_t *insn = tramp;
+	int64_t disp = (uintptr_t)func - (uintptr_t)(insn + 5);
+	size_t i;
+
+	assert(insn[0] == STATIC_CALL_JMP);
+	assert(disp == (int32_t)disp);
+
+	/* memcpy() may be the static call that is being updated. */
+	for (i = 0; i < sizeof(int32_t); ++i)
+		((volatile uint8_t *)insn)[1 + i] = (uint64_t)disp >> (8 * i);
+
+	/* Serialize, such that the CPU does not run the jump it fetched before
+	 * it got modified.
+	 */
+	cpuid(0, NULL, NULL, NULL, NULL);
+}
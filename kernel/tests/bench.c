@@ -0,0 +1,339 @@
+#include <types.h>
+#include <assert.h>
+#include <paging.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/mem.h>
+#include <kernel/time.h>
+#include <kernel/tests.h>
+
+/*
+ * Microbenchmarks for the memory subsystem. Every benchmark prints a single
+ * line of the form
+ *
+ *   BENCH name=<name> ops=<n> cycles_per_op=<cycles>
+ *
+ * which is picked up by bench-lab1 through gradelib.py. The name is unique
+ * within a run, such that the results of two runs can be compared.
+ */
+
+/* The number of pages allocated by the page benchmarks at order 0, and the
+ * number of times every per-order benchmark allocates and frees a chunk.
+ */
+#define BENCH_NPAGES 4096
+#define BENCH_NREPS 1024
+
+/* The number of nodes in the rb-tree benchmarks. */
+#define BENCH_NNODES 4096
+
+/* The chunk the memory bandwidth benchmarks copy to and from. */
+#define BENCH_BUF_ORDER BUDDY_2M_PAGE
+
+/* The number of allocations of the mixed benchmark, one in BENCH_HUGE_RATIO of
+ * which is a huge page.
+ */
+#define BENCH_MIX_NPAGES 512
+#define BENCH_HUGE_RATIO 32
+
+struct bench_node {
+	struct rb_node node;
+	uint64_t key;
+};
+
+static struct page_info *bench_pages[BENCH_NPAGES];
+static uint64_t bench_seed = 0x9E3779B97F4A7C15;
+
+/* A xorshift generator, such that every run uses the same sequence. */
+static uint64_t bench_rand(void)
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 7;
+	bench_seed ^= bench_seed << 17;
+
+	return bench_seed;
+}
+
+static void bench_shuffle(struct page_info **pages, size_t n)
+{
+	struct page_info *tmp;
+	size_t i, j;
+
+	for (i = n; i > 1; --i) {
+		j = bench_rand() % i;
+		tmp = pages[i - 1];
+		pages[i - 1] = pages[j];
+		pages[j] = tmp;
+	}
+}
+
+static void bench_report(const char *name, size_t order, size_t ops,
+	uint64_t cycles)
+{
+	if (order == BUDDY_MAX_ORDER)
+		cprintf("BENCH name=%s ops=%u cycles_per_op=%lu\n", name, ops,
+			ops ? cycles / ops : 0);
+	else
+		cprintf("BENCH name=%s/%u ops=%u cycles_per_op=%lu\n", name,
+			order, ops, ops ? cycles / ops : 0);
+}
+
+/* Allocates as many chunks of the order as fit in the array, up to
+ * BENCH_NPAGES pages worth.
+ *
+ * Returns the number of chunks allocated.
+ */
+static size_t bench_alloc(size_t order, uint64_t *cycles)
+{
+	size_t i, n = MAX(BENCH_NPAGES >> order, 8);
+	uint64_t start;
+
+	start = read_tsc_ordered();
+
+	for (i = 0; i < n; ++i) {
+		bench_pages[i] = page_alloc_order(order, 0);
+
+		if (!bench_pages[i])
+			break;
+	}
+
+	*cycles += read_tsc_ordered() - start;
+
+	return i;
+}
+
+/* Frees the chunks in the array, either in the order they were allocated in
+ * or in reverse.
+ */
+static void bench_free(size_t n, int reverse, uint64_t *cycles)
+{
+	uint64_t start;
+	size_t i;
+
+	start = read_tsc_ordered();
+
+	for (i = 0; i < n; ++i)
+		page_free(bench_pages[reverse ? n - i - 1 : i]);
+
+	*cycles += read_tsc_ordered() - start;
+}
+
+/* Allocates a batch of chunks and frees them last in, first out. */
+static void bench_page_lifo(size_t order)
+{
+	uint64_t cycles = 0;
+	size_t n;
+
+	n = bench_alloc(order, &cycles);
+	bench_free(n, 1, &cycles);
+	bench_report("page_lifo", order, 2 * n, cycles);
+}
+
+/* Allocates a batch of chunks and frees them first in, first out. */
+static void bench_page_fifo(size_t order)
+{
+	uint64_t cycles = 0;
+	size_t n;
+
+	n = bench_alloc(order, &cycles);
+	bench_free(n, 0, &cycles);
+	bench_report("page_fifo", order, 2 * n, cycles);
+}
+
+/* Allocates a batch of chunks and frees them in random order, which leaves
+ * the free lists fragmented.
+ */
+static void bench_page_random(size_t order)
+{
+	uint64_t cycles = 0;
+	size_t n;
+
+	n = bench_alloc(order, &cycles);
+	bench_shuffle(bench_pages, n);
+	bench_free(n, 0, &cycles);
+	bench_report("page_random", order, 2 * n, cycles);
+}
+
+/* Allocates and immediately frees a chunk of the order, which measures the
+ * latency of the fast path.
+ */
+static void bench_page_order(size_t order)
+{
+	struct page_info *page;
+	uint64_t start, cycles;
+	size_t i, n = 0;
+
+	start = read_tsc_ordered();
+
+	for (i = 0; i < BENCH_NREPS; ++i) {
+		page = page_alloc_order(order, 0);
+
+		if (!page)
+			break;
+
+		page_free(page);
+		n += 2;
+	}
+
+	cycles = read_tsc_ordered() - start;
+	bench_report("page_order", order, n, cycles);
+}
+
+/* Allocates mostly small pages mixed with huge pages, then frees them all in
+ * random order.
+ */
+static void bench_page_huge_mix(void)
+{
+	uint64_t start, cycles;
+	size_t i, order, n;
+
+	start = read_tsc_ordered();
+
+	for (n = 0; n < BENCH_MIX_NPAGES; ++n) {
+		order = bench_rand() % BENCH_HUGE_RATIO ? BUDDY_4K_PAGE :
+			BUDDY_2M_PAGE;
+		bench_pages[n] = page_alloc_order(order, 0);
+
+		if (!bench_pages[n])
+			break;
+	}
+
+	cycles = read_tsc_ordered() - start;
+	bench_shuffle(bench_pages, n);
+	start = read_tsc_ordered();
+
+	for (i = 0; i < n; ++i)
+		page_free(bench_pages[i]);
+
+	cycles += read_tsc_ordered() - start;
+	bench_report("page_huge_mix", BUDDY_MAX_ORDER, 2 * n, cycles);
+}
+
+/* Measures memset() and memmove() on a huge page, where an operation is a
+ * single 4 KiB page worth of bytes.
+ */
+static void bench_memory(void)
+{
+	struct page_info *src, *dst;
+	size_t npages = (size_t)1 << BENCH_BUF_ORDER;
+	size_t len = PAGE_SIZE << BENCH_BUF_ORDER;
+	uint64_t start, cycles;
+
+	src = page_alloc_order(BENCH_BUF_ORDER, 0);
+	dst = page_alloc_order(BENCH_BUF_ORDER, 0);
+
+	if (!src || !dst) {
+		cprintf("BENCH skipping memset and memmove: out of memory\n");
+		goto out;
+	}
+
+	start = read_tsc_ordered();
+	memset(page2kva(dst), 0x5A, len);
+	cycles = read_tsc_ordered() - start;
+	bench_report("memset", BUDDY_MAX_ORDER, npages, cycles);
+
+	start = read_tsc_ordered();
+	memmove(page2kva(dst), page2kva(src), len);
+	cycles = read_tsc_ordered() - start;
+	bench_report("memmove", BUDDY_MAX_ORDER, npages, cycles);
+
+	/* Overlapping moves go backwards. */
+	start = read_tsc_ordered();
+	memmove((char *)page2kva(dst) + 64, page2kva(dst), len - 64);
+	cycles = read_tsc_ordered() - start;
+	bench_report("memmove_overlap", BUDDY_MAX_ORDER, npages, cycles);
+
+out:
+	if (src)
+		page_free(src);
+
+	if (dst)
+		page_free(dst);
+}
+
+static int bench_node_cmp(struct rb_node *lhs, struct rb_node *rhs)
+{
+	uint64_t a = container_of(lhs, struct bench_node, node)->key;
+	uint64_t b = container_of(rhs, struct bench_node, node)->key;
+
+	return (a > b) - (a < b);
+}
+
+static int bench_key_cmp(const void *key, struct rb_node *node)
+{
+	uint64_t a = *(const uint64_t *)key;
+	uint64_t b = container_of(node, struct bench_node, node)->key;
+
+	return (a > b) - (a < b);
+}
+
+/* Inserts nodes with random keys into an rb-tree and looks all of them up. */
+static void bench_rbtree(void)
+{
+	struct page_info *page;
+	struct bench_node *nodes;
+	struct rb_tree tree;
+	uint64_t start, cycles;
+	size_t i, order = 0;
+
+	while ((PAGE_SIZE << order) < BENCH_NNODES * sizeof *nodes)
+		++order;
+
+	page = page_alloc_order(order, 0);
+
+	if (!page) {
+		cprintf("BENCH skipping rbtree: out of memory\n");
+		return;
+	}
+
+	nodes = page2kva(page);
+	rb_init(&tree);
+
+	for (i = 0; i < BENCH_NNODES; ++i) {
+		rb_node_init(&nodes[i].node);
+		nodes[i].key = bench_rand();
+	}
+
+	start = read_tsc_ordered();
+
+	for (i = 0; i < BENCH_NNODES; ++i)
+		rb_insert(&tree, &nodes[i].node, bench_node_cmp);
+
+	cycles = read_tsc_ordered() - start;
+	bench_report("rb_insert", BUDDY_MAX_ORDER, BENCH_NNODES, cycles);
+
+	start = read_tsc_ordered();
+
+	for (i = 0; i < BENCH_NNODES; ++i)
+		assert(rb_find(&tree, &nodes[i].key, bench_key_cmp));
+
+	cycles = read_tsc_ordered() - start;
+	bench_report("rb_find", BUDDY_MAX_ORDER, BENCH_NNODES, cycles);
+
+	page_free(page);
+}
+
+/* Runs all benchmarks. The last line tells bench-lab1 that we are done. */
+void mem_bench(void)
+{
+	static const size_t orders[] = { BUDDY_4K_PAGE, 3, BUDDY_2M_PAGE };
+	size_t i, order;
+
+	cprintf("BENCH tsc_khz=%lu\n", tsc_khz);
+
+	for (i = 0; i < length_of(orders); ++i) {
+		bench_page_lifo(orders[i]);
+		bench_page_fifo(orders[i]);
+		bench_page_random(orders[i]);
+	}
+
+	for (order = 0; order <= BUDDY_2M_PAGE; ++order)
+		bench_page_order(order);
+
+	bench_page_huge_mix();
+	bench_memory();
+	bench_rbtree();
+
+	cprintf("BENCH done\n");
+}
@@ -1,31 +1,70 @@
 #include <types.h>
 #include <assert.h>
-#include <list.h>
+#include <hash.h>
+#include <interval_tree.h>
 #include <paging.h>
+#include <string.h>
 
+#include <kernel/cpufeature.h>
+#include <kernel/klog.h>
+#include <kernel/kwork.h>
 #include <kernel/mem.h>
+#include <kernel/monitor.h>
+#include <kernel/smp.h>
+#include <kernel/static_call.h>
+#include <kernel/time.h>
 
-extern struct list buddy_free_list[];
+/* The number of pages to allocate when checking the per-CPU page cache. */
+#define PCP_BATCH_CHECK 128
+
+/* The number and size of the objects to allocate when checking the slab
+ * allocator.
+ */
+#define SLAB_CHECK 200
+#define SLAB_CHECK_SIZE 48
+
+/* The number of intervals to insert when checking the interval tree. */
+#define INTERVAL_CHECK 64
+
+/* The number of objects to insert when checking the hash table. */
+#define HASH_CHECK 256
+
+/* The number of chunks every CPU allocates when checking concurrent
+ * allocations.
+ */
+#define SMP_ALLOC_CHECK 64
+
+/* The number of work items to submit when checking kwork. */
+#define KWORK_CHECK 128
+
+/* The number of references every CPU takes and drops when checking the
+ * reference counts.
+ */
+#define PAGE_REF_CHECK 100000
 
 /* Checks the number of free pages available in both base memory and high
  * memory.
  */
 void lab1_check_free_list_avail(void)
 {
+	struct page_list *list;
 	struct page_info *page;
-	struct list *node;
-	size_t order;
+	size_t node, order, migrate;
 	size_t nfree_basemem = 0;
 	size_t nfree_extmem = 0;
 
-	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		list_foreach(buddy_free_list + order, node) {
-			page = container_of(node, struct page_info, pp_node);
+	for (node = 0; node < nnodes; ++node) {
+		for (migrate = 0; migrate < MIGRATE_TYPES; ++migrate) {
+			for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+				list = buddy_zones[node].free_list[migrate] +
+					order;
 
-			if (page2pa(page) < EXT_PHYS_MEM) {
-				++nfree_basemem;
-			} else {
-				++nfree_extmem;
+				page_list_foreach(list, page) {
+					if (page2pa(page) < EXT_PHYS_MEM)
+						++nfree_basemem;
+					else
+						++nfree_extmem;
+				}
 			}
 		}
 	}
@@ -41,24 +80,62 @@ void lab1_check_free_list_avail(void)
  */
 void lab1_check_free_list_order(void)
 {
+	struct buddy_zone *zone;
+	struct page_list *list;
 	struct page_info *page;
-	struct list *node;
-	size_t order;
+	size_t node, order, migrate;
 	size_t nviolations = 0;
+	size_t nfree, nfree_node, nfree_pages = 0;
 
 	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		list_foreach(buddy_free_list + order, node) {
-			page = container_of(node, struct page_info, pp_node);
+		nfree = 0;
+
+		for (node = 0; node < nnodes; ++node) {
+			zone = buddy_zones + node;
+			nfree_node = 0;
+
+			for (migrate = 0; migrate < MIGRATE_TYPES; ++migrate) {
+				list = zone->free_list[migrate] + order;
+
+				page_list_foreach(list, page) {
+					if (page->pp_order != order ||
+					    page->pp_node != node ||
+					    page_migrate_type(page) != migrate)
+						++nviolations;
 
-			if (page->pp_order != order)
-				++nviolations;
+					++nfree_node;
+				}
+
+				if (!page_list_is_empty(list) !=
+				    !!(zone->free_mask[migrate] & (1 << order))) {
+					panic("free mask is out of sync for order %u on node %u",
+						order, node);
+				}
+			}
+
+			if (nfree_node != zone->stats.nfree[order]) {
+				panic("found %u free pages of order %u on node %u, but counted %u",
+					nfree_node, order, node,
+					zone->stats.nfree[order]);
+			}
+
+			nfree += nfree_node;
+		}
+
+		if (nfree != count_free_pages(order)) {
+			panic("found %u free pages of order %u, but counted %u",
+				nfree, order, count_free_pages(order));
 		}
+
+		nfree_pages += nfree << order;
 	}
 
 	if (nviolations != 0) {
 		panic("found %u order violations in free list", nviolations);
 	}
 
+	assert(nfree_pages == count_total_free_pages());
+
 	cprintf("[LAB 1] check_free_list_order() succeeded!\n");
 }
 
@@ -75,7 +152,7 @@ void lab1_check_memory_layout(struct boot_info *boot_info)
 	for (order = 0; order < boot_info->mmap_len; ++order, ++entry) {
 		for (pa = entry->addr; pa < entry->addr + entry->len;
 		     pa += PAGE_SIZE) {
-			if (pa >= BOOT_MAP_LIM)
+			if (pa >= npages_init * PAGE_SIZE)
 				continue;
 
 			page = pa2page(pa);
@@ -94,14 +171,61 @@ void lab1_check_memory_layout(struct boot_info *boot_info)
 	cprintf("[LAB 1] check_memory_layout() succeeded!\n");
 }
 
+void lab1_check_boot_regions(struct boot_info *boot_info)
+{
+	struct boot_region *region;
+	struct mmap_entry *entry;
+	physaddr_t end, kernel_end;
+	size_t i, j;
+
+	kernel_end = PADDR(boot_alloc(0));
+	end = 0;
+
+	for (i = 0; i < boot_nregions; ++i) {
+		region = boot_regions + i;
+
+		/* The regions are sorted, merged and page aligned. */
+		assert(region->start < region->end);
+		assert(i == 0 || region->start > end);
+		assert(region->start % PAGE_SIZE == 0);
+		assert(region->end % PAGE_SIZE == 0);
+		end = region->end;
+
+		/* None of the reserved ranges are in there. */
+		assert(region->start > 0);
+		assert(region->end <= KERNEL_LMA || region->start >= kernel_end);
+		assert(!(region->start <= PADDR(boot_info) &&
+			PADDR(boot_info) < region->end));
+		assert(!(region->start <= (physaddr_t)boot_info->elf_hdr &&
+			(physaddr_t)boot_info->elf_hdr < region->end));
+
+		/* Nor is any memory that is not free. */
+		entry = (struct mmap_entry *)KADDR(boot_info->mmap_addr);
+
+		for (j = 0; j < boot_info->mmap_len; ++j, ++entry) {
+			if (entry->type == MMAP_FREE)
+				continue;
+
+			assert(region->end <= entry->addr ||
+				region->start >= entry->addr + entry->len);
+		}
+	}
+
+	cprintf("[LAB 1] check_boot_regions() succeeded!\n");
+}
+
 void check_buddy_consistency(physaddr_t addr, size_t order, struct page_info *parent)
 {
 	struct page_info *page;
 
+	/* Chunks of the higher orders may extend beyond the end of memory. */
+	if (PAGE_INDEX(addr) >= npages_init)
+		return;
+
 	page = pa2page(addr);
 
 	if (parent && parent != page) {
-		if (page->pp_free || !list_is_empty(&page->pp_node) ||
+		if (page->pp_free || page_is_listed(page) ||
 			page->pp_order < parent->pp_order) {
 			panic("page %p of order %u is free, while parent page "
 				"%p of order %u is already free",
@@ -110,17 +234,17 @@ void check_buddy_consistency(physaddr_t addr, size_t order, struct page_info *pa
 		}
 	}
 
-	if (page->pp_free && list_is_empty(&page->pp_node)) {
+	if (page->pp_free && !page_is_listed(page)) {
 		panic("page %p of order %u is free, but not on the free list",
 			page2pa(page), page->pp_order);
 	}
 
-	if (!page->pp_free && !list_is_empty(&page->pp_node)) {
+	if (!page->pp_free && page_is_listed(page)) {
 		panic("page %p of order %u is in use, but on the free list",
 			page2pa(page), page->pp_order);
 	}
 
-	if (page->pp_free && list_is_empty(&page->pp_node)) {
+	if (page->pp_free && !page_is_listed(page)) {
 		parent = page;
 	}
 
@@ -139,7 +263,7 @@ void lab1_check_buddy_consistency(void)
 	physaddr_t addr;
 
 	for (addr = 0;
-	     addr < BOOT_MAP_LIM;
+	     addr < npages_init * PAGE_SIZE;
 	     addr += (1 << (BUDDY_MAX_ORDER + 12 - 1))) {
 		check_buddy_consistency(addr, BUDDY_MAX_ORDER - 1, NULL);
 	}
@@ -149,47 +273,61 @@ void lab1_check_buddy_consistency(void)
 
 void lab1_check_split_and_merge(int flags)
 {
-	struct list stolen_free_list[10];
-	struct page_info *page;
+	static struct buddy_zone stolen_zones[NNODES];
+	struct page_info *page, *buddy;
 	size_t order;
 	size_t nfree_pages;
 
-	/* Count the number of order 9 pages. */
-	nfree_pages = count_free_pages(BUDDY_2M_PAGE);
+	/* Count the number of free pages. */
+	nfree_pages = count_total_free_pages();
 
-	/* Allocate a order 9 chunk. */
 #ifdef BONUS_LAB1
-	if (flags & ALLOC_HUGE)
+	/* Allocate a huge page and check against the count of free pages. */
+	if (flags & ALLOC_HUGE) {
 		page = page_alloc(ALLOC_HUGE);
-	else
+
+		if (!page) {
+			panic("can't allocate 2M page!");
+		}
+
+		assert(page->pp_order == BUDDY_2M_PAGE);
+		assert(count_total_free_pages() + 512 == nfree_pages);
+		page_free(page);
+		assert(count_total_free_pages() == nfree_pages);
+	}
 #endif
-		page = buddy_find(BUDDY_2M_PAGE);
+
+	/* Allocate an order 10 chunk and split it into two order 9 chunks by
+	 * hand. The upper half stays allocated while the free lists are stolen,
+	 * such that the lower half cannot merge with any of the stolen chunks.
+	 */
+	page = buddy_find(BUDDY_2M_PAGE + 1);
 
 	if (!page) {
-		panic("can't allocate 2M page!");
+		panic("can't allocate 4M chunk!");
 	}
 
-	/* Check against the count of huge pages. */
-	assert(count_free_pages(BUDDY_2M_PAGE) + 1 == nfree_pages);
+	buddy = page + (1 << BUDDY_2M_PAGE);
+	page->pp_order = BUDDY_2M_PAGE;
+	buddy->pp_order = BUDDY_2M_PAGE;
+	buddy->pp_free = 0;
 
 	/* Steal the lists of free pages. */
-	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		stolen_free_list[order] = buddy_free_list[order];
-		list_init(buddy_free_list + order);
-	}
+	memcpy(stolen_zones, buddy_zones, sizeof buddy_zones);
+	buddy_init();
 
 	/* Return the huge page. */
 	page_free(page);
 
 	/* Check if we have an order 9 chunk. */
-	for (order = 0; order < BUDDY_2M_PAGE; ++order) {
-		assert(count_free_pages(order) == 0);
+	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+		assert(count_free_pages(order) == (order == BUDDY_2M_PAGE));
 	}
 
-	assert(count_free_pages(BUDDY_2M_PAGE) == 1);
-
-	/* Allocate a normal page. */
-	page = page_alloc(0);
+	/* Allocate a normal page. Bypass the per-CPU page cache, as it would
+	 * refill itself with a whole batch of pages.
+	 */
+	page = buddy_find(BUDDY_4K_PAGE);
 
 	if (!page) {
 		panic("can't allocate 4K page!");
@@ -203,15 +341,13 @@ void lab1_check_split_and_merge(int flags)
 	assert(count_free_pages(BUDDY_2M_PAGE) == 0);
 
 	/* Return the normal page. */
-	page_free(page);
+	buddy_merge(page);
 
 	/* Check if we have a huge page. */
-	for (order = 0; order < BUDDY_2M_PAGE; ++order) {
-		assert(count_free_pages(order) == 0);
+	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
+		assert(count_free_pages(order) == (order == BUDDY_2M_PAGE));
 	}
 
-	assert(count_free_pages(BUDDY_2M_PAGE) == 1);
-
 	/* Allocate an order 9 chunk again. */
 	if (flags & ALLOC_HUGE)
 		page = page_alloc(ALLOC_HUGE);
@@ -223,12 +359,12 @@ void lab1_check_split_and_merge(int flags)
 	}
 
 	/* Return the lists of free chunks. */
-	for (order = 0; order < BUDDY_MAX_ORDER; ++order) {
-		buddy_free_list[order] = stolen_free_list[order];
-	}
+	memcpy(buddy_zones, stolen_zones, sizeof buddy_zones);
 
-	/* Return the huge page. */
+	/* Return both halves of the order 10 chunk. */
 	page_free(page);
+	page_free(buddy);
+	assert(count_total_free_pages() == nfree_pages);
 
 #ifdef BONUS_LAB1
 	if (flags & ALLOC_HUGE)
@@ -239,15 +375,1271 @@ void lab1_check_split_and_merge(int flags)
 
 }
 
+/* Checks that order 0 pages go through the per-CPU page cache and that
+ * draining the caches returns every page to the buddy allocator.
+ */
+void lab1_check_page_cache(void)
+{
+	struct page_info *page[PCP_BATCH_CHECK];
+	size_t nfree_pages;
+	size_t i;
+
+	page_cache_drain_all();
+	nfree_pages = count_total_free_pages();
+
+	for (i = 0; i < PCP_BATCH_CHECK; ++i) {
+		page[i] = page_alloc(0);
+		assert(page[i]);
+		assert(!page[i]->pp_free);
+		assert(page[i]->pp_order == 0);
+	}
+
+	assert(count_total_free_pages() + count_cached_pages() +
+		PCP_BATCH_CHECK == nfree_pages);
+
+	for (i = 0; i < PCP_BATCH_CHECK; ++i)
+		page_free(page[i]);
+
+	assert(count_total_free_pages() + count_cached_pages() == nfree_pages);
+
+	page_cache_drain_all();
+	assert(count_cached_pages() == 0);
+	assert(count_total_free_pages() == nfree_pages);
+
+	cprintf("[LAB 1] check_page_cache() succeeded!\n");
+}
+
+static int page_is_zero(struct page_info *page)
+{
+	uint64_t *p = page2kva(page);
+	size_t i;
+
+	for (i = 0; i < (PAGE_SIZE << page->pp_order) / sizeof *p; ++i) {
+		if (p[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Checks that the pools of zeroed pages are refilled when idle, that they serve
+ * ALLOC_ZERO requests with cleared pages and that draining them returns all
+ * their pages to the buddy allocator.
+ */
+void lab1_check_zero_pool(void)
+{
+	struct page_info *page;
+	size_t nfree_pages, nzeroed;
+
+	zero_pool_drain();
+	page_cache_drain_all();
+	nfree_pages = count_total_free_pages();
+
+	while (zero_pool_refill(16) > 0);
+
+	nzeroed = count_zeroed_pages();
+	assert(nzeroed > 0);
+	assert(count_total_free_pages() + nzeroed == nfree_pages);
+
+	page = page_alloc(ALLOC_ZERO);
+	assert(page);
+	assert(!page->pp_zero);
+	assert(page_is_zero(page));
+	assert(count_zeroed_pages() == nzeroed - 1);
+	memset(page2kva(page), 0xAA, PAGE_SIZE);
+	page_free(page);
+
+#ifdef BONUS_LAB1
+	page = page_alloc(ALLOC_ZERO | ALLOC_HUGE);
+	assert(page);
+	assert(page->pp_order == BUDDY_2M_PAGE);
+	assert(!page->pp_zero);
+	assert(page_is_zero(page));
+	page_free(page);
+#endif
+
+	zero_pool_drain();
+	page_cache_drain_all();
+	assert(count_zeroed_pages() == 0);
+	assert(count_total_free_pages() == nfree_pages);
+
+	/* A dirtied page must be cleared again when allocated with ALLOC_ZERO. */
+	page = page_alloc(ALLOC_ZERO);
+	assert(page);
+	assert(page_is_zero(page));
+	page_free(page);
+	page_cache_drain_all();
+
+	cprintf("[LAB 1] check_zero_pool() succeeded!\n");
+}
+
+#define BULK_CHECK 100
+
+/* Checks that bulk allocations hand out distinct pages of the requested order
+ * and that freeing them in bulk merges all of them back into the chunks they
+ * came from.
+ */
+void lab1_check_bulk(void)
+{
+	struct page_info *page[BULK_CHECK];
+	struct buddy_stats stats, new_stats;
+	size_t nfree_pages, order, i, j;
+
+	zero_pool_drain();
+	page_cache_drain_all();
+	buddy_get_stats(&stats);
+	nfree_pages = stats.nfree_pages;
+
+	for (order = 0; order < 3; ++order) {
+		assert(page_alloc_bulk(page, BULK_CHECK, order, ALLOC_ZERO) ==
+			BULK_CHECK);
+		assert(count_total_free_pages() + (BULK_CHECK << order) ==
+			nfree_pages);
+
+		for (i = 0; i < BULK_CHECK; ++i) {
+			assert(page[i]->pp_order == order);
+			assert(!page[i]->pp_free);
+			assert(!page_is_listed(page[i]));
+			assert(!(page_index(page[i]) & ((1 << order) - 1)));
+			assert(page_is_zero(page[i]));
+
+			for (j = 0; j < i; ++j)
+				assert(page[i] != page[j]);
+		}
+
+		page_free_bulk(page, BULK_CHECK);
+		buddy_get_stats(&new_stats);
+		assert(memcmp(&stats, &new_stats, sizeof stats) == 0);
+	}
+
+	cprintf("[LAB 1] check_bulk() succeeded!\n");
+}
+
+/* Checks that chunks of arbitrary orders are contiguous, aligned and zeroed on
+ * request.
+ */
+void lab1_check_alloc_order(void)
+{
+	struct page_info *page;
+	size_t nfree_pages, order;
+
+	assert(!page_alloc_order(BUDDY_MAX_ORDER, 0));
+
+	for (order = 1; order <= BUDDY_2M_PAGE + 1; ++order) {
+		nfree_pages = count_total_free_pages();
+		page = page_alloc_order(order, ALLOC_ZERO);
+		assert(page);
+		assert(page->pp_order == order);
+		assert(!(page_index(page) & ((1 << order) - 1)));
+		assert(page_is_zero(page));
+		assert(count_total_free_pages() + (1 << order) == nfree_pages);
+		page_free(page);
+		assert(count_total_free_pages() == nfree_pages);
+	}
+
+	cprintf("[LAB 1] check_alloc_order() succeeded!\n");
+}
+
+static void slab_check_ctor(void *obj)
+{
+	memset(obj, 0x5a, SLAB_CHECK_SIZE);
+}
+
+/* Checks that the slab allocator hands out distinct, aligned and constructed
+ * objects and that shrinking the cache returns all of its pages.
+ */
+void lab1_check_slab(void)
+{
+	struct kmem_cache *cache;
+	char *obj[SLAB_CHECK];
+	size_t nfree_pages, i, j;
+
+	cache = kmem_cache_create("check_slab", SLAB_CHECK_SIZE, 16,
+		slab_check_ctor);
+	assert(cache);
+	assert(!kmem_cache_create("check_slab_huge", PAGE_SIZE << 4, 0, NULL));
+
+	page_cache_drain_all();
+	nfree_pages = count_total_free_pages();
+
+	for (i = 0; i < SLAB_CHECK; ++i) {
+		obj[i] = kmem_cache_alloc(cache);
+		assert(obj[i]);
+		assert(!((uintptr_t)obj[i] & 15));
+
+		for (j = 0; j < SLAB_CHECK_SIZE; ++j)
+			assert(obj[i][j] == 0x5a);
+
+		memset(obj[i], i, SLAB_CHECK_SIZE);
+	}
+
+	/* The objects should not overlap. */
+	for (i = 0; i < SLAB_CHECK; ++i) {
+		for (j = 0; j < SLAB_CHECK_SIZE; ++j)
+			assert(obj[i][j] == (char)i);
+
+		slab_check_ctor(obj[i]);
+	}
+
+	assert(count_total_free_pages() < nfree_pages);
+
+	for (i = 0; i < SLAB_CHECK; ++i)
+		kmem_cache_free(cache, obj[i]);
+
+	kmem_cache_shrink(cache);
+	page_cache_drain_all();
+	assert(count_total_free_pages() == nfree_pages);
+
+	kmem_cache_destroy(cache);
+
+	cprintf("[LAB 1] check_slab() succeeded!\n");
+}
+
+/* Checks that kmalloc() picks the right size class and that the memory is
+ * usable and zeroed on request.
+ */
+void lab1_check_kmalloc(void)
+{
+	static const size_t sizes[][2] = {
+		{ 1, 8 }, { 8, 8 }, { 9, 16 }, { 24, 24 }, { 25, 32 },
+		{ 33, 48 }, { 100, 128 }, { 192, 192 }, { 193, 256 },
+		{ 300, 384 }, { 1000, 1024 }, { 2048, 2048 },
+		{ 2049, PAGE_SIZE }, { 5000, 2 * PAGE_SIZE },
+		{ 20000, 8 * PAGE_SIZE },
+	};
+	char *ptr;
+	size_t i, j, size;
+
+	assert(!kmalloc(0, 0));
+
+	for (i = 0; i < length_of(sizes); ++i) {
+		size = sizes[i][0];
+		ptr = kmalloc(size, ALLOC_ZERO);
+		assert(ptr);
+		assert(ksize(ptr) == sizes[i][1]);
+		assert(!((uintptr_t)ptr & (KMALLOC_MIN_SIZE - 1)));
+		assert(size <= KMALLOC_MAX_SIZE ||
+		       !((uintptr_t)ptr & (PAGE_SIZE - 1)));
+
+		for (j = 0; j < size; ++j)
+			assert(ptr[j] == 0);
+
+		memset(ptr, 0xa5, size);
+		kfree(ptr);
+	}
+
+	kfree(NULL);
+
+	cprintf("[LAB 1] check_kmalloc() succeeded!\n");
+}
+
+/* Checks that arenas hand out aligned, non-overlapping memory and that reset
+ * and release return the chunks to the buddy allocator.
+ */
+void lab1_check_arena(void)
+{
+	struct arena arena;
+	struct arena_mark mark;
+	size_t nfree = count_total_free_pages() + count_cached_pages();
+	char *ptr, *prev, *big;
+	size_t i;
+
+	arena_init(&arena, ARENA_ORDER);
+	prev = arena_alloc(&arena, 1, 0);
+	assert(prev);
+
+	for (i = 0; i < 64; ++i) {
+		ptr = arena_alloc(&arena, 24, 16);
+		assert(ptr);
+		assert(!((uintptr_t)ptr & 15));
+		assert(ptr >= prev + 1);
+		memset(ptr, 0xa5, 24);
+		prev = ptr + 23;
+	}
+
+	arena_mark(&arena, &mark);
+	ptr = arena_alloc(&arena, 8, 0);
+
+	/* Allocations larger than a chunk get a chunk of their own. */
+	big = arena_alloc(&arena, 3 * PAGE_SIZE, 0);
+	assert(big);
+	memset(big, 0x5a, 3 * PAGE_SIZE);
+	assert(count_total_free_pages() + count_cached_pages() < nfree - 4);
+
+	arena_reset(&arena, &mark);
+	assert(count_total_free_pages() + count_cached_pages() == nfree - 1);
+	assert(arena_alloc(&arena, 8, 0) == ptr);
+
+	arena_release(&arena);
+	assert(count_total_free_pages() + count_cached_pages() == nfree);
+
+	cprintf("[LAB 1] check_arena() succeeded!\n");
+}
+
+static int interval_check_cmp(const void *key, struct rb_node *node)
+{
+	uintptr_t start = *(const uintptr_t *)key;
+	uintptr_t other = interval_of(node)->start;
+
+	return (start > other) - (start < other);
+}
+
+/* Checks the ordered lookups of the red-black tree and the overlap queries of
+ * the interval tree, while intervals are being added and removed.
+ */
+void lab1_check_interval_tree(void)
+{
+	static struct interval intervals[INTERVAL_CHECK + 1];
+	struct rb_tree tree;
+	struct interval *interval;
+	uintptr_t key;
+	size_t i, n;
+
+	interval_tree_init(&tree);
+
+	/* Insert [64i, 64i + 48) in shuffled order, plus one long interval. */
+	for (i = 0; i < INTERVAL_CHECK; ++i) {
+		interval = intervals + (i * 37) % INTERVAL_CHECK;
+		interval->start = (interval - intervals) * 64;
+		interval->end = interval->start + 48;
+		assert(interval_insert(&tree, interval) == 0);
+	}
+
+	interval = intervals + INTERVAL_CHECK;
+	interval->start = 1000;
+	interval->end = 3000;
+	assert(interval_insert(&tree, interval) == 0);
+
+	key = 640;
+	assert(interval_of(rb_find(&tree, &key, interval_check_cmp)) ==
+		intervals + 10);
+	key = 641;
+	assert(!rb_find(&tree, &key, interval_check_cmp));
+	assert(interval_of(rb_lower_bound(&tree, &key, interval_check_cmp)) ==
+		intervals + 11);
+
+	assert(interval_find(&tree, 10 * 64 + 47) == intervals + 10);
+	assert(!interval_find(&tree, 10 * 64 + 48));
+	assert(interval_find(&tree, 1020) == intervals + INTERVAL_CHECK);
+	assert(interval_find(&tree, 1024) == intervals + INTERVAL_CHECK);
+	assert(interval_next_overlap(intervals + INTERVAL_CHECK, 1024, 1025) ==
+		intervals + 16);
+
+	n = 0;
+
+	for (interval = interval_first_overlap(&tree, 900, 1100); interval;
+	     interval = interval_next_overlap(interval, 900, 1100))
+		++n;
+
+	/* [896, 944), [960, 1008), [1000, 3000), [1024, 1072), [1088, ...) */
+	assert(n == 5);
+
+	/* Remove the long interval and every other short one. */
+	assert(interval_remove(&tree, intervals + INTERVAL_CHECK) == 0);
+
+	for (i = 0; i < INTERVAL_CHECK; i += 2)
+		assert(interval_remove(&tree, intervals + i) == 0);
+
+	assert(!interval_find(&tree, 1020));
+	assert(!interval_find(&tree, 1024));
+	assert(interval_find(&tree, 1088) == intervals + 17);
+	assert(interval_first_overlap(&tree, 0, 4096) == intervals + 1);
+
+	n = 0;
+
+	for (interval = interval_of(rb_first(&tree)); interval;
+	     interval = interval_of(rb_next(&interval->node)))
+		assert(interval == intervals + 2 * n++ + 1);
+
+	assert(n == INTERVAL_CHECK / 2);
+
+	cprintf("[LAB 1] check_interval_tree() succeeded!\n");
+}
+
+/* Checks that a tree built from a sorted array can be walked in order and
+ * queried, and that it stays balanced when modified afterwards.
+ */
+void lab1_check_rb_build(void)
+{
+	static struct interval intervals[INTERVAL_CHECK];
+	struct rb_tree tree;
+	struct rb_iter iter;
+	struct rb_node *node;
+	size_t i, n = 0;
+
+	for (i = 0; i < INTERVAL_CHECK; ++i) {
+		intervals[i].start = i * 64;
+		intervals[i].end = i * 64 + 48 + (i == 8) * 1024;
+	}
+
+	interval_tree_init(&tree);
+	assert(interval_tree_build(&tree, intervals, INTERVAL_CHECK) == 0);
+	assert(tree.root->color == RB_BLACK);
+
+	rb_iter_init(&iter, &tree);
+
+	while ((node = rb_iter_next(&iter)))
+		assert(interval_of(node) == intervals + n++);
+
+	assert(n == INTERVAL_CHECK);
+
+	/* The tree has to know the long interval [512, 1584) covers 1024. */
+	assert(interval_find(&tree, 1024) == intervals + 8);
+	assert(!interval_find(&tree, 40 * 64 + 50));
+
+	for (i = 0; i < INTERVAL_CHECK; i += 3)
+		assert(interval_remove(&tree, intervals + i) == 0);
+
+	assert(interval_find(&tree, 1024) == intervals + 8);
+	assert(!interval_find(&tree, 1590));
+	assert(interval_remove(&tree, intervals + 8) == 0);
+	assert(interval_find(&tree, 1024) == intervals + 16);
+	assert(interval_find(&tree, 64) == intervals + 1);
+
+	cprintf("[LAB 1] check_rb_build() succeeded!\n");
+}
+
+struct hash_check {
+	struct hash_node node;
+	uint64_t key;
+};
+
+static int hash_check_match(const void *key, struct hash_node *node)
+{
+	return hash_entry(node, struct hash_check, node)->key ==
+		*(const uint64_t *)key;
+}
+
+static struct hash_check *hash_check_find(struct hash_table *table,
+	uint64_t key)
+{
+	return hash_entry(hash_find(table, hash64(key), &key,
+		hash_check_match), struct hash_check, node);
+}
+
+/* Checks that the hash table finds every object while it grows, and that
+ * removed objects are gone.
+ */
+void lab1_check_hash(void)
+{
+	static struct hash_check objs[HASH_CHECK];
+	struct hash_table table;
+	struct hash_node **buckets;
+	size_t i, nbuckets = 4;
+
+	buckets = kmalloc(nbuckets * sizeof *buckets, 0);
+	assert(buckets);
+	hash_init(&table, buckets, nbuckets);
+
+	for (i = 0; i < HASH_CHECK; ++i) {
+		/* Page-aligned keys should still spread over the buckets. */
+		objs[i].key = (uint64_t)i << PAGE_TABLE_SHIFT;
+		hash_insert(&table, &objs[i].node, hash64(objs[i].key));
+
+		if (hash_needs_resize(&table)) {
+			nbuckets *= 2;
+			buckets = kmalloc(nbuckets * sizeof *buckets, 0);
+			assert(buckets);
+			kfree(hash_resize(&table, buckets, nbuckets));
+		}
+	}
+
+	assert(table.count == HASH_CHECK);
+	assert(table.nbuckets * HASH_MAX_LOAD >= HASH_CHECK);
+
+	for (i = 0; i < HASH_CHECK; ++i)
+		assert(hash_check_find(&table, objs[i].key) == objs + i);
+
+	assert(!hash_check_find(&table, 1));
+
+	for (i = 0; i < HASH_CHECK; i += 2)
+		assert(hash_remove(&table, &objs[i].node) == 0);
+
+	assert(hash_remove(&table, &objs[0].node) < 0);
+	assert(table.count == HASH_CHECK / 2);
+
+	for (i = 0; i < HASH_CHECK; ++i)
+		assert(!hash_check_find(&table, objs[i].key) == !(i & 1));
+
+	assert(hash_str("kmalloc-8") != hash_str("kmalloc-16"));
+	kfree(table.buckets);
+
+	cprintf("[LAB 1] check_hash() succeeded!\n");
+}
+
+/* Checks that the CPU finds its own per-CPU data and runs on its own stack,
+ * which backtraces can walk.
+ */
+static void percpu_check(unsigned cpu, void *arg)
+{
+	volatile uint32_t *nok = arg;
+	uintptr_t top = cpu_kstack_top(cpu), sp = (uintptr_t)&top, rip;
+
+	if (this_cpu_id() != cpu || this_cpu() != cpus + cpu)
+		return;
+
+	if (this_cpu()->cache != page_caches + cpu ||
+	    this_cpu()->log != klog_rings + cpu)
+		return;
+
+	if (cpu != 0 && (sp >= top || sp < top - KSTACK_SIZE))
+		return;
+
+	if (walk_stack(read_rbp(), &rip, 1) != 1)
+		return;
+
+	xadd(nok, 1);
+}
+
+void lab1_check_percpu(void)
+{
+	uint32_t nok = 0;
+	physaddr_t pa;
+	uintptr_t top;
+	size_t i;
+
+	smp_run(percpu_check, &nok);
+	assert(nok == ncpus);
+
+	/* The gap below the stack of every AP is left unmapped. */
+	for (i = 1; i < ncpus; ++i) {
+		top = cpu_kstack_top(i);
+		assert(map_lookup(kernel_pml4, top - PAGE_SIZE, &pa, NULL) == 0);
+		assert(map_lookup(kernel_pml4, top - KSTACK_SIZE - PAGE_SIZE, &pa,
+			NULL) < 0);
+	}
+
+	cprintf("[LAB 1] check_percpu() succeeded!\n");
+}
+
+struct kwork_check {
+	struct kwork work;
+	volatile uint32_t *count;
+	uint32_t runs;
+};
+
+static void kwork_check(void *arg)
+{
+	struct kwork_check *check = arg;
+
+	++check->runs;
+	xadd(check->count, 1);
+}
+
+void lab1_check_kwork(void)
+{
+	struct kwork_check checks[KWORK_CHECK];
+	volatile uint32_t count = 0;
+	size_t i;
+
+	for (i = 0; i < KWORK_CHECK; ++i) {
+		kwork_init_item(&checks[i].work, kwork_check, checks + i);
+		checks[i].count = &count;
+		checks[i].runs = 0;
+		kwork_submit(&checks[i].work);
+	}
+
+	/* Submitting pending work again does not queue it twice. */
+	kwork_submit(&checks[0].work);
+
+	for (i = 0; i < KWORK_CHECK; ++i)
+		kwork_wait(&checks[i].work);
+
+	assert(count == KWORK_CHECK);
+
+	for (i = 0; i < KWORK_CHECK; ++i)
+		assert(checks[i].runs == 1 && !checks[i].work.pending);
+
+	/* Once done, work can be submitted again. */
+	kwork_submit(&checks[0].work);
+	kwork_wait(&checks[0].work);
+	assert(count == KWORK_CHECK + 1 && checks[0].runs == 2);
+	assert(!kwork_run());
+
+	cprintf("[LAB 1] check_kwork() succeeded!\n");
+}
+
+/* Allocates chunks of order 0 and 2 on every CPU at the same time, checks that
+ * no two CPUs got the same memory and returns the chunks.
+ */
+static void smp_alloc_check(unsigned cpu, void *arg)
+{
+	static struct page_info *chunks[NCPUS][SMP_ALLOC_CHECK];
+	struct page_info **pp = chunks[cpu];
+	size_t i, j;
+
+	for (i = 0; i < SMP_ALLOC_CHECK; ++i) {
+		pp[i] = page_alloc_order((i & 1) * 2, 0);
+		assert(pp[i]);
+		memset(page2kva(pp[i]), cpu, PAGE_SIZE << pp[i]->pp_order);
+	}
+
+	for (i = 0; i < SMP_ALLOC_CHECK; ++i) {
+		for (j = 0; j < PAGE_SIZE << pp[i]->pp_order; j += PAGE_SIZE)
+			assert(((uint8_t *)page2kva(pp[i]))[j] == (uint8_t)cpu);
+
+		page_free(pp[i]);
+	}
+}
+
+void lab1_check_smp_alloc(void)
+{
+	size_t nfree = count_total_free_pages() + count_cached_pages() +
+		count_zeroed_pages();
+
+	smp_run(smp_alloc_check, NULL);
+	page_cache_drain_all();
+
+	assert(count_total_free_pages() + count_zeroed_pages() == nfree);
+
+	cprintf("[LAB 1] check_smp_alloc() succeeded!\n");
+}
+
+/* Checks that allocations of different migrate types end up in different
+ * pageblocks, and that huge pages take over the type of the allocation.
+ */
+void lab1_check_migrate(void)
+{
+	struct page_info *movable, *unmovable, *huge;
+	size_t nfree = count_total_free_pages() + count_cached_pages();
+	size_t ncached;
+
+	movable = page_alloc_order(BUDDY_4K_PAGE, ALLOC_MOVABLE);
+	unmovable = page_alloc_order(BUDDY_4K_PAGE, 0);
+	assert(movable && unmovable);
+	assert(page_migrate_type(movable) == MIGRATE_MOVABLE);
+	assert(page_migrate_type(unmovable) == MIGRATE_UNMOVABLE);
+	assert(pageblock_of(movable) != pageblock_of(unmovable));
+
+	huge = page_alloc_order(BUDDY_2M_PAGE, ALLOC_RECLAIMABLE);
+	assert(huge);
+	assert(page_migrate_type(huge) == MIGRATE_RECLAIMABLE);
+
+	/* Movable pages bypass the per-CPU page cache. */
+	ncached = count_cached_pages();
+	page_free(movable);
+	assert(count_cached_pages() == ncached);
+	page_free(unmovable);
+	page_free(huge);
+
+	assert(count_total_free_pages() + count_cached_pages() == nfree);
+
+	cprintf("[LAB 1] check_migrate() succeeded!\n");
+}
+
+/* The number of movable pages allocated by lab1_check_compact(). */
+#define CHECK_COMPACT_PAGES 2048
+
+/* Returns the number of free pageblocks. */
+static size_t count_free_pageblocks(void)
+{
+	size_t order, n = 0;
+
+	for (order = PAGEBLOCK_ORDER; order < BUDDY_MAX_ORDER; ++order)
+		n += count_free_pages(order) << (order - PAGEBLOCK_ORDER);
+
+	return n;
+}
+
+void lab1_check_compact(void)
+{
+	static struct page_info *owners[CHECK_COMPACT_PAGES];
+	struct page_info *pinned;
+	size_t i, nhuge, nblocks;
+
+	for (i = 0; i < CHECK_COMPACT_PAGES; ++i) {
+		assert(page_alloc_movable(BUDDY_4K_PAGE, 0, owners + i));
+		assert(owners[i]->pp_movable);
+		*(size_t *)page2kva(owners[i]) = i;
+	}
+
+	/* Fragment the movable pageblocks by freeing 7 of every 8 pages. */
+	for (i = 0; i < CHECK_COMPACT_PAGES; ++i) {
+		if (i % 8)
+			page_free_movable(owners[i]);
+	}
+
+	assert(count_movable_pages() == CHECK_COMPACT_PAGES / 8);
+
+	/* Some of the free pageblocks may have been split up to hold the pages
+	 * moved out of the pageblocks that were compacted.
+	 */
+	nhuge = count_free_pageblocks();
+	pinned = page_pin_movable(owners);
+	nblocks = compact_memory(BUDDY_MAX_ORDER);
+	assert(nblocks > 0);
+	assert(count_free_pageblocks() > nhuge);
+	assert(count_free_pageblocks() <= nhuge + nblocks);
+
+	/* Pinned pages stay where they are. */
+	assert(owners[0] == pinned);
+	page_unpin_movable(pinned);
+
+	/* The pages that are left may have moved, but still hold their data. */
+	for (i = 0; i < CHECK_COMPACT_PAGES; i += 8) {
+		assert(owners[i]->pp_movable);
+		assert(*(size_t *)page2kva(owners[i]) == i);
+		page_free_movable(owners[i]);
+	}
+
+	assert(count_movable_pages() == 0);
+	page_cache_drain_all();
+	lab1_check_buddy_consistency();
+
+	cprintf("[LAB 1] check_compact() succeeded!\n");
+}
+
+/* Checks that va maps to pa with a page of the given size. */
+static void check_mapped(struct page_table *pml4, uintptr_t va, physaddr_t pa,
+	size_t size)
+{
+	physaddr_t found;
+	size_t found_size;
+
+	assert(map_lookup(pml4, va, &found, &found_size) == 0);
+	assert(found == pa);
+	assert(found_size == size);
+}
+
+void lab1_check_map(void)
+{
+	struct page_info *page;
+	struct page_table *pml4;
+	uintptr_t va, mid;
+	physaddr_t pa, found;
+	size_t len, size;
+
+	page = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	assert(page);
+	pml4 = page2kva(page);
+
+	/* A range that starts and ends with a 4K and a 2M page and has a 1G
+	 * page in the middle, if the CPU supports those.
+	 */
+	va = 3 * PAGE_DIR_SPAN - PAGE_TABLE_SPAN - PAGE_SIZE;
+	pa = 5 * PAGE_DIR_SPAN - PAGE_TABLE_SPAN - PAGE_SIZE;
+	len = PAGE_DIR_SPAN + 2 * PAGE_TABLE_SPAN + 2 * PAGE_SIZE;
+	mid = va + PAGE_SIZE + PAGE_TABLE_SPAN;
+	assert(map_range(pml4, va, pa, len, PAGE_WRITE) == 0);
+
+	check_mapped(pml4, va, pa, PAGE_SIZE);
+	check_mapped(pml4, va + PAGE_SIZE, pa + PAGE_SIZE, PAGE_TABLE_SPAN);
+	assert(map_lookup(pml4, mid, &found, &size) == 0);
+	assert(found == pa + PAGE_SIZE + PAGE_TABLE_SPAN);
+	assert(size == PAGE_DIR_SPAN || size == PAGE_TABLE_SPAN);
+	check_mapped(pml4, va + len - PAGE_SIZE, pa + len - PAGE_SIZE,
+		PAGE_SIZE);
+	check_mapped(pml4, va + len - PAGE_SIZE - PAGE_TABLE_SPAN,
+		pa + len - PAGE_SIZE - PAGE_TABLE_SPAN, PAGE_TABLE_SPAN);
+	assert(map_lookup(pml4, va + len, &found, NULL) < 0);
+	assert(map_lookup(pml4, va - PAGE_SIZE, &found, NULL) < 0);
+
+	/* Unmapping a single page of the huge page only splits the 2M page it
+	 * is part of down to 4K.
+	 */
+	mid += PAGE_DIR_SPAN / 2;
+	pa += PAGE_SIZE + PAGE_TABLE_SPAN + PAGE_DIR_SPAN / 2;
+	assert(unmap_range(pml4, mid, PAGE_SIZE) == 0);
+	assert(map_lookup(pml4, mid, &found, NULL) < 0);
+	check_mapped(pml4, mid - PAGE_SIZE, pa - PAGE_SIZE, PAGE_TABLE_SPAN);
+	check_mapped(pml4, mid + PAGE_SIZE, pa + PAGE_SIZE, PAGE_SIZE);
+	check_mapped(pml4, 3 * PAGE_DIR_SPAN, 5 * PAGE_DIR_SPAN,
+		PAGE_TABLE_SPAN);
+
+	assert(unmap_range(pml4, va, len) == 0);
+	assert(map_lookup(pml4, va, &found, NULL) < 0);
+	assert(map_lookup(pml4, mid + PAGE_SIZE, &found, NULL) < 0);
+	map_destroy(pml4);
+
+	/* The kernel itself is mapped by the direct map. */
+	if (kernel_pml4) {
+		assert(map_lookup(kernel_pml4, (uintptr_t)lab1_check_map,
+			&found, &size) == 0);
+		assert(found == PADDR(lab1_check_map));
+		assert(size >= PAGE_TABLE_SPAN);
+	}
+
+	cprintf("[LAB 1] check_map() succeeded!\n");
+}
+
+void lab1_check_tlb(void)
+{
+	struct page_info *page, *pml4_page;
+	struct page_table *pml4;
+	struct tlb_batch batch;
+	physaddr_t *entry;
+	uintptr_t va = 4 * PAGE_DIR_SPAN;
+	size_t i;
+
+	pml4_page = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	page = page_alloc_order(BUDDY_4K_PAGE, 0);
+	assert(pml4_page && page);
+	pml4 = page2kva(pml4_page);
+	assert(page->pp_ref == 0);
+
+	/* Every mapping holds a reference, and mapping the page at the same
+	 * address again replaces the old mapping.
+	 */
+	assert(page_insert(pml4, page, va, PAGE_WRITE) == 0);
+	assert(page->pp_ref == 1);
+	assert(page_insert(pml4, page, va, PAGE_WRITE) == 0);
+	assert(page->pp_ref == 1);
+	assert(page_insert(pml4, page, va + PAGE_SIZE, 0) == 0);
+	assert(page->pp_ref == 2);
+	assert(page_lookup(pml4, va, &entry) == page);
+	assert(*entry & PAGE_WRITE);
+	assert(page_lookup(pml4, va + 2 * PAGE_SIZE, NULL) == NULL);
+	check_mapped(pml4, va + PAGE_SIZE, page2pa(page), PAGE_SIZE);
+
+	/* The references are only dropped once the batch is flushed. */
+	tlb_batch_init(&batch, pml4);
+	page_remove_batch(&batch, va);
+	page_remove_batch(&batch, va + PAGE_SIZE);
+	page_remove_batch(&batch, va + 2 * PAGE_SIZE);
+	assert(batch.naddrs == 2 && batch.npages == 2 && !batch.full);
+	assert(page->pp_ref == 2);
+	assert(page_lookup(pml4, va, NULL) == NULL);
+
+	/* Hold on to the page to check the count after the flush. */
+	page_get(page);
+	tlb_batch_flush(&batch);
+	assert(page->pp_ref == 1);
+	assert(batch.naddrs == 0 && batch.npages == 0);
+
+	/* Too many pages turn into a full flush. */
+	for (i = 0; i <= TLB_BATCH_MAX; ++i)
+		tlb_batch_add(&batch, va + i * PAGE_SIZE);
+
+	assert(batch.full);
+	tlb_batch_flush(&batch);
+	assert(!batch.full && batch.naddrs == 0);
+
+	page_decref(page);
+	map_destroy(pml4);
+
+	cprintf("[LAB 1] check_tlb() succeeded!\n");
+}
+
+/* Returns the page of the table the entry points to. */
+static struct page_info *pt_page_of(physaddr_t entry)
+{
+	assert(entry & PAGE_PRESENT);
+	return pa2page(PAGE_ADDR(entry));
+}
+
+void lab1_check_pt_pool(void)
+{
+	struct page_info *page, *pdpt, *pd, *pt, *tables[3];
+	struct page_table *pml4, *table;
+	uintptr_t va = 5 * PAGE_DIR_SPAN + 3 * PAGE_TABLE_SPAN;
+	physaddr_t pa = 7 * PAGE_TABLE_SPAN;
+	size_t i, j, npool;
+
+	page = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	assert(page);
+	pml4 = page2kva(page);
+	pt_pool_drain();
+	assert(count_pt_pool_pages() == 0);
+
+	/* Every table counts the entries it has in use. */
+	assert(map_range(pml4, va, pa, 2 * PAGE_SIZE, PAGE_WRITE) == 0);
+	pdpt = pt_page_of(pml4->entries[(va >> PML4_SHIFT) & PAGE_TABLE_MASK]);
+	table = page2kva(pdpt);
+	pd = pt_page_of(table->entries[(va >> PDPT_SHIFT) & PAGE_TABLE_MASK]);
+	table = page2kva(pd);
+	pt = pt_page_of(table->entries[(va >> PAGE_DIR_SHIFT) &
+		PAGE_TABLE_MASK]);
+	assert(pdpt->pp_pt && pd->pp_pt && pt->pp_pt);
+	assert(pdpt->pp_nents == 1 && pd->pp_nents == 1 && pt->pp_nents == 2);
+
+	/* Unmapping everything frees the tables into the pool, which get
+	 * reused by the next mapping.
+	 */
+	assert(unmap_range(pml4, va, PAGE_SIZE) == 0);
+	assert(pt->pp_nents == 1 && count_pt_pool_pages() == 0);
+	assert(unmap_range(pml4, va + PAGE_SIZE, PAGE_SIZE) == 0);
+	assert(count_pt_pool_pages() == 3);
+	assert(pml4->entries[(va >> PML4_SHIFT) & PAGE_TABLE_MASK] == 0);
+
+	/* Splitting fills the new table, and the tables in the pool are all
+	 * zeroes again.
+	 */
+	assert(map_range(pml4, va, 0, PAGE_TABLE_SPAN, PAGE_WRITE) == 0);
+	assert(count_pt_pool_pages() == 1);
+	assert(unmap_range(pml4, va, PAGE_SIZE) == 0);
+	assert(count_pt_pool_pages() == 0);
+	map_destroy(pml4);
+	npool = count_pt_pool_pages();
+	assert(npool == length_of(tables));
+
+	for (i = 0; i < npool; ++i) {
+		tables[i] = pt_alloc();
+		assert(tables[i] && tables[i]->pp_pt && !tables[i]->pp_nents);
+		table = page2kva(tables[i]);
+
+		for (j = 0; j < PAGE_TABLE_ENTRIES; ++j)
+			assert(table->entries[j] == 0);
+	}
+
+	assert(count_pt_pool_pages() == 0);
+
+	for (i = 0; i < npool; ++i)
+		pt_free(tables[i]);
+
+	assert(pt_pool_drain() == npool);
+	assert(count_pt_pool_pages() == 0);
+
+	cprintf("[LAB 1] check_pt_pool() succeeded!\n");
+}
+
+void lab1_check_cow(void)
+{
+	struct page_info *page, *root_a, *root_b, *found;
+	struct page_table *a, *b;
+	physaddr_t *entry;
+	uintptr_t va = 6 * PAGE_DIR_SPAN;
+
+	root_a = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	root_b = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	page = page_alloc_order(BUDDY_4K_PAGE, 0);
+	assert(root_a && root_b && page);
+	a = page2kva(root_a);
+	b = page2kva(root_b);
+	memset(page2kva(page), 0xA5, PAGE_SIZE);
+
+	/* Sharing maps the page read-only in both. */
+	assert(page_insert(a, page, va, PAGE_WRITE) == 0);
+	assert(page_insert(a, page, va + PAGE_SIZE, 0) == 0);
+	assert(cow_share(b, a, va, 2 * PAGE_SIZE) == 0);
+	assert(page->pp_ref == 4);
+	assert(page_lookup(a, va, &entry) == page);
+	assert(!(*entry & PAGE_WRITE) && (*entry & PAGE_COW));
+	assert(page_lookup(b, va, &entry) == page);
+	assert(!(*entry & PAGE_WRITE) && (*entry & PAGE_COW));
+
+	/* Pages that were read-only to begin with stay that way. */
+	assert(page_lookup(b, va + PAGE_SIZE, &entry) == page);
+	assert(!(*entry & PAGE_COW));
+	assert(cow_fault(b, va + PAGE_SIZE) < 0);
+	page_remove(b, va + PAGE_SIZE);
+	page_remove(a, va + PAGE_SIZE);
+
+	/* The first write copies the page. */
+	assert(cow_fault(b, va + 16) == 0);
+	found = page_lookup(b, va, &entry);
+	assert(found && found != page);
+	assert((*entry & PAGE_WRITE) && !(*entry & PAGE_COW));
+	assert(found->pp_ref == 1 && page->pp_ref == 1);
+	assert(memcmp(page2kva(found), page2kva(page), PAGE_SIZE) == 0);
+
+	/* The last mapping gets the page back without a copy. */
+	assert(cow_fault(a, va) == 0);
+	assert(page_lookup(a, va, &entry) == page);
+	assert((*entry & PAGE_WRITE) && !(*entry & PAGE_COW));
+	assert(cow_fault(a, va) == 0);
+
+	page_remove(a, va);
+	page_remove(b, va);
+	map_destroy(a);
+	map_destroy(b);
+
+	cprintf("[LAB 1] check_cow() succeeded!\n");
+}
+
+/* Takes and drops references to the shared page on every CPU at once. */
+static void page_ref_check(unsigned cpu, void *arg)
+{
+	struct page_info *page = arg;
+	size_t i;
+
+	for (i = 0; i < PAGE_REF_CHECK; ++i) {
+		page_get(page);
+		page_get(page);
+		page_put(page);
+	}
+
+	for (i = 0; i < PAGE_REF_CHECK; ++i)
+		page_put(page);
+}
+
+void lab1_check_page_ref(void)
+{
+	struct page_info *page;
+	size_t nfree;
+
+	page_cache_drain_all();
+	nfree = count_total_free_pages() + count_cached_pages();
+	page = page_alloc_order(BUDDY_4K_PAGE, 0);
+	assert(page);
+
+	/* More references than the old 16-bit counter could hold. */
+	page_get(page);
+	smp_run(page_ref_check, page);
+	assert(page->pp_ref == 1);
+
+	/* The last reference frees the page, but only with the next batch. */
+	page_put(page);
+	assert(count_total_free_pages() + count_cached_pages() == nfree);
+	assert(page_caches[this_cpu_id()].ndeferred == 1);
+	page_cache_drain_all();
+	assert(page_caches[this_cpu_id()].ndeferred == 0);
+	assert(count_total_free_pages() == nfree);
+
+	cprintf("[LAB 1] check_page_ref() succeeded!\n");
+}
+
+void lab1_check_lazy(void)
+{
+	struct page_info *root, *page;
+	struct page_table *pml4;
+	physaddr_t *entry, pa, zero;
+	uintptr_t va = 8 * PAGE_DIR_SPAN - 2 * PAGE_SIZE;
+	size_t len = HPAGE_SIZE + 4 * PAGE_SIZE, size;
+	int level;
+
+	root = page_alloc_order(BUDDY_4K_PAGE, ALLOC_ZERO);
+	assert(root);
+	pml4 = page2kva(root);
+
+	/* Every page reads from the zero page, the aligned part as a huge page. */
+	assert(lazy_map(pml4, va, len, PAGE_WRITE) == 0);
+	assert(map_lookup(pml4, va, &zero, &size) == 0 && size == PAGE_SIZE);
+	assert(map_lookup(pml4, va + 2 * PAGE_SIZE, &pa, &size) == 0);
+	assert(size == HPAGE_SIZE && pa == ROUNDDOWN(zero, HPAGE_SIZE));
+	entry = map_find(pml4, va + 2 * PAGE_SIZE, &level);
+	assert(!(*entry & PAGE_WRITE) && (*entry & PAGE_LAZY));
+
+	/* The first write to a small page gets it a page of its own. */
+	assert(lazy_fault(pml4, va + PAGE_SIZE + 8) == 0);
+	page = page_lookup(pml4, va + PAGE_SIZE, &entry);
+	assert(page && page2pa(page) - ROUNDDOWN(zero, HPAGE_SIZE) >=
+		HPAGE_SIZE);
+	assert((*entry & PAGE_WRITE) && !(*entry & PAGE_LAZY));
+	assert(page->pp_ref == 1);
+	assert(((uint64_t *)page2kva(page))[1] == 0);
+	assert(lazy_fault(pml4, va + PAGE_SIZE) < 0);
+
+	/* The huge page gets a huge page, if there is one. */
+	assert(lazy_fault(pml4, va + HPAGE_SIZE) == 0);
+	assert(map_lookup(pml4, va + 2 * PAGE_SIZE, &pa, &size) == 0);
+	assert(size == HPAGE_SIZE || size == PAGE_SIZE);
+	assert(pa - ROUNDDOWN(zero, HPAGE_SIZE) >= HPAGE_SIZE);
+	entry = map_find(pml4, va + HPAGE_SIZE, &level);
+	assert((*entry & PAGE_WRITE) && !(*entry & PAGE_LAZY));
+
+	lazy_unmap(pml4, va, len);
+	assert(map_lookup(pml4, va, &pa, NULL) < 0);
+	assert(map_lookup(pml4, va + HPAGE_SIZE, &pa, NULL) < 0);
+	assert(map_lookup(pml4, va + len - PAGE_SIZE, &pa, NULL) < 0);
+	map_destroy(pml4);
+
+	cprintf("[LAB 1] check_lazy() succeeded!\n");
+}
+
+void lab1_check_ktime(void)
+{
+	uint64_t start, end;
+
+	assert(tsc_khz > 0);
+
+	start = ktime_ns();
+	udelay(1000);
+	end = ktime_ns();
+	assert(end - start >= NSEC_PER_MSEC);
+	assert(tsc_to_ns(tsc_khz * 1000) == NSEC_PER_SEC ||
+	       tsc_to_ns(tsc_khz * 1000) + 1 == NSEC_PER_SEC);
+
+	cprintf("[LAB 1] check_ktime() succeeded!\n");
+}
+
+/* Counts the number of flushes and the characters flushed. */
+static void count_puts(const char *s, size_t n, void *putdat)
+{
+	size_t *counts = putdat;
+
+	++counts[0];
+	counts[1] += n;
+}
+
+void lab1_check_printfmt(void)
+{
+	char buf[32], span[16];
+	struct printbuf pb = PRINTBUF_INIT(span, sizeof span, count_puts, NULL);
+	size_t counts[2] = { 0, 0 };
+	int n;
+
+	n = snprintf(buf, sizeof buf, "%u %d %x %o %lu", 0, -1234567, 0xbeef, 8,
+		18446744073709551615UL);
+	assert(n == 39);
+	assert(strcmp(buf, "0 -1234567 beef 10 184467440737") == 0);
+
+	snprintf(buf, sizeof buf, "[%5d|%-5s|%05x|%.2s|%p]", 42, "ab", 0xa, "xyz",
+		(void *)0x1000);
+	assert(strcmp(buf, "[   42|ab   |0000a|xy|0x1000]") == 0);
+
+	/* Short strings are collected in the span and flushed once. */
+	pb.putdat = counts;
+	n = bprintfmt(&pb, "%s %u", "abc", 100);
+	assert(n == 7 && counts[0] == 1 && counts[1] == 7);
+
+	/* Strings larger than the span bypass it. */
+	counts[0] = counts[1] = 0;
+	n = bprintfmt(&pb, "%s", "a string larger than the span");
+	assert(n == 29 && counts[0] == 1 && counts[1] == 29);
+
+	cprintf("[LAB 1] check_printfmt() succeeded!\n");
+}
+
+void lab1_check_klog(void)
+{
+	struct klog_reader reader;
+	struct klog_rec rec;
+	char text[KLOG_MAX_TEXT], buf[32];
+	size_t i, n, first = 0, last = 0;
+	uint64_t time = 0;
+
+	/* Records above the console level stay out of the console. Log more
+	 * than fits, such that the ring wraps around.
+	 */
+	for (i = 0; i < 2 * KLOG_SIZE / 32; ++i)
+		klog(KLOG_DEBUG, "klog %05u\n", i);
+
+	klog_reader_init(&reader);
+	n = 0;
+
+	while (klog_reader_next(&reader, &rec, text)) {
+		assert(rec.time >= time);
+		time = rec.time;
+
+		if (rec.level != KLOG_DEBUG)
+			continue;
+
+		assert(rec.len == 11 && memcmp(text, "klog ", 5) == 0);
+		memcpy(buf, text + 5, 5);
+		buf[5] = '\0';
+		last = strtol(buf, NULL, 10);
+
+		if (!n++)
+			first = last;
+		else
+			assert(last == first + n - 1);
+	}
+
+	/* The oldest records got overwritten, the latest ones are there. */
+	assert(first > 0);
+	assert(last == i - 1);
+
+	cprintf("[LAB 1] check_klog() succeeded!\n");
+}
+
+static int static_call_one(int x)
+{
+	return x + 1;
+}
+
+static int static_call_two(int x)
+{
+	return x + 2;
+}
+
+DEFINE_STATIC_CALL(static_call_check, static_call_one);
+
+void lab1_check_static_call(void)
+{
+	uint32_t ebx;
+
+	/* The features got probed from the boot CPU. */
+	if (cpu_has(CPU_FEATURE_ERMS)) {
+		cpuid_count(7, 0, NULL, &ebx, NULL, NULL);
+		assert(ebx & CPUID_7_EBX_ERMS);
+	}
+
+	assert(static_call(static_call_check)(1) == 2);
+	static_call_update(static_call_check, static_call_two);
+	assert(static_call(static_call_check)(1) == 3);
+	static_call_update(static_call_check, static_call_one);
+	assert(static_call(static_call_check)(1) == 2);
+
+	cprintf("[LAB 1] check_static_call() succeeded!\n");
+}
+
+#ifdef MEM_TRACE
+/* Sums up the latency histograms of all CPUs for the operation and order. */
+static size_t count_traced(unsigned op, size_t order)
+{
+	size_t i, bucket, n = 0;
+
+	for (i = 0; i < ncpus; ++i) {
+		for (bucket = 0; bucket < MEM_TRACE_NBUCKETS; ++bucket)
+			n += mem_traces[i].latency[op][order][bucket];
+	}
+
+	return n;
+}
+
+void lab1_check_mem_trace(void)
+{
+	struct page_info *page;
+
+	mem_trace_reset();
+
+	page = page_alloc_order(BUDDY_2M_PAGE, 0);
+	assert(page);
+	page_free(page);
+
+	/* There may be enough memory for a 1G page. */
+	page = page_alloc_order(BUDDY_1G_PAGE, 0);
+
+	if (page)
+		page_free(page);
+	else
+		assert(mem_traces[this_cpu_id()].failed[BUDDY_1G_PAGE] == 1);
+
+	assert(count_traced(MEM_TRACE_ALLOC, BUDDY_2M_PAGE) == 1);
+	assert(count_traced(MEM_TRACE_FIND, BUDDY_2M_PAGE) >= 1);
+	assert(count_traced(MEM_TRACE_FREE, BUDDY_2M_PAGE) == 1);
+
+	cprintf("[LAB 1] check_mem_trace() succeeded!\n");
+}
+#endif
+
 void lab1_check_mem(struct boot_info *boot_info)
 {
 	lab1_check_free_list_avail();
 	lab1_check_free_list_order();
 	lab1_check_memory_layout(boot_info);
+	lab1_check_boot_regions(boot_info);
 	lab1_check_buddy_consistency();
 	lab1_check_split_and_merge(0);
 #ifdef BONUS_LAB1
 	lab1_check_split_and_merge(ALLOC_HUGE);
 #endif
-
+	lab1_check_page_cache();
+	lab1_check_zero_pool();
+	lab1_check_bulk();
+	lab1_check_alloc_order();
+	lab1_check_slab();
+	lab1_check_kmalloc();
+	lab1_check_arena();
+	lab1_check_interval_tree();
+	lab1_check_rb_build();
+	lab1_check_hash();
+	lab1_check_percpu();
+	lab1_check_kwork();
+	lab1_check_smp_alloc();
+	lab1_check_migrate();
+	lab1_check_compact();
+	lab1_check_map();
+	lab1_check_tlb();
+	lab1_check_pt_pool();
+	lab1_check_cow();
+	lab1_check_page_ref();
+	lab1_check_lazy();
+	lab1_check_ktime();
+	lab1_check_printfmt();
+	lab1_check_klog();
+	lab1_check_static_call();
+#ifdef MEM_TRACE
+	lab1_check_mem_trace();
+#endif
 }
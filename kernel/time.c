@@ -0,0 +1,138 @@
+#include <types.h>
+#include <stdio.h>
+
+#include <x86-64/asm.h>
+
+#include <kernel/time.h>
+
+/* Channel 0 of the PIT raises IRQ 0. */
+#define PIT_CH0 0x40
+#define PIT_CMD_CH0_MODE2 0x34
+
+/* Channel 2 of the PIT is wired to the PC speaker. Its gate and output can be
+ * controlled and read through port 0x61, which lets us poll it without having
+ * to set up interrupts.
+ */
+#define PIT_CH2 0x42
+#define PIT_CMD 0x43
+#define PIT_CMD_CH2_MODE0 0xB0
+#define PIT_PORT_B 0x61
+#define PIT_PORT_B_GATE2 0x01
+#define PIT_PORT_B_SPEAKER 0x02
+#define PIT_PORT_B_OUT2 0x20
+
+/* An upper bound on the number of polls while waiting for the PIT, in case
+ * there is none.
+ */
+#define PIT_MAX_POLLS 1000000
+
+uint64_t tsc_khz;
+uint64_t tsc_ns_mult;
+uint64_t tsc_base;
+
+/* Counts down from ms milliseconds on channel 2 of the PIT and measures how
+ * many TSC cycles that takes.
+ *
+ * Returns the TSC frequency in kHz or 0 if the PIT never fired.
+ */
+static uint64_t pit_calibrate_tsc(unsigned ms)
+{
+	uint32_t latch = PIT_HZ * ms / 1000;
+	uint64_t start, end;
+	size_t i;
+
+	/* Raise the gate of channel 2, but keep the speaker quiet. */
+	outb(PIT_PORT_B, (inb(PIT_PORT_B) & ~PIT_PORT_B_SPEAKER) |
+		PIT_PORT_B_GATE2);
+
+	/* In mode 0, OUT2 goes high once the counter reaches zero. */
+	outb(PIT_CMD, PIT_CMD_CH2_MODE0);
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	start = read_tsc();
+
+	for (i = 0; i < PIT_MAX_POLLS; ++i) {
+		if (inb(PIT_PORT_B) & PIT_PORT_B_OUT2)
+			break;
+	}
+
+	end = read_tsc();
+
+	if (i == PIT_MAX_POLLS)
+		return 0;
+
+	return (end - start) / ms;
+}
+
+/* Asks the CPU for its base frequency through CPUID leaf 0x16.
+ *
+ * Returns the frequency in kHz or 0 if the CPU does not tell.
+ */
+static uint64_t cpuid_tsc_khz(void)
+{
+	uint32_t max_leaf, mhz;
+
+	cpuid(0, &max_leaf, NULL, NULL, NULL);
+
+	if (max_leaf < 0x16)
+		return 0;
+
+	cpuid(0x16, &mhz, NULL, NULL, NULL);
+
+	return (uint64_t)(mhz & 0xFFFF) * 1000;
+}
+
+/* Measures the frequency of the TSC against the PIT, falling back to what
+ * CPUID reports. This does not need the console, so it can run first thing
+ * during boot.
+ */
+void tsc_init(void)
+{
+	tsc_khz = pit_calibrate_tsc(TSC_CALIBRATE_MS);
+
+	if (!tsc_khz)
+		tsc_khz = cpuid_tsc_khz();
+
+	/* Better a clock that is off than none at all. */
+	if (!tsc_khz)
+		tsc_khz = 1000000;
+
+	tsc_ns_mult = (NSEC_PER_MSEC << 32) / tsc_khz;
+	tsc_base = read_tsc();
+}
+
+/* Programs channel 0 of the PIT to raise IRQ 0 hz times per second, as far as
+ * the 16-bit divisor allows.
+ */
+void pit_start_periodic(unsigned hz)
+{
+	uint32_t latch = PIT_HZ / hz;
+
+	if (latch > 0xFFFF)
+		latch = 0xFFFF;
+
+	outb(PIT_CMD, PIT_CMD_CH0_MODE2);
+	outb(PIT_CH0, latch & 0xFF);
+	outb(PIT_CH0, latch >> 8);
+}
+
+/* Spins for at least us microseconds. Before the TSC has been calibrated, every
+ * access to the POST diagnostics port is taken to be about a microsecond.
+ */
+void udelay(unsigned us)
+{
+	uint64_t end;
+
+	if (!tsc_ns_mult) {
+		while (us--)
+			inb(0x80);
+
+		return;
+	}
+
+	end = ktime_ns() + us * NSEC_PER_USEC;
+
+	while (ktime_ns() < end)
+		pause();
+}
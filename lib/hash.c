@@ -0,0 +1,109 @@
+#include <types.h>
+#include <hash.h>
+
+/* Hashes a string using FNV-1a. */
+uint64_t hash_str(const char *s)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *s; ++s) {
+		hash ^= (unsigned char)*s;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* Sets up an empty table using the array of nbuckets buckets, where nbuckets
+ * is a power of two.
+ */
+void hash_init(struct hash_table *table, struct hash_node **buckets,
+	size_t nbuckets)
+{
+	size_t i;
+
+	for (i = 0; i < nbuckets; ++i)
+		buckets[i] = NULL;
+
+	table->buckets = buckets;
+	table->nbuckets = nbuckets;
+	table->count = 0;
+}
+
+/* Adds the node to the head of its bucket. The node is fully set up before
+ * it becomes visible to readers.
+ */
+void hash_insert(struct hash_table *table, struct hash_node *node,
+	uint64_t hash)
+{
+	struct hash_node **bucket = table->buckets +
+		(hash & (table->nbuckets - 1));
+
+	node->hash = hash;
+	node->next = *bucket;
+	__atomic_store_n(bucket, node, __ATOMIC_RELEASE);
+	++table->count;
+}
+
+/* Unlinks the node from its bucket. Readers currently at the node can still
+ * follow its next pointer.
+ *
+ * Returns -1 if the node is not in the table.
+ */
+int hash_remove(struct hash_table *table, struct hash_node *node)
+{
+	struct hash_node **link = table->buckets +
+		(node->hash & (table->nbuckets - 1));
+
+	for (; *link; link = &(*link)->next) {
+		if (*link == node) {
+			__atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+			--table->count;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Looks up a node with the given hash for which match() returns non-zero.
+ *
+ * Returns the node or NULL if there is no such node.
+ */
+struct hash_node *hash_find(struct hash_table *table, uint64_t hash,
+	const void *key, int (*match)(const void *key, struct hash_node *node))
+{
+	struct hash_node *node;
+
+	for (node = hash_bucket_head(table, hash); node;
+	     node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) {
+		if (node->hash == hash && match(key, node))
+			return node;
+	}
+
+	return NULL;
+}
+
+/* Moves all nodes over to the new array of nbuckets buckets, where nbuckets
+ * is a power of two. The hashes are stored in the nodes, so nothing is hashed
+ * again.
+ *
+ * Returns the old array of buckets, such that the caller can free it.
+ */
+struct hash_node **hash_resize(struct hash_table *table,
+	struct hash_node **buckets, size_t nbuckets)
+{
+	struct hash_node **old = table->buckets, *node, *next;
+	size_t i, old_nbuckets = table->nbuckets;
+
+	hash_init(table, buckets, nbuckets);
+
+	for (i = 0; i < old_nbuckets; ++i) {
+		for (node = old[i]; node; node = next) {
+			next = node->next;
+			hash_insert(table, node, node->hash);
+		}
+	}
+
+	return old;
+}
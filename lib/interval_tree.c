@@ -0,0 +1,139 @@
+#include <types.h>
+#include <interval_tree.h>
+
+static void interval_augment(struct rb_node *node)
+{
+	struct interval *interval = interval_of(node);
+	struct interval *child;
+	size_t i;
+
+	interval->max_end = interval->end;
+
+	for (i = 0; i < 2; ++i) {
+		child = interval_of(node->child[i]);
+
+		if (child && child->max_end > interval->max_end)
+			interval->max_end = child->max_end;
+	}
+}
+
+static int interval_cmp(struct rb_node *lhs, struct rb_node *rhs)
+{
+	uintptr_t a = interval_of(lhs)->start, b = interval_of(rhs)->start;
+
+	return (a > b) - (a < b);
+}
+
+void interval_tree_init(struct rb_tree *tree)
+{
+	rb_init_augmented(tree, interval_augment);
+}
+
+/* Builds the tree from an array of intervals sorted by start address in O(n).
+ * The tree must be empty.
+ */
+int interval_tree_build(struct rb_tree *tree, struct interval *intervals,
+	size_t n)
+{
+	return rb_build(tree, intervals, n, sizeof *intervals,
+		offsetof(struct interval, node));
+}
+
+int interval_insert(struct rb_tree *tree, struct interval *interval)
+{
+	interval->max_end = interval->end;
+
+	return rb_insert(tree, &interval->node, interval_cmp);
+}
+
+int interval_remove(struct rb_tree *tree, struct interval *interval)
+{
+	return rb_remove(tree, &interval->node);
+}
+
+static inline int interval_overlaps(struct interval *interval,
+	uintptr_t start, uintptr_t end)
+{
+	return interval->start < end && start < interval->end;
+}
+
+/* Looks up the interval with the lowest start address that overlaps
+ * [start, end). If the left subtree of a node ends past start, it either holds
+ * the overlap or all of its intervals start at or past end, in which case
+ * neither the node nor its right subtree can overlap.
+ *
+ * Returns the interval or NULL if none overlaps.
+ */
+struct interval *interval_first_overlap(struct rb_tree *tree, uintptr_t start,
+	uintptr_t end)
+{
+	struct rb_node *node = tree->root;
+	struct interval *interval, *left;
+
+	while (node) {
+		interval = interval_of(node);
+		left = interval_of(node->child[RB_LEFT]);
+
+		if (left && left->max_end > start) {
+			node = &left->node;
+			continue;
+		}
+
+		if (interval_overlaps(interval, start, end))
+			return interval;
+
+		if (interval->start >= end)
+			return NULL;
+
+		node = node->child[RB_RIGHT];
+	}
+
+	return NULL;
+}
+
+/* Looks up the next interval after the given one, in order of start address,
+ * that overlaps [start, end).
+ *
+ * Returns the interval or NULL if there are no more overlapping intervals.
+ */
+struct interval *interval_next_overlap(struct interval *interval,
+	uintptr_t start, uintptr_t end)
+{
+	struct rb_node *node = &interval->node;
+	struct interval *right;
+
+	for (;;) {
+		/* Skip the right subtree if nothing in it ends past start. */
+		right = interval_of(node->child[RB_RIGHT]);
+
+		if (right && right->max_end > start) {
+			node = rb_next(node);
+		} else {
+			while (node->parent &&
+			       node->parent->child[RB_RIGHT] == node)
+				node = node->parent;
+
+			node = node->parent;
+		}
+
+		if (!node)
+			return NULL;
+
+		interval = interval_of(node);
+
+		if (interval->start >= end)
+			return NULL;
+
+		if (interval_overlaps(interval, start, end))
+			return interval;
+	}
+}
+
+/* Looks up the interval with the lowest start address that contains addr.
+ *
+ * Returns the interval or NULL if no interval contains addr.
+ */
+struct interval *interval_find(struct rb_tree *tree, uintptr_t addr)
+{
+	return interval_first_overlap(tree, addr, addr + 1);
+}
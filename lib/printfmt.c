@@ -30,24 +30,141 @@ static const char * const error_string[] = {
 	[EPERM] = "Operation not permitted",
 };
 
-/*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+/* Hands the characters collected in the span to puts, unless the output is
+ * truncated to the span.
+ */
+static void pb_flush(struct printbuf *pb)
+{
+	if (!pb->puts || !pb->len)
+		return;
+
+	pb->puts(pb->buf, pb->len, pb->putdat);
+	pb->len = 0;
+}
+
+/* Appends n characters to the span, flushing it whenever it fills up. Strings
+ * that are at least as large as the span are handed to puts directly.
+ */
+static void pb_write(struct printbuf *pb, const char *s, size_t n)
+{
+	size_t count;
+
+	pb->cnt += n;
+
+	if (pb->puts && n >= pb->size) {
+		pb_flush(pb);
+		pb->puts(s, n, pb->putdat);
+		return;
+	}
+
+	while (n > 0) {
+		if (pb->len == pb->size) {
+			if (!pb->puts)
+				return;
+
+			pb_flush(pb);
+		}
+
+		count = MIN(n, pb->size - pb->len);
+		memcpy(pb->buf + pb->len, s, count);
+		pb->len += count;
+		s += count;
+		n -= count;
+	}
+}
+
+/* Appends n copies of the character to the span. */
+static void pb_fill(struct printbuf *pb, int c, size_t n)
+{
+	size_t count;
+
+	pb->cnt += n;
+
+	while (n > 0) {
+		if (pb->len == pb->size) {
+			if (!pb->puts)
+				return;
+
+			pb_flush(pb);
+		}
+
+		count = MIN(n, pb->size - pb->len);
+		memset(pb->buf + pb->len, c, count);
+		pb->len += count;
+		n -= count;
+	}
+}
+
+static const char digits[] = "0123456789abcdef";
+
+/* The decimal digits of 0 to 99, such that decimal numbers are converted two
+ * digits per division.
+ */
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Converts the number to digits that end at end. Bases other than 10 have to
+ * be 8 or 16, which are converted by shifting.
+ *
+ * Returns the number of digits.
  */
-static void printnum(void (*putch)(int, void*), void *putdat,
-	 unsigned long long num, unsigned base, int width, int padc)
+static size_t fmtnum(char *end, unsigned long long num, unsigned base)
 {
-	/* First recursively print all preceding (more significant) digits. */
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
+	unsigned shift = base == 16 ? 4 : 3;
+	char *p = end;
+	unsigned r;
+
+	if (base != 10) {
+		do {
+			*--p = digits[num & (base - 1)];
+			num >>= shift;
+		} while (num);
+
+		return end - p;
+	}
+
+	while (num >= 100) {
+		r = num % 100;
+		num /= 100;
+		p -= 2;
+		p[0] = digit_pairs[2 * r];
+		p[1] = digit_pairs[2 * r + 1];
+	}
+
+	if (num >= 10) {
+		p -= 2;
+		p[0] = digit_pairs[2 * num];
+		p[1] = digit_pairs[2 * num + 1];
 	} else {
-		/* print any needed pad characters before first digit. */
-		while (--width > 0)
-			putch(padc, putdat);
+		*--p = '0' + num;
 	}
 
-	/* Then print this (the least significant) digit. */
-	putch("0123456789abcdef"[num % base], putdat);
+	return end - p;
+}
+
+/* Prints a number, preceded by padding up to the width. */
+static void printnum(struct printbuf *pb, unsigned long long num,
+	unsigned base, int width, int padc)
+{
+	/* Enough for a 64-bit number in octal. */
+	char buf[24];
+	size_t n;
+
+	n = fmtnum(buf + sizeof buf, num, base);
+
+	if (width > 0 && (size_t)width > n)
+		pb_fill(pb, padc, width - n);
+
+	pb_write(pb, buf + sizeof buf - n, n);
 }
 
 /*
@@ -78,26 +195,36 @@ static long long getint(va_list *ap, int lflag)
 }
 
 
-/* Main function to format and print a string. */
-void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
-
-void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
-		va_list tmp_ap)
+/* Formats the string into the span of the printbuf, flushing it to its puts
+ * callback whenever it fills up and once done. If puts is NULL, the output is
+ * truncated to the span instead.
+ *
+ * Returns the number of characters of the full output.
+ */
+int vbprintfmt(struct printbuf *pb, const char *fmt, va_list tmp_ap)
 {
+	int cnt = pb->cnt;
 	va_list ap;
 	register const char *p;
 	register int ch, err;
 	unsigned long long num;
 	int base, lflag, width, precision, altflag;
 	char padc;
+	size_t n;
 
 	va_copy(ap, tmp_ap);
 
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
+		/* Copy the text up to the next %-escape sequence in one go. */
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; ++fmt)
+			;
+
+		pb_write(pb, p, fmt - p);
+
+		if (*fmt++ == '\0') {
+			va_end(ap);
+			pb_flush(pb);
+			return pb->cnt - cnt;
 		}
 
 		/* Process a %-escape sequence. */
@@ -162,7 +289,7 @@ void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 
 		/* character */
 		case 'c':
-			putch(va_arg(ap, int), putdat);
+			pb_fill(pb, va_arg(ap, int), 1);
 			break;
 
 		/* error message */
@@ -170,34 +297,36 @@ void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 			err = va_arg(ap, int);
 			if (err < 0)
 				err = -err;
-			if (err >= length_of(error_string) || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
+			if (err >= length_of(error_string) || (p = error_string[err]) == NULL) {
+				pb_write(pb, "error ", 6);
+				printnum(pb, err, 10, -1, ' ');
+			} else {
+				pb_write(pb, p, strlen(p));
+			}
 			break;
 
 		/* string */
 		case 's':
 			if ((p = va_arg(ap, char *)) == NULL)
 				p = "(null)";
-			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
-					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0);
-					width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
-			for (; width > 0; width--)
-				putch(' ', putdat);
+			n = strnlen(p, precision < 0 ? SIZE_MAX : precision);
+			if (width > 0 && padc != '-' && (size_t)width > n)
+				pb_fill(pb, padc, width - n);
+			if (altflag) {
+				for (; n > 0; --n, ++p)
+					pb_write(pb, *p < ' ' || *p > '~' ? "?" : p, 1);
+			} else {
+				pb_write(pb, p, n);
+			}
+			if (padc == '-' && width > 0 && (size_t)width > n)
+				pb_fill(pb, ' ', width - n);
 			break;
 
 		/* (signed) decimal */
 		case 'd':
 			num = getint(&ap, lflag);
 			if ((long long) num < 0) {
-				putch('-', putdat);
+				pb_write(pb, "-", 1);
 				num = -(long long) num;
 			}
 			base = 10;
@@ -217,8 +346,7 @@ void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 
 		/* pointer */
 		case 'p':
-			putch('0', putdat);
-			putch('x', putdat);
+			pb_write(pb, "0x", 2);
 			num = (unsigned long long)
 				(uintptr_t) va_arg(ap, void *);
 			base = 16;
@@ -229,17 +357,17 @@ void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 			num = getuint(&ap, lflag);
 			base = 16;
 		number:
-			printnum(putch, putdat, num, base, width, padc);
+			printnum(pb, num, base, width, padc);
 			break;
 
 		/* escaped '%' character */
 		case '%':
-			putch(ch, putdat);
+			pb_write(pb, "%", 1);
 			break;
 
 		/* unrecognized escape sequence - just print it literally */
 		default:
-			putch('%', putdat);
+			pb_write(pb, "%", 1);
 			for (fmt--; fmt[-1] != '%'; fmt--)
 				/* do nothing */;
 			break;
@@ -247,42 +375,66 @@ void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
 	}
 }
 
-void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...)
+int bprintfmt(struct printbuf *pb, const char *fmt, ...)
 {
 	va_list ap;
+	int cnt;
 
 	va_start(ap, fmt);
-	vprintfmt(putch, putdat, fmt, ap);
+	cnt = vbprintfmt(pb, fmt, ap);
 	va_end(ap);
+
+	return cnt;
 }
 
-struct sprintbuf {
-	char *buf;
-	char *ebuf;
-	int cnt;
+/* Adapts the characters flushed by a printbuf to a putch callback. */
+struct putchbuf {
+	void (*putch)(int, void*);
+	void *putdat;
 };
 
-static void sprintputch(int ch, struct sprintbuf *b)
+static void putch_puts(const char *s, size_t n, void *dat)
+{
+	struct putchbuf *b = dat;
+
+	while (n-- > 0)
+		b->putch(*s++, b->putdat);
+}
+
+void vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt,
+		va_list ap)
+{
+	struct putchbuf b = { putch, putdat };
+	char buf[PRINTBUF_SIZE];
+	struct printbuf pb = PRINTBUF_INIT(buf, sizeof buf, putch_puts, &b);
+
+	vbprintfmt(&pb, fmt, ap);
+}
+
+void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...)
 {
-	b->cnt++;
-	if (b->buf < b->ebuf)
-		*b->buf++ = ch;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintfmt(putch, putdat, fmt, ap);
+	va_end(ap);
 }
 
 int vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 {
-	struct sprintbuf b = {buf, buf+n-1, 0};
+	struct printbuf pb;
 
 	if (buf == NULL || n < 1)
 		return -EINVAL;
 
-	/* Print the string to the buffer. */
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	/* Leave room for the null terminator. */
+	pb = (struct printbuf)PRINTBUF_INIT(buf, n - 1, NULL, NULL);
+	vbprintfmt(&pb, fmt, ap);
 
 	/* Null terminate the buffer. */
-	*b.buf = '\0';
+	buf[pb.len] = '\0';
 
-	return b.cnt;
+	return pb.cnt;
 }
 
 int snprintf(char *buf, int n, const char *fmt, ...)
@@ -296,5 +448,3 @@ int snprintf(char *buf, int n, const char *fmt, ...)
 
 	return rc;
 }
-
-
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <string.h>
 
 #include <rbtree.h>
@@ -22,6 +23,12 @@ static void rotate_node(struct rb_tree *tree, struct rb_node *node,
 	}
 
 	node->parent = child;
+
+	/* The node is now the child of its former child. */
+	if (tree->augment) {
+		tree->augment(node);
+		tree->augment(child);
+	}
 }
 
 static struct rb_node *get_outermost(struct rb_node *node,
@@ -116,120 +123,136 @@ int rb_balance(struct rb_tree *tree, struct rb_node *node)
 	return 0;
 }
 
-static int do_remove(struct rb_tree *tree,
-	struct rb_node *node)
+static inline int is_black(struct rb_node *node)
 {
-	struct rb_node *parent, *child;
-	enum rb_dir dir, child_dir;
-
-	if (!tree || !node)
-		return -1;
-
-	parent = node->parent;
-
-	if (node->child[RB_LEFT] && node->child[RB_RIGHT]) {
-		child = node->child[RB_LEFT];
-		child = get_outermost(child, RB_RIGHT);
-		do_remove(tree, child);
-
-		child->child[RB_LEFT] = node->child[RB_LEFT];
-
-		if (node->child[RB_LEFT])
-			node->child[RB_LEFT]->parent = child;
-
-		child->child[RB_RIGHT] = node->child[RB_RIGHT];
+	return !node || node->color == RB_BLACK;
+}
 
-		if (node->child[RB_RIGHT])
-			node->child[RB_RIGHT]->parent = child;
-	} else {
-		child_dir = !node->child[RB_LEFT];
-		child = node->child[child_dir];
-	}
+/* Replaces the node with child in the eyes of the parent of the node. */
+static void replace_child(struct rb_tree *tree, struct rb_node *node,
+	struct rb_node *child)
+{
+	struct rb_node *parent = node->parent;
 
-	if (parent) {
-		dir = parent->child[RB_RIGHT] == node;
-		parent->child[dir] = child;
-	} else {
+	if (parent)
+		parent->child[parent->child[RB_RIGHT] == node] = child;
+	else
 		tree->root = child;
-	}
 
 	if (child)
 		child->parent = parent;
-
-	memset(node, 0, sizeof *node);
-
-	return 0;
 }
 
-int rb_remove(struct rb_tree *tree, struct rb_node *node)
+/* Recalculates the augmented data of the node and its ancestors. */
+void rb_augment_propagate(struct rb_tree *tree, struct rb_node *node)
 {
-	struct rb_node *sibling, *child, *other;
-	enum rb_dir dir, child_dir;
-
-	if (!tree || !node)
-		return -1;
-
-	child_dir = !node->child[RB_LEFT];
-	child = node->child[child_dir];
-	other = node->child[!child_dir];
-
-	do_remove(tree, node);
-
-	if (!child && !other)
-		return 0;
-
-	if (node->color == RB_RED)
-		return 0;
+	if (!tree->augment)
+		return;
 
-	node = child;
-
-	if (node->color == RB_RED) {
-		node->color = RB_BLACK;
-		return 0;
-	}
+	for (; node; node = node->parent)
+		tree->augment(node);
+}
 
-	while (node->parent) {
-		dir = node->parent->child[RB_LEFT] == node;
-		sibling = node->parent->child[dir];
+/* Restores the red-black properties after a black node has been removed from
+ * the side dir of parent, where node is the node that took its place, if any.
+ */
+static void remove_fixup(struct rb_tree *tree, struct rb_node *node,
+	struct rb_node *parent, enum rb_dir dir)
+{
+	struct rb_node *sibling;
 
-		if (!sibling) {
-			break;
-		}
+	while (parent && is_black(node)) {
+		sibling = parent->child[!dir];
 
 		if (sibling->color == RB_RED) {
-			node->parent->color = RB_RED;
 			sibling->color = RB_BLACK;
-			rotate_node(tree, node->parent, !dir);
-			sibling = node->parent->child[dir];
-		};
-
-		if ((!sibling->child[!dir] || sibling->child[!dir]->color ==
-		    RB_BLACK) &&
-		    (!sibling->child[dir] || sibling->child[dir]->color ==
-		    RB_BLACK)) {
+			parent->color = RB_RED;
+			rotate_node(tree, parent, dir);
+			sibling = parent->child[!dir];
+		}
+
+		if (is_black(sibling->child[RB_LEFT]) &&
+		    is_black(sibling->child[RB_RIGHT])) {
 			sibling->color = RB_RED;
-			node = node->parent;
+			node = parent;
+			parent = node->parent;
+
+			if (parent)
+				dir = parent->child[RB_RIGHT] == node;
+
 			continue;
 		}
 
-		if (!sibling->child[dir] || sibling->child[dir]->color ==
-		    RB_BLACK) {
+		if (is_black(sibling->child[!dir])) {
+			sibling->child[dir]->color = RB_BLACK;
 			sibling->color = RB_RED;
-			sibling->child[!dir]->color = RB_BLACK;
-			rotate_node(tree, node->parent, dir);
-			sibling = node->parent->child[dir];
+			rotate_node(tree, sibling, !dir);
+			sibling = parent->child[!dir];
 		}
 
-		sibling->color = node->parent->color;
-		node->parent->color = RB_BLACK;
-		sibling->child[dir]->color = RB_BLACK;
-		rotate_node(tree, node->parent, !dir);
-
+		sibling->color = parent->color;
+		parent->color = RB_BLACK;
+		sibling->child[!dir]->color = RB_BLACK;
+		rotate_node(tree, parent, dir);
 		node = tree->root;
+		break;
 	}
 
 	if (node)
 		node->color = RB_BLACK;
+}
+
+int rb_remove(struct rb_tree *tree, struct rb_node *node)
+{
+	struct rb_node *parent, *child, *prev;
+	enum rb_color color;
+	enum rb_dir dir;
+
+	if (!tree || !node)
+		return -1;
+
+	if (node->child[RB_LEFT] && node->child[RB_RIGHT]) {
+		/* Move the in-order predecessor, which has no right child, into
+		 * the place of the node. The tree then loses a node where the
+		 * predecessor used to be.
+		 */
+		prev = get_outermost(node->child[RB_LEFT], RB_RIGHT);
+		child = prev->child[RB_LEFT];
+		color = prev->color;
+
+		if (prev->parent == node) {
+			parent = prev;
+			dir = RB_LEFT;
+		} else {
+			parent = prev->parent;
+			dir = RB_RIGHT;
+			parent->child[RB_RIGHT] = child;
+
+			if (child)
+				child->parent = parent;
+
+			prev->child[RB_LEFT] = node->child[RB_LEFT];
+			prev->child[RB_LEFT]->parent = prev;
+		}
+
+		prev->child[RB_RIGHT] = node->child[RB_RIGHT];
+		prev->child[RB_RIGHT]->parent = prev;
+		prev->color = node->color;
+		replace_child(tree, node, prev);
+	} else {
+		child = node->child[!node->child[RB_LEFT]];
+		parent = node->parent;
+		color = node->color;
+		dir = parent && parent->child[RB_RIGHT] == node;
+		replace_child(tree, node, child);
+	}
+
+	rb_augment_propagate(tree, parent);
+
+	if (color == RB_BLACK)
+		remove_fixup(tree, child, parent, dir);
+
+	memset(node, 0, sizeof *node);
 
 	return 0;
 }
@@ -253,7 +276,182 @@ int rb_replace(struct rb_tree *tree, struct rb_node *node,
 		node->child[RB_RIGHT]->parent = new_node;
 
 	*new_node = *node;
+	rb_augment_propagate(tree, new_node);
 
 	return 0;
 }
 
+/* Links the node into the tree in order of cmp, after any nodes that compare
+ * equal, and rebalances the tree.
+ */
+int rb_insert(struct rb_tree *tree, struct rb_node *node,
+	int (*cmp)(struct rb_node *lhs, struct rb_node *rhs))
+{
+	struct rb_node *parent = NULL, **link;
+
+	if (!tree || !node)
+		return -1;
+
+	link = &tree->root;
+
+	while (*link) {
+		parent = *link;
+		link = parent->child + (cmp(node, parent) >= 0);
+	}
+
+	node->parent = parent;
+	node->child[RB_LEFT] = NULL;
+	node->child[RB_RIGHT] = NULL;
+	*link = node;
+
+	rb_augment_propagate(tree, node);
+
+	return rb_balance(tree, node);
+}
+
+/* Looks up a node that compares equal to the key, where cmp returns a
+ * negative number, zero or a positive number if the key is less than, equal
+ * to or greater than the key of the node.
+ *
+ * Returns the node or NULL if there is no such node.
+ */
+struct rb_node *rb_find(struct rb_tree *tree, const void *key,
+	int (*cmp)(const void *key, struct rb_node *node))
+{
+	struct rb_node *node = tree->root;
+	int ret;
+
+	while (node) {
+		ret = cmp(key, node);
+
+		if (ret == 0)
+			return node;
+
+		node = node->child[ret > 0];
+	}
+
+	return NULL;
+}
+
+/* Looks up the first node that does not compare less than the key.
+ *
+ * Returns the node or NULL if all nodes compare less than the key.
+ */
+struct rb_node *rb_lower_bound(struct rb_tree *tree, const void *key,
+	int (*cmp)(const void *key, struct rb_node *node))
+{
+	struct rb_node *node = tree->root, *bound = NULL;
+
+	while (node) {
+		if (cmp(key, node) <= 0) {
+			bound = node;
+			node = node->child[RB_LEFT];
+		} else {
+			node = node->child[RB_RIGHT];
+		}
+	}
+
+	return bound;
+}
+
+/* Links the nodes of the sorted array [first, first + n) into a balanced
+ * subtree of the given depth and returns its root. The nodes on the deepest
+ * level, which is not necessarily full, are red and all others are black,
+ * such that every path has the same number of black nodes.
+ */
+static struct rb_node *build_subtree(struct rb_tree *tree, char *first,
+	size_t n, size_t size, size_t offset, size_t depth, size_t red_depth)
+{
+	struct rb_node *node, *child;
+	size_t mid = n / 2;
+	enum rb_dir dir;
+
+	if (n == 0)
+		return NULL;
+
+	node = (struct rb_node *)(first + mid * size + offset);
+	node->color = depth == red_depth ? RB_RED : RB_BLACK;
+
+	for (dir = RB_LEFT; dir <= RB_RIGHT; ++dir) {
+		child = dir == RB_LEFT ?
+			build_subtree(tree, first, mid, size, offset,
+				depth + 1, red_depth) :
+			build_subtree(tree, first + (mid + 1) * size,
+				n - mid - 1, size, offset, depth + 1,
+				red_depth);
+		node->child[dir] = child;
+
+		if (child)
+			child->parent = node;
+	}
+
+	if (tree->augment)
+		tree->augment(node);
+
+	return node;
+}
+
+/* Builds the tree from an array of n objects of size bytes each, sorted in
+ * order, that have their struct rb_node at the given offset. The tree must be
+ * empty. This takes O(n) time without any rotations.
+ */
+int rb_build(struct rb_tree *tree, void *base, size_t n, size_t size,
+	size_t offset)
+{
+	size_t red_depth = 0;
+
+	if (!tree || tree->root)
+		return -1;
+
+	/* The levels above red_depth are full. */
+	while (((size_t)2 << red_depth) - 1 <= n)
+		++red_depth;
+
+	tree->root = build_subtree(tree, base, n, size, offset, 0, red_depth);
+
+	if (tree->root) {
+		tree->root->parent = NULL;
+		tree->root->color = RB_BLACK;
+	}
+
+	return 0;
+}
+
+/* Descends to the leftmost node of the subtree, pushing the nodes on the way
+ * onto the stack of the iterator.
+ */
+static void iter_push_left(struct rb_iter *iter, struct rb_node *node)
+{
+	for (; node; node = node->child[RB_LEFT]) {
+		assert(iter->depth < RB_ITER_DEPTH);
+		iter->stack[iter->depth++] = node;
+	}
+
+	/* Fetch the node that will be returned next ahead of time. */
+	if (iter->depth)
+		__builtin_prefetch(iter->stack[iter->depth - 1]);
+}
+
+/* Sets up the iterator to walk the tree in order. */
+void rb_iter_init(struct rb_iter *iter, struct rb_tree *tree)
+{
+	iter->depth = 0;
+	iter_push_left(iter, tree->root);
+}
+
+/* Returns the next node in order, or NULL once all nodes have been visited.
+ * Unlike rb_next(), this never walks back up through the parent pointers. The
+ * tree must not be modified while iterating.
+ */
+struct rb_node *rb_iter_next(struct rb_iter *iter)
+{
+	struct rb_node *node;
+
+	if (!iter->depth)
+		return NULL;
+
+	node = iter->stack[--iter->depth];
+	iter_push_left(iter, node->child[RB_RIGHT]);
+
+	return node;
+}
@@ -1,6 +1,10 @@
 /* Basic string routines.  Not hardware optimized, but not shabby. */
 
 #include <string.h>
+#include <x86-64/asm.h>
+
+#include <kernel/cpufeature.h>
+#include <kernel/static_call.h>
 
 /*
  * Using assembly for memset/memmove makes some difference on real hardware,
@@ -113,25 +117,137 @@ char *strfind(const char *s, char c)
 }
 
 #if ASM
-void *memset(void *v, int c, size_t n)
+/*
+ * The memset() and memcpy() implementations are static calls that
+ * string_init() patches at boot based on what the CPU supports. The default
+ * implementations use rep stosq and rep movsq, which work on any x86-64 CPU.
+ * On CPUs with enhanced rep movsb/stosb (ERMS), plain rep stosb and rep movsb
+ * are at least as fast and get rid of the tail handling.
+ *
+ * SSE and AVX are not used, as the kernel is built with -mno-sse and does not
+ * save the extended register state.
+ */
+
+/* Fills of at least this many bytes use non-temporal stores, as they would
+ * otherwise evict most of the cache. */
+#define MEMSET_NT_MIN (1024 * 1024)
+
+static uint64_t memset_word(int c)
 {
-	char *p;
+	return (uint8_t)c * UINT64_C(0x0101010101010101);
+}
+
+static void *memset_stosq(void *v, int c, size_t n)
+{
+	uint64_t word = memset_word(c);
+	size_t nwords = n / 8, nbytes = n % 8;
+	void *p = v;
+
+	asm volatile("rep stosq\n"
+		: "+D" (p), "+c" (nwords) : "a" (word) : "memory");
+	asm volatile("rep stosb\n"
+		: "+D" (p), "+c" (nbytes) : "a" (word) : "memory");
+
+	return v;
+}
+
+static void *memset_ermsb(void *v, int c, size_t n)
+{
+	void *p = v;
+
+	asm volatile("rep stosb\n"
+		: "+D" (p), "+c" (n) : "a" (c) : "memory");
 
-	if (n == 0)
-		return v;
-	if ((uintptr_t)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
 	return v;
 }
 
+static void *memcpy_movsq(void *dst, const void *src, size_t n)
+{
+	size_t nwords = n / 8, nbytes = n % 8;
+	const void *s = src;
+	void *d = dst;
+
+	asm volatile("rep movsq\n"
+		: "+D" (d), "+S" (s), "+c" (nwords) :: "memory");
+	asm volatile("rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (nbytes) :: "memory");
+
+	return dst;
+}
+
+static void *memcpy_ermsb(void *dst, const void *src, size_t n)
+{
+	const void *s = src;
+	void *d = dst;
+
+	asm volatile("rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (n) :: "memory");
+
+	return dst;
+}
+
+DEFINE_STATIC_CALL(memset_impl, memset_stosq);
+DEFINE_STATIC_CALL(memcpy_impl, memcpy_movsq);
+
+/* Selects the fastest memset() and memcpy() implementations for this CPU. This
+ * has to run after cpu_features_init() and before the APs are started.
+ */
+void string_init(void)
+{
+	if (cpu_has(CPU_FEATURE_ERMS)) {
+		static_call_update(memset_impl, memset_ermsb);
+		static_call_update(memcpy_impl, memcpy_ermsb);
+	}
+}
+
+/* Like memset(), but uses non-temporal stores that bypass the cache. Use this
+ * for large regions, such as pages that are being zeroed in advance, that are
+ * not going to be accessed again soon.
+ */
+void *memset_nt(void *v, int c, size_t n)
+{
+	uint64_t word = memset_word(c);
+	size_t head;
+	char *p = v;
+
+	/* Align the destination for the quadword stores. */
+	head = MIN(n, -(uintptr_t)p & 7);
+	static_call(memset_impl)(p, c, head);
+	p += head;
+	n -= head;
+
+	for (; n >= 32; n -= 32, p += 32) {
+		asm volatile("movnti %1, 0(%0)\n"
+			"movnti %1, 8(%0)\n"
+			"movnti %1, 16(%0)\n"
+			"movnti %1, 24(%0)\n"
+			:: "r" (p), "r" (word) : "memory");
+	}
+
+	for (; n >= 8; n -= 8, p += 8)
+		asm volatile("movnti %1, (%0)\n" :: "r" (p), "r" (word) : "memory");
+
+	static_call(memset_impl)(p, c, n);
+
+	/* Non-temporal stores are weakly ordered. */
+	asm volatile("sfence\n" ::: "memory");
+
+	return v;
+}
+
+void *memset(void *v, int c, size_t n)
+{
+	if (n >= MEMSET_NT_MIN)
+		return memset_nt(v, c, n);
+
+	return static_call(memset_impl)(v, c, n);
+}
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+	return static_call(memcpy_impl)(dst, src, n);
+}
+
 void *memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
@@ -139,25 +255,29 @@ void *memmove(void *dst, const void *src, size_t n)
 
 	s = src;
 	d = dst;
-	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((uintptr_t)s%4 == 0 && (uintptr_t)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		/* Some versions of GCC rely on DF being clear. */
-		asm volatile("cld" ::: "cc");
+
+	if (!(s < d && s + n > d))
+		return static_call(memcpy_impl)(dst, src, n);
+
+	/* The regions overlap with the destination last: copy backwards. */
+	s += n;
+	d += n;
+
+	if ((uintptr_t)s%8 == 0 && (uintptr_t)d%8 == 0 && n%8 == 0) {
+		d -= 8;
+		s -= 8;
+		n /= 8;
+		asm volatile("std; rep movsq\n"
+			: "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
 	} else {
-		if ((uintptr_t)s%4 == 0 && (uintptr_t)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+		--d;
+		--s;
+		asm volatile("std; rep movsb\n"
+			: "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
 	}
+	/* Some versions of GCC rely on DF being clear. */
+	asm volatile("cld" ::: "cc");
+
 	return dst;
 }
 
@@ -194,13 +314,22 @@ void *memmove(void *dst, const void *src, size_t n)
 
 	return dst;
 }
-#endif
 
 void *memcpy(void *dst, const void *src, size_t n)
 {
 	return memmove(dst, src, n);
 }
 
+void string_init(void)
+{
+}
+
+void *memset_nt(void *v, int c, size_t n)
+{
+	return memset(v, c, n);
+}
+#endif
+
 int memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;